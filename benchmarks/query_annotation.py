@@ -0,0 +1,40 @@
+import pyndri
+import sys
+import timeit
+
+if len(sys.argv) <= 2:
+    print('Usage: python {0} <path-to-indri-index> <path-to-queries> '
+          '[<results-requested>] [<repeats>]'.format(sys.argv[0]))
+
+    sys.exit(0)
+
+index = pyndri.Index(sys.argv[1])
+
+# One query per line.
+with open(sys.argv[2], 'r', encoding='latin1') as f:
+    queries = [line.strip() for line in f if line.strip()]
+
+results_requested = int(sys.argv[3]) if len(sys.argv) > 3 else 1000
+repeats = int(sys.argv[4]) if len(sys.argv) > 4 else 5
+
+
+def run(annotate):
+    for query in queries:
+        index.query(query,
+                    results_requested=results_requested,
+                    annotate=annotate)
+
+
+# Warm up the page cache.
+run(annotate=False)
+
+annotated = min(timeit.repeat(lambda: run(annotate=True),
+                              number=1, repeat=repeats))
+lean = min(timeit.repeat(lambda: run(annotate=False),
+                         number=1, repeat=repeats))
+
+print('annotated: {:.3f} ms/query'.format(1000.0 * annotated / len(queries)))
+print('lean: {:.3f} ms/query'.format(1000.0 * lean / len(queries)))
+print('saving: {:.3f} ms/query ({:.1f}%)'.format(
+    1000.0 * (annotated - lean) / len(queries),
+    100.0 * (annotated - lean) / annotated))
@@ -0,0 +1,178 @@
+import bisect
+import itertools
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import pyndri
+
+if len(sys.argv) <= 1:
+    print('Usage: python {0} <num-documents> [<document-length>] '
+          '[<vocabulary-size>] [<num-queries>] [<seed>]'.format(sys.argv[0]))
+
+    sys.exit(0)
+
+num_documents = int(sys.argv[1])
+document_length = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+vocabulary_size = int(sys.argv[3]) if len(sys.argv) > 3 else 50000
+num_queries = int(sys.argv[4]) if len(sys.argv) > 4 else 1000
+seed = int(sys.argv[5]) if len(sys.argv) > 5 else 0
+
+num_startup_repetitions = 25
+
+INDRI_CONFIG = """<parameters>
+<index>index/</index>
+<memory>1024M</memory>
+<storeDocs>true</storeDocs>
+<corpus><path>corpus.trectext</path><class>trectext</class></corpus>
+<stemmer><name>krovetz</name></stemmer>
+</parameters>"""
+
+rng = random.Random(seed)
+
+
+def word(rank):
+    letters = []
+
+    while True:
+        rank, letter = divmod(rank, 26)
+        letters.append(chr(ord('a') + letter))
+
+        if rank == 0:
+            return 'q' + ''.join(letters)
+
+
+# Term frequencies follow Zipf's law.
+vocabulary = [word(rank) for rank in range(vocabulary_size)]
+cumulative_weights = list(itertools.accumulate(
+    1.0 / rank for rank in range(1, vocabulary_size + 1)))
+
+
+def sample_terms(n):
+    return [vocabulary[bisect.bisect(cumulative_weights,
+                                     rng.random() * cumulative_weights[-1])]
+            for _ in range(n)]
+
+
+def measure(name, function, count=None):
+    start = time.perf_counter()
+    result = function()
+    elapsed = time.perf_counter() - start
+
+    if count:
+        print('{}: {:.3f} s ({:.1f} us per item)'.format(
+            name, elapsed, 1e6 * elapsed / count))
+    else:
+        print('{}: {:.3f} s'.format(name, elapsed))
+
+    return result
+
+
+test_dir = tempfile.mkdtemp()
+
+try:
+    with open(os.path.join(test_dir, 'corpus.trectext'),
+              'w', encoding='latin1') as f:
+        for i in range(num_documents):
+            f.write('<DOC>\n<DOCNO>doc{}</DOCNO>\n<TEXT>\n{}\n</TEXT>\n</DOC>\n'
+                    .format(i, ' '.join(sample_terms(document_length))))
+
+    with open(os.path.join(test_dir, 'IndriBuildIndex.conf'), 'w') as f:
+        f.write(INDRI_CONFIG)
+
+    with open(os.devnull, 'w') as f:
+        measure('IndriBuildIndex', lambda: subprocess.check_call(
+            ['IndriBuildIndex', 'IndriBuildIndex.conf'],
+            stdout=f, cwd=test_dir))
+
+    queries = [' '.join(sample_terms(rng.randint(1, 4)))
+               for _ in range(num_queries)]
+
+    index_path = os.path.join(test_dir, 'index')
+
+    # Components are opened lazily; compare against opening all of them
+    # eagerly, or only the one a job reading document lengths needs. Every
+    # mode is opened once beforehand, so that all of them find the files in
+    # the page cache, and then repeatedly in shuffled order.
+    startup_modes = [
+        ('open all components', {'components': ['index', 'collection', 'query']}),
+        ('open lazily', {}),
+        ('open index component only', {'components': ['index']}),
+    ]
+
+    def startup_time(kwargs):
+        start = time.perf_counter()
+
+        startup_index = pyndri.Index(index_path, **kwargs)
+        startup_index.document_length(1)
+
+        elapsed = time.perf_counter() - start
+
+        del startup_index
+
+        return elapsed
+
+    for _, kwargs in startup_modes:
+        startup_time(kwargs)
+
+    startup_timings = dict((name, []) for name, _ in startup_modes)
+
+    for _ in range(num_startup_repetitions):
+        for name, kwargs in rng.sample(startup_modes, len(startup_modes)):
+            startup_timings[name].append(startup_time(kwargs))
+
+    for name, _ in startup_modes:
+        timings = sorted(startup_timings[name])
+
+        print('{}: {:.3f} ms (median of {})'.format(
+            name, 1000.0 * timings[len(timings) // 2], len(timings)))
+
+    index = measure('open', lambda: pyndri.Index(index_path))
+    measure('open index component', index.document_base)
+
+    index.set_instrumentation()
+
+    document_ids = range(index.document_base(), index.maximum_document())
+
+    measure('document', lambda: [index.document(document_id)
+                                 for document_id in document_ids],
+            count=len(document_ids))
+    measure('iter_documents', lambda: list(index.iter_documents()),
+            count=len(document_ids))
+    measure('document_range', lambda: index.document_range(
+        index.document_base(), index.maximum_document()),
+        count=len(document_ids))
+
+    measure('get_dictionary', index.get_dictionary)
+    measure('vocabulary', index.vocabulary)
+
+    # Warm up the query environment and the term bounds.
+    index.set_instrumentation(False)
+
+    for query in queries:
+        index.wand_query(query)
+
+    index.set_instrumentation()
+
+    measure('query', lambda: [index.query(query) for query in queries],
+            count=len(queries))
+    measure('wand_query', lambda: [index.wand_query(query) for query in queries],
+            count=len(queries))
+    measure('batch_query', lambda: index.batch_query(queries),
+            count=len(queries))
+
+    statistics = index.instrumentation_stats()
+
+    for phase, phase_statistics in sorted(statistics['phases'].items()):
+        if phase_statistics['calls']:
+            print('{}: {} calls, {:.3f} s'.format(
+                phase, phase_statistics['calls'], phase_statistics['seconds']))
+
+    for counter, value in sorted(statistics['counters'].items()):
+        print('{}: {}'.format(counter, value))
+finally:
+    shutil.rmtree(test_dir)
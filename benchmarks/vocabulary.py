@@ -0,0 +1,34 @@
+import pyndri
+import sys
+import timeit
+
+if len(sys.argv) <= 1:
+    print('Usage: python {0} <path-to-indri-index> [<repeats>]'.format(
+        sys.argv[0]))
+
+    sys.exit(0)
+
+index = pyndri.Index(sys.argv[1])
+
+repeats = int(sys.argv[2]) if len(sys.argv) > 2 else 5
+
+
+def dictionaries():
+    index.get_dictionary()
+    index.get_term_frequencies()
+
+
+def arrays():
+    index.vocabulary()
+
+
+# Warm up the page cache.
+arrays()
+
+separate = min(timeit.repeat(dictionaries, number=1, repeat=repeats))
+single_pass = min(timeit.repeat(arrays, number=1, repeat=repeats))
+
+print('{} terms'.format(index.unique_terms()))
+print('get_dictionary + get_term_frequencies: {:.3f} s'.format(separate))
+print('vocabulary: {:.3f} s'.format(single_pass))
+print('speedup: {:.1f}x'.format(separate / single_pass))
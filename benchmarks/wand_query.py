@@ -0,0 +1,66 @@
+import pyndri
+import sys
+import time
+
+if len(sys.argv) <= 2:
+    print('Usage: python {0} <path-to-indri-index> <path-to-queries> '
+          '[<results-requested>]'.format(sys.argv[0]))
+
+    sys.exit(0)
+
+index = pyndri.Index(sys.argv[1])
+
+# One bag-of-words query per line.
+with open(sys.argv[2], 'r', encoding='latin1') as f:
+    queries = [line.strip() for line in f if line.strip()]
+
+results_requested = int(sys.argv[3]) if len(sys.argv) > 3 else 1000
+
+
+def benchmark(run_query):
+    latencies = []
+    results = []
+
+    for query in queries:
+        start = time.perf_counter()
+        results.append(run_query(query))
+        latencies.append(time.perf_counter() - start)
+
+    latencies.sort()
+
+    return results, latencies
+
+
+def report(name, latencies):
+    print('{}: mean {:.3f} ms, median {:.3f} ms, p99 {:.3f} ms'.format(
+        name,
+        1000.0 * sum(latencies) / len(latencies),
+        1000.0 * latencies[len(latencies) // 2],
+        1000.0 * latencies[min(len(latencies) - 1,
+                               int(0.99 * len(latencies)))]))
+
+
+# Warm up the page cache and the term bounds.
+for query in queries:
+    index.wand_query(query, results_requested=results_requested)
+
+query_results, query_latencies = benchmark(
+    lambda query: index.query(query, results_requested=results_requested))
+wand_results, wand_latencies = benchmark(
+    lambda query: index.wand_query(query, results_requested=results_requested))
+
+report('query', query_latencies)
+report('wand_query', wand_latencies)
+
+identical = sum(
+    1 for expected, actual in zip(query_results, wand_results)
+    if [doc_id for doc_id, _ in expected] == [doc_id for doc_id, _ in actual])
+
+max_score_difference = max(
+    [abs(expected_score - actual_score)
+     for expected, actual in zip(query_results, wand_results)
+     for (_, expected_score), (_, actual_score) in zip(expected, actual)] +
+    [0.0])
+
+print('{}/{} rankings identical; maximum score difference {:g}.'.format(
+    identical, len(queries), max_score_difference))
@@ -11,8 +11,13 @@ index = pyndri.Index(sys.argv[1])
 
 results = index.query('hello world', results_requested=10)
 
-for int_document_id, score in results:
-    ext_document_id, _ = index.document(int_document_id)
+blob, offsets = index.docnos(
+    [int_document_id for int_document_id, _ in results])
+offsets = offsets.tolist()
+
+for (int_document_id, score), begin, end in zip(
+        results, offsets, offsets[1:]):
+    ext_document_id = blob[begin:end].decode('latin1')
 
     print('Document {ext_document_id} retrieved with score {score}.'.format(
         ext_document_id=ext_document_id, score=score))
@@ -1,8 +1,6 @@
 import pyndri
 import sys
 
-import numpy as np
-
 if len(sys.argv) <= 1:
     print('Usage: python {0} <path-to-indri-index> [<index-name>]'.format(
         sys.argv[0]))
@@ -11,19 +9,11 @@ if len(sys.argv) <= 1:
 
 index = pyndri.Index(sys.argv[1])
 
-num_documents = 0
-mean = 0.0
-M2 = 0.0
-
-for document_id in range(index.document_base(), index.maximum_document()):
-    x = float(index.document_length(document_id))
-
-    num_documents += 1
-    delta = x - mean
-    mean += delta / num_documents
-    M2 += delta * (x - mean)
+statistics = index.document_length_statistics()
 
-std = np.sqrt(M2 / (num_documents - 1))
+num_documents = statistics['num_documents']
+mean = statistics['mean']
+std = statistics['std']
 
 prefix = '' if len(sys.argv) == 2 else '{}_'.format(sys.argv[2].upper())
 
@@ -3,7 +3,12 @@ from pyndri_ext import *
 
 __all__ = [
     'Index',
+    'ShardedIndex',
+    'Array',
     'Dictionary',
+    'DictionarySnapshot',
     'extract_dictionary',
     'stem',
+    'set_async_concurrency',
+    'async_stats',
 ]
@@ -1,9 +1,13 @@
 import collections
+import collections.abc
+import mmap
 import pyndri
 import logging
+import struct
 
 __all__ = [
     'Dictionary',
+    'DictionarySnapshot',
     'extract_dictionary',
 ]
 
@@ -25,6 +29,19 @@ class Dictionary(object):
 
         self.krovetz_stemming = krovetz_stemming
 
+    @classmethod
+    def from_snapshot(cls, path, krovetz_stemming=True):
+        """
+        Memory-maps a dictionary snapshot written by Index.export_dictionary.
+
+        Lookups are answered lazily from the mapping, such that processes
+        loading the same snapshot share a single page-cache copy.
+        """
+        snapshot = DictionarySnapshot(path)
+
+        return cls(snapshot.token2id, snapshot.id2token, snapshot.id2df,
+                   krovetz_stemming=krovetz_stemming)
+
     def __getitem__(self, token_id):
         return self.id2token[token_id]
 
@@ -94,6 +111,164 @@ class Dictionary(object):
         return sorted(counter.items())
 
 
+class DictionarySnapshot(object):
+    """
+    Read-only, memory-mapped view of a dictionary snapshot.
+
+    See Index.export_dictionary for the file layout.
+    """
+
+    MAGIC = b'PYNDRIDC'
+    VERSION = 1
+
+    HEADER = struct.Struct('=8sIIQQQ')
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self._mmap = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        magic, version, _, num_terms, max_term_id, blob_size = \
+            self.HEADER.unpack_from(self._mmap)
+
+        if magic != self.MAGIC:
+            raise IOError('{} is not a dictionary snapshot.'.format(path))
+
+        if version != self.VERSION:
+            raise IOError('Unsupported dictionary snapshot version {}.'.format(
+                version))
+
+        self.num_terms = num_terms
+        self.max_term_id = max_term_id
+
+        view = memoryview(self._mmap)
+        offset = self.HEADER.size
+
+        def take(fmt, count):
+            nonlocal offset
+
+            size = struct.calcsize(fmt) * count
+            array = view[offset:offset + size].cast(fmt)
+            offset += size
+
+            return array
+
+        self._offsets = take('Q', num_terms + 1)
+        self._dfs = take('Q', max_term_id + 1)
+        self._cfs = take('Q', max_term_id + 1)
+        self._term_ids = take('I', num_terms)
+        self._ranks = take('I', max_term_id + 1)
+        self._blob = view[offset:offset + blob_size]
+
+        self.token2id = _SnapshotTokenToId(self)
+        self.id2token = _SnapshotIdToToken(self)
+        self.id2df = _SnapshotIdToCount(self, self._dfs)
+        self.id2cf = _SnapshotIdToCount(self, self._cfs)
+
+    def _term(self, rank):
+        return bytes(
+            self._blob[self._offsets[rank]:self._offsets[rank + 1]])
+
+    def _rank(self, token_id):
+        if not isinstance(token_id, int) or \
+                token_id < 0 or token_id > self.max_term_id:
+            return None
+
+        rank = self._ranks[token_id]
+
+        return None if rank == 0xFFFFFFFF else rank
+
+    def _find(self, token):
+        try:
+            term = token.encode('latin1')
+        except (AttributeError, UnicodeEncodeError):
+            return None
+
+        lo, hi = 0, self.num_terms
+
+        while lo < hi:
+            mid = (lo + hi) // 2
+
+            if self._term(mid) < term:
+                lo = mid + 1
+            else:
+                hi = mid
+
+        if lo < self.num_terms and self._term(lo) == term:
+            return self._term_ids[lo]
+
+        return None
+
+
+class _SnapshotTokenToId(collections.abc.Mapping):
+
+    def __init__(self, snapshot):
+        self._snapshot = snapshot
+
+    def __getitem__(self, token):
+        token_id = self._snapshot._find(token)
+
+        if token_id is None:
+            raise KeyError(token)
+
+        return token_id
+
+    def __contains__(self, token):
+        return self._snapshot._find(token) is not None
+
+    def __iter__(self):
+        for rank in range(self._snapshot.num_terms):
+            yield self._snapshot._term(rank).decode('latin1')
+
+    def __len__(self):
+        return self._snapshot.num_terms
+
+
+class _SnapshotIdToToken(collections.abc.Mapping):
+
+    def __init__(self, snapshot):
+        self._snapshot = snapshot
+
+    def __getitem__(self, token_id):
+        rank = self._snapshot._rank(token_id)
+
+        if rank is None:
+            raise KeyError(token_id)
+
+        return self._snapshot._term(rank).decode('latin1')
+
+    def __contains__(self, token_id):
+        return self._snapshot._rank(token_id) is not None
+
+    def __iter__(self):
+        for rank in range(self._snapshot.num_terms):
+            yield self._snapshot._term_ids[rank]
+
+    def __len__(self):
+        return self._snapshot.num_terms
+
+
+class _SnapshotIdToCount(collections.abc.Mapping):
+
+    def __init__(self, snapshot, counts):
+        self._snapshot = snapshot
+        self._counts = counts
+
+    def __getitem__(self, token_id):
+        if self._snapshot._rank(token_id) is None:
+            raise KeyError(token_id)
+
+        return self._counts[token_id]
+
+    def __contains__(self, token_id):
+        return self._snapshot._rank(token_id) is not None
+
+    def __iter__(self):
+        return iter(self._snapshot.id2token)
+
+    def __len__(self):
+        return self._snapshot.num_terms
+
+
 def extract_dictionary(index):
     assert isinstance(index, pyndri.Index)
 
@@ -1,15 +1,39 @@
 #include <Python.h>
 #include "structmember.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
 #include <string>
 #include <iostream>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <indri/CompressedCollection.hpp>
 #include <indri/DiskIndex.hpp>
+#include <indri/DocListIterator.hpp>
 #include <indri/KrovetzStemmer.hpp>
 #include <indri/QueryEnvironment.hpp>
+#include <indri/TextTokenizer.hpp>
 #include <indri/Path.hpp>
+#include <indri/Mutex.hpp>
+#include <indri/ScopedLock.hpp>
+#include <indri/ConditionVariable.hpp>
+#include <indri/Thread.hpp>
 #include "indri/SnippetBuilder.hpp"
 
 using std::string;
@@ -21,562 +45,9230 @@ using std::string;
 #define CHECK_GT(first, second) assert(first > second)
 #define CHECK_GE(first, second) assert(first >= second)
 
+// Serializes the methods of stateful objects under free-threaded CPython,
+// where the GIL no longer does.
+#if PY_VERSION_HEX >= 0x030D0000
+#define BEGIN_CRITICAL_SECTION(object) Py_BEGIN_CRITICAL_SECTION(object)
+#define END_CRITICAL_SECTION() Py_END_CRITICAL_SECTION()
+#else
+#define BEGIN_CRITICAL_SECTION(object) {
+#define END_CRITICAL_SECTION() }
+#endif
+
+// Threading.
+
+static size_t default_num_threads() {
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return num_cpus > 0 ? static_cast<size_t>(num_cpus) : 1;
+}
+
+// Boolean that threads set and test without holding a lock.
+class AtomicFlag {
+ public:
+    explicit AtomicFlag(const bool value = false) : value_(value) {}
+
+    bool get() const {
+        return __atomic_load_n(&value_, __ATOMIC_ACQUIRE);
+    }
+
+    void set(const bool value) {
+        __atomic_store_n(&value_, value, __ATOMIC_RELEASE);
+    }
+
+ private:
+    bool value_;
+};
+
+// Hands out the work items [0, size) to worker threads, one at a time.
+class WorkQueue {
+ public:
+    explicit WorkQueue(const size_t size) : next_(0), size_(size) {}
+
+    bool next(size_t* const item) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (next_ >= size_) {
+            return false;
+        }
+
+        *item = next_++;
+
+        return true;
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    size_t next_;
+    const size_t size_;
+};
+
+// Runs every function(data[i]) on its own thread and blocks until all
+// threads have finished. Callers must not hold the GIL.
+template <typename T>
+static void run_threads(void (*function)(void*), std::vector<T>* const data) {
+    if (data->size() == 1) {
+        function(&(*data)[0]);
+
+        return;
+    }
+
+    std::vector<indri::thread::Thread*> threads;
+
+    for (size_t i = 0; i < data->size(); ++i) {
+        threads.push_back(new indri::thread::Thread(function, &(*data)[i]));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i]->join();
+
+        delete threads[i];
+    }
+}
+
+// Long-lived pool of worker threads that process submitted tasks in FIFO
+// order, at most max_in_flight at a time; threads are only started as the
+// limit requires. Tasks are processed by process(task), which is called
+// without the GIL.
+class TaskExecutor {
+ public:
+    TaskExecutor(void (*process)(void*), const size_t max_in_flight)
+        : process_(process), max_in_flight_(0), running_(0) {
+        set_max_in_flight(max_in_flight);
+    }
+
+    void submit(void* const task) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        queue_.push_back(task);
+        condition_.notifyOne();
+    }
+
+    void set_max_in_flight(const size_t max_in_flight) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        max_in_flight_ = max_in_flight;
+
+        // Threads are kept for the lifetime of the process.
+        while (threads_.size() < max_in_flight_) {
+            threads_.push_back(new indri::thread::Thread(TaskExecutor::run, this));
+            threads_.back()->detach();
+        }
+
+        condition_.notifyAll();
+    }
+
+    void statistics(size_t* const max_in_flight,
+                    size_t* const running,
+                    size_t* const queued) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        *max_in_flight = max_in_flight_;
+        *running = running_;
+        *queued = queue_.size();
+    }
+
+ private:
+    static void run(void* data) {
+        static_cast<TaskExecutor*>(data)->work();
+    }
+
+    void work() {
+        for (;;) {
+            void* task;
+
+            {
+                indri::thread::ScopedLock lock(mutex_);
+
+                while (queue_.empty() || running_ >= max_in_flight_) {
+                    condition_.wait(mutex_);
+                }
+
+                task = queue_.front();
+                queue_.pop_front();
+
+                ++running_;
+            }
+
+            process_(task);
+
+            indri::thread::ScopedLock lock(mutex_);
+
+            --running_;
+            condition_.notifyAll();
+        }
+    }
+
+    void (* const process_)(void*);
+
+    indri::thread::Mutex mutex_;
+    indri::thread::ConditionVariable condition_;
+
+    std::vector<indri::thread::Thread*> threads_;
+    std::list<void*> queue_;
+
+    size_t max_in_flight_;
+    size_t running_;
+};
+
+// Executor of the asynchronous Index methods, created on first use. Both are
+// replaced in forked children, as the threads of the parent are not forked.
+static indri::thread::Mutex* async_executor_lock = new indri::thread::Mutex;
+static TaskExecutor* async_executor = NULL;
+
+// Lazily grown pool of QueryEnvironments over a single repository. An
+// environment is handed out to at most one thread at a time.
+class QueryEnvironmentPool {
+ public:
+    QueryEnvironmentPool() {}
+
+    ~QueryEnvironmentPool() {
+        for (size_t i = 0; i < environments_.size(); ++i) {
+            environments_[i]->close();
+
+            delete environments_[i];
+        }
+    }
+
+    void set_repository_path(const std::string& repository_path) {
+        repository_path_ = repository_path;
+    }
+
+    // Throws lemur::api::Exception if the repository cannot be opened.
+    indri::api::QueryEnvironment* acquire() {
+        {
+            indri::thread::ScopedLock lock(mutex_);
+
+            if (!idle_.empty()) {
+                indri::api::QueryEnvironment* const query_env = idle_.back();
+                idle_.pop_back();
+
+                return query_env;
+            }
+        }
+
+        indri::api::QueryEnvironment* const query_env =
+            new indri::api::QueryEnvironment;
+
+        try {
+            query_env->addIndex(repository_path_);
+        } catch (const lemur::api::Exception& e) {
+            delete query_env;
+
+            throw;
+        }
+
+        indri::thread::ScopedLock lock(mutex_);
+        environments_.push_back(query_env);
+
+        return query_env;
+    }
+
+    void release(indri::api::QueryEnvironment* const query_env) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        idle_.push_back(query_env);
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    std::string repository_path_;
+
+    std::vector<indri::api::QueryEnvironment*> environments_;
+    std::vector<indri::api::QueryEnvironment*> idle_;
+};
+
+// Lazily grown pool of DiskIndex handles over a single index, such that
+// threads can read from the index without sharing its file handles. A
+// handle is handed out to at most one thread at a time.
+class DiskIndexPool {
+ public:
+    DiskIndexPool() {}
+
+    ~DiskIndexPool() {
+        for (size_t i = 0; i < indexes_.size(); ++i) {
+            indexes_[i]->close();
+
+            delete indexes_[i];
+        }
+    }
+
+    void set_path(const std::string& repository_path, const std::string& index_path) {
+        repository_path_ = repository_path;
+        index_path_ = index_path;
+    }
+
+    // Throws lemur::api::Exception if the index cannot be opened.
+    indri::index::DiskIndex* acquire() {
+        {
+            indri::thread::ScopedLock lock(mutex_);
+
+            if (!idle_.empty()) {
+                indri::index::DiskIndex* const index = idle_.back();
+                idle_.pop_back();
+
+                return index;
+            }
+        }
+
+        indri::index::DiskIndex* const index = new indri::index::DiskIndex;
+
+        try {
+            index->open(repository_path_, index_path_);
+        } catch (const lemur::api::Exception& e) {
+            delete index;
+
+            throw;
+        }
+
+        indri::thread::ScopedLock lock(mutex_);
+        indexes_.push_back(index);
+
+        return index;
+    }
+
+    void release(indri::index::DiskIndex* const index) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        idle_.push_back(index);
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    std::string repository_path_;
+    std::string index_path_;
+
+    std::vector<indri::index::DiskIndex*> indexes_;
+    std::vector<indri::index::DiskIndex*> idle_;
+};
+
+// Holds a DiskIndex from a pool for the lifetime of the scope.
+class ScopedDiskIndex {
+ public:
+    // Throws lemur::api::Exception if the index cannot be opened.
+    explicit ScopedDiskIndex(DiskIndexPool* const pool)
+        : pool_(pool), index_(pool->acquire()) {}
+
+    ~ScopedDiskIndex() {
+        pool_->release(index_);
+    }
+
+    indri::index::DiskIndex* operator->() const {
+        return index_;
+    }
+
+    indri::index::DiskIndex* get() const {
+        return index_;
+    }
+
+ private:
+    DiskIndexPool* const pool_;
+    indri::index::DiskIndex* const index_;
+};
+
+// Stemming.
+
+// KrovetzStemmer keeps state between calls and is not safe to share between
+// threads; stemmers are pooled instead, such that threads stem concurrently.
+class KrovetzStemmerPool {
+ public:
+    ~KrovetzStemmerPool() {
+        for (size_t i = 0; i < stemmers_.size(); ++i) {
+            delete stemmers_[i];
+        }
+    }
+
+    indri::parse::KrovetzStemmer* acquire() {
+        {
+            indri::thread::ScopedLock lock(mutex_);
+
+            if (!idle_.empty()) {
+                indri::parse::KrovetzStemmer* const stemmer = idle_.back();
+                idle_.pop_back();
+
+                return stemmer;
+            }
+        }
+
+        indri::parse::KrovetzStemmer* const stemmer = new indri::parse::KrovetzStemmer;
+
+        indri::thread::ScopedLock lock(mutex_);
+        stemmers_.push_back(stemmer);
+
+        return stemmer;
+    }
+
+    void release(indri::parse::KrovetzStemmer* const stemmer) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        idle_.push_back(stemmer);
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    std::vector<indri::parse::KrovetzStemmer*> stemmers_;
+    std::vector<indri::parse::KrovetzStemmer*> idle_;
+};
+
+// Replaced in forked children, as the parent may have held its lock.
+static KrovetzStemmerPool* krovetz_stemmers = new KrovetzStemmerPool;
+
+// Stems the terms in place with a single stemmer from the pool.
+static void krovetz_stem(std::vector<std::string>* const terms) {
+    indri::parse::KrovetzStemmer* const stemmer = krovetz_stemmers->acquire();
+
+    std::vector<char> buffer;
+
+    for (size_t i = 0; i < terms->size(); ++i) {
+        buffer.assign((*terms)[i].begin(), (*terms)[i].end());
+        buffer.push_back('\0');
+
+        // The result points into the stemmer's own buffer.
+        (*terms)[i] = stemmer->kstem_stemmer(&buffer[0]);
+    }
+
+    krovetz_stemmers->release(stemmer);
+}
+
+static std::string krovetz_stem(const std::string& term) {
+    std::vector<std::string> terms(1, term);
+    krovetz_stem(&terms);
+
+    return terms[0];
+}
+
+// Splits a query into lowercase alphanumeric terms, as Indri's query parser
+// does for bag-of-words queries.
+static void tokenize_text(const std::string& text, std::vector<std::string>* const terms) {
+    std::string term;
+
+    for (size_t i = 0; i <= text.size(); ++i) {
+        const unsigned char c = i < text.size() ? text[i] : ' ';
+
+        if (isalnum(c) || c >= 0x80) {
+            term += tolower(c);
+        } else if (!term.empty()) {
+            terms->push_back(term);
+            term.clear();
+        }
+    }
+}
+
+// Indri's TextTokenizer is a flex scanner with global state, so documents
+// are tokenized one at a time. Replaced in forked children, as the parent
+// may have held the lock.
+static indri::thread::Mutex* text_tokenizer_lock = new indri::thread::Mutex;
+static indri::parse::TextTokenizer* text_tokenizer = NULL;
+
+// Splits the raw text of a document into terms as Indri does when indexing:
+// with Indri's TextTokenizer, which skips markup, after which terms are
+// normalized as by Indri's NormalizationTransformation, i.e., lowercased and
+// stripped of apostrophes and periods ("Who's" becomes "whos").
+static void tokenize_document(const std::string& text, std::vector<std::string>* const terms) {
+    indri::parse::UnparsedDocument document;
+    document.text = text.c_str();
+    document.textLength = text.size() + 1;
+    document.content = document.text;
+    document.contentLength = text.size();
+
+    {
+        indri::thread::ScopedLock lock(text_tokenizer_lock);
+
+        if (text_tokenizer == NULL) {
+            text_tokenizer = new indri::parse::TextTokenizer;
+        }
+
+        indri::parse::TokenizedDocument* const tokenized =
+            text_tokenizer->tokenize(&document);
+
+        for (size_t i = 0; i < tokenized->terms.size(); ++i) {
+            if (tokenized->terms[i] != NULL) {
+                terms->push_back(tokenized->terms[i]);
+            }
+        }
+    }
+
+    size_t num_terms = 0;
+
+    for (size_t i = 0; i < terms->size(); ++i) {
+        std::string term;
+
+        for (size_t j = 0; j < (*terms)[i].size(); ++j) {
+            const unsigned char c = (*terms)[i][j];
+
+            if (c != '\'' && c != '.') {
+                term += tolower(c);
+            }
+        }
+
+        if (!term.empty()) {
+            (*terms)[num_terms++].swap(term);
+        }
+    }
+
+    terms->resize(num_terms);
+}
+
+// Array
+
+// Type-erased owner of the memory exposed by an Array.
+class ArrayStorage {
+ public:
+    virtual ~ArrayStorage() {}
+};
+
+template <typename T>
+class VectorArrayStorage : public ArrayStorage {
+ public:
+    explicit VectorArrayStorage(std::vector<T>* const values) {
+        values_.swap(*values);
+    }
+
+    T* data() {
+        return values_.empty() ? NULL : &values_[0];
+    }
+
+ private:
+    std::vector<T> values_;
+};
+
+// Memory owned by another object, e.g. a sidecar mapped by an Index, which is
+// kept alive while exposed.
+class ObjectArrayStorage : public ArrayStorage {
+ public:
+    explicit ObjectArrayStorage(PyObject* const owner) : owner_(owner) {
+        Py_INCREF(owner_);
+    }
+
+    ~ObjectArrayStorage() {
+        Py_DECREF(owner_);
+    }
+
+ private:
+    PyObject* const owner_;
+};
+
+template <typename T> struct ArrayFormat {};
+template <> struct ArrayFormat<int8_t> { static const char* value() { return "b"; } };
+template <> struct ArrayFormat<uint8_t> { static const char* value() { return "B"; } };
+template <> struct ArrayFormat<int32_t> { static const char* value() { return "i"; } };
+template <> struct ArrayFormat<uint32_t> { static const char* value() { return "I"; } };
+template <> struct ArrayFormat<int64_t> { static const char* value() { return "q"; } };
+template <> struct ArrayFormat<uint64_t> { static const char* value() { return "Q"; } };
+template <> struct ArrayFormat<float> { static const char* value() { return "f"; } };
+template <> struct ArrayFormat<double> { static const char* value() { return "d"; } };
+
+// Read-only, C-contiguous and typed array of one or two dimensions that
+// exposes its memory through the buffer protocol; numpy.asarray wraps it
+// without copying.
+typedef struct {
+    PyObject_HEAD
+
+    ArrayStorage* storage_;
+
+    void* data_;
+    Py_ssize_t length_;  // Number of elements.
+    Py_ssize_t itemsize_;
+    const char* format_;
+
+    int ndim_;
+    Py_ssize_t shape_[2];
+    Py_ssize_t strides_[2];
+} Array;
+
+// Shapes the elements of an Array as a vector.
+static void Array_set_shape(Array* self) {
+    self->ndim_ = 1;
+    self->shape_[0] = self->length_;
+    self->strides_[0] = self->itemsize_;
+}
+
+// Shapes the elements of an Array as a row-major matrix.
+static void Array_set_shape(Array* self,
+                            const Py_ssize_t num_rows,
+                            const Py_ssize_t num_columns) {
+    self->ndim_ = 2;
+    self->shape_[0] = num_rows;
+    self->shape_[1] = num_columns;
+    self->strides_[0] = num_columns * self->itemsize_;
+    self->strides_[1] = self->itemsize_;
+}
+
+static void Array_dealloc(Array* self) {
+    delete self->storage_;
+
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static int Array_getbuffer(Array* self, Py_buffer* view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Array objects are read-only.");
+
+        view->obj = NULL;
+
+        return -1;
+    }
+
+    view->obj = (PyObject*) self;
+    view->buf = self->data_;
+    view->len = self->length_ * self->itemsize_;
+    view->readonly = 1;
+    view->itemsize = self->itemsize_;
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(self->format_) : NULL;
+    view->ndim = self->ndim_;
+    view->shape = (flags & PyBUF_ND) ? self->shape_ : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? self->strides_ : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    Py_INCREF(self);
+
+    return 0;
+}
+
+static Py_ssize_t Array_length(Array* self) {
+    return self->shape_[0];
+}
+
+// Returns a row of a matrix as an Array that shares its memory.
+static PyObject* Array_row(Array* self, const Py_ssize_t idx) {
+    Array* const row = PyObject_New(Array, Py_TYPE(self));
+
+    if (row == NULL) {
+        return NULL;
+    }
+
+    row->storage_ = new ObjectArrayStorage((PyObject*) self);
+    row->data_ = static_cast<char*>(self->data_) + idx * self->strides_[0];
+    row->length_ = self->shape_[1];
+    row->itemsize_ = self->itemsize_;
+    row->format_ = self->format_;
+
+    Array_set_shape(row);
+
+    return (PyObject*) row;
+}
+
+static PyObject* Array_item(Array* self, Py_ssize_t idx) {
+    if (idx < 0 || idx >= self->shape_[0]) {
+        PyErr_SetString(PyExc_IndexError, "Array index out of range.");
+
+        return NULL;
+    }
+
+    if (self->ndim_ > 1) {
+        return Array_row(self, idx);
+    }
+
+    PyObject* const view = PyMemoryView_FromObject((PyObject*) self);
+
+    if (view == NULL) {
+        return NULL;
+    }
+
+    PyObject* const item = PySequence_GetItem(view, idx);
+    Py_DECREF(view);
+
+    return item;
+}
+
+static PyObject* Array_tolist(Array* self) {
+    PyObject* const view = PyMemoryView_FromObject((PyObject*) self);
+
+    if (view == NULL) {
+        return NULL;
+    }
+
+    PyObject* const list = PyObject_CallMethod(view, "tolist", NULL);
+    Py_DECREF(view);
+
+    return list;
+}
+
+static PyObject* Array_get_format(Array* self, void* closure) {
+    return PyUnicode_FromString(self->format_);
+}
+
+static PyBufferProcs Array_as_buffer = {
+    (getbufferproc) Array_getbuffer,
+    NULL,
+};
+
+static PySequenceMethods Array_as_sequence = {
+    (lenfunc) Array_length,     /* sq_length */
+    0,                          /* sq_concat */
+    0,                          /* sq_repeat */
+    (ssizeargfunc) Array_item,  /* sq_item */
+};
+
+static PyMethodDef Array_methods[] = {
+    {"tolist", (PyCFunction) Array_tolist, METH_NOARGS,
+     "Returns the elements of the array as a list."},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Array_getset[] = {
+    {"format", (getter) Array_get_format, NULL,
+     "The struct-module format character of the array elements.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject ArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyndri.Array",             /* tp_name */
+    sizeof(Array),             /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) Array_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    &Array_as_sequence,        /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    &Array_as_buffer,          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "Read-only array objects supporting the buffer protocol", /* tp_doc */
+    0,                   /* tp_traverse */
+    0,                   /* tp_clear */
+    0,                   /* tp_richcompare */
+    0,                   /* tp_weaklistoffset */
+    0,                   /* tp_iter */
+    0,                   /* tp_iternext */
+    Array_methods,             /* tp_methods */
+    0,                         /* tp_members */
+    Array_getset,              /* tp_getset */
+};
+
+// Creates an Array that takes ownership of the contents of values; values is
+// left empty.
+template <typename T>
+static PyObject* Array_from_vector(std::vector<T>* const values) {
+    Array* const self = PyObject_New(Array, &ArrayType);
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->length_ = values->size();
+
+    VectorArrayStorage<T>* const storage = new VectorArrayStorage<T>(values);
+
+    self->storage_ = storage;
+    self->data_ = storage->data();
+    self->itemsize_ = sizeof(T);
+    self->format_ = ArrayFormat<T>::value();
+
+    Array_set_shape(self);
+
+    return (PyObject*) self;
+}
+
+// Creates a row-major num_rows by num_columns Array that takes ownership of
+// the contents of values; values is left empty.
+template <typename T>
+static PyObject* Array_from_matrix(std::vector<T>* const values,
+                                   const Py_ssize_t num_rows,
+                                   const Py_ssize_t num_columns) {
+    Array* const self = (Array*) Array_from_vector(values);
+
+    if (self != NULL) {
+        Array_set_shape(self, num_rows, num_columns);
+    }
+
+    return (PyObject*) self;
+}
+
+// Creates an Array that exposes, without copying, length values owned by
+// owner.
+template <typename T>
+static PyObject* Array_from_memory(const T* const values,
+                                   const size_t length,
+                                   PyObject* const owner) {
+    Array* const self = PyObject_New(Array, &ArrayType);
+
+    if (self == NULL) {
+        return NULL;
+    }
+
+    self->length_ = length;
+    self->storage_ = new ObjectArrayStorage(owner);
+    self->data_ = const_cast<T*>(values);
+    self->itemsize_ = sizeof(T);
+    self->format_ = ArrayFormat<T>::value();
+
+    Array_set_shape(self);
+
+    return (PyObject*) self;
+}
+
+// Conversion helpers.
+
+static PyObject* decode_string(const std::string& str) {
+    return PyUnicode_Decode(str.c_str(), str.size(), ENCODING, "strict");
+}
+
+// Reads integers from an object exposing a buffer of integers (e.g., a NumPy
+// array or an Array) or, otherwise, from an iterable of ints.
+static bool read_integers(PyObject* const object, std::vector<int64_t>* const values) {
+    if (PyObject_CheckBuffer(object)) {
+        Py_buffer view;
+
+        if (PyObject_GetBuffer(object, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0) {
+            return false;
+        }
+
+        const char* format = view.format != NULL ? view.format : "B";
+
+        // Only native and little-endian standard sizes are supported.
+        if (*format == '@' || *format == '=' || *format == '<') {
+            ++format;
+        }
+
+        const Py_ssize_t count = view.itemsize > 0 ? view.len / view.itemsize : 0;
+        values->reserve(values->size() + count);
+
+        bool supported = format[0] != '\0' && format[1] == '\0';
+
+        for (Py_ssize_t i = 0; supported && i < count; ++i) {
+            const char* const item = static_cast<const char*>(view.buf) + i * view.itemsize;
+
+            switch (view.itemsize) {
+                case 1:
+                    values->push_back(islower(*format) ?
+                        static_cast<int64_t>(*reinterpret_cast<const int8_t*>(item)) :
+                        static_cast<int64_t>(*reinterpret_cast<const uint8_t*>(item)));
+                    break;
+                case 2:
+                    values->push_back(islower(*format) ?
+                        static_cast<int64_t>(*reinterpret_cast<const int16_t*>(item)) :
+                        static_cast<int64_t>(*reinterpret_cast<const uint16_t*>(item)));
+                    break;
+                case 4:
+                    values->push_back(islower(*format) ?
+                        static_cast<int64_t>(*reinterpret_cast<const int32_t*>(item)) :
+                        static_cast<int64_t>(*reinterpret_cast<const uint32_t*>(item)));
+                    break;
+                case 8:
+                    values->push_back(*reinterpret_cast<const int64_t*>(item));
+                    break;
+                default:
+                    supported = false;
+            }
+        }
+
+        if (supported && !strchr("bBhHiIlLqQnN", *format)) {
+            supported = false;
+        }
+
+        PyBuffer_Release(&view);
+
+        if (!supported) {
+            PyErr_SetString(PyExc_TypeError,
+                            "Passed buffer does not contain native integers.");
+
+            return false;
+        }
+
+        return true;
+    }
+
+    PyObject* const iterator = PyObject_GetIter(object);
+
+    if (iterator == NULL) {
+        return false;
+    }
+
+    PyObject* item;
+    while ((item = PyIter_Next(iterator))) {
+        const long long value = PyLong_AsLongLong(item);
+        Py_DECREF(item);
+
+        if (value == -1 && PyErr_Occurred()) {
+            Py_DECREF(iterator);
+
+            return false;
+        }
+
+        values->push_back(value);
+    }
+
+    Py_DECREF(iterator);
+
+    return !PyErr_Occurred();
+}
+
+// Reads the strings of an iterable of str, encoded as ENCODING. Sets an
+// exception and returns false on failure.
+static bool read_strings(PyObject* const object, std::vector<std::string>* const values) {
+    PyObject* const iterator = PyObject_GetIter(object);
+
+    if (iterator == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Passed object is not iterable.");
+
+        return false;
+    }
+
+    PyObject* item;
+
+    while ((item = PyIter_Next(iterator)) != NULL) {
+        PyObject* const item_bytes = PyUnicode_Check(item) ?
+            PyUnicode_AsEncodedString(item, ENCODING, "strict") : NULL;
+
+        Py_DECREF(item);
+
+        if (item_bytes == NULL) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_TypeError, "Expected an iterable of str.");
+            }
+
+            Py_DECREF(iterator);
+
+            return false;
+        }
+
+        values->push_back(std::string(PyBytes_AS_STRING(item_bytes),
+                                      PyBytes_GET_SIZE(item_bytes)));
+
+        Py_DECREF(item_bytes);
+    }
+
+    Py_DECREF(iterator);
+
+    return !PyErr_Occurred();
+}
+
+// Converts query results to a tuple of (int_document_id, score) pairs, or
+// (int_document_id, score, snippet) triples if snippets are passed.
+static PyObject* results_to_tuple(
+        const std::vector<indri::api::ScoredExtentResult>& query_results,
+        const std::vector<std::string>* const snippets = NULL) {
+    PyObject* const results = PyTuple_New(query_results.size());
+
+    for (size_t pos = 0; pos < query_results.size(); ++pos) {
+        PyObject* const result = PyTuple_New(snippets != NULL ? 3 : 2);
+
+        PyTuple_SetItem(result, 0, PyLong_FromLong(query_results[pos].document));
+        PyTuple_SetItem(result, 1, PyFloat_FromDouble(query_results[pos].score));
+
+        if (snippets != NULL) {
+            PyTuple_SetItem(result, 2, decode_string((*snippets)[pos]));
+        }
+
+        PyTuple_SetItem(results, pos, result);
+    }
+
+    return results;
+}
+
+// Instrumentation.
+
+enum Phase {
+    QUERY_PHASE,              // Parsing and evaluation by Indri, incl. annotation.
+    SNIPPETS_PHASE,           // Retrieving documents and building snippets.
+    RESULTS_PHASE,            // Constructing the Python results.
+    WAND_PHASE,               // Bag-of-words evaluation with WAND.
+    DOCUMENTS_PHASE,          // Reading term lists of documents.
+    VOCABULARY_PHASE,         // Scanning the vocabulary.
+    NUM_PHASES
+};
+
+static const char* const PHASE_NAMES[NUM_PHASES] = {
+    "query", "snippets", "results", "wand", "documents", "vocabulary"
+};
+
+enum Counter {
+    DOCUMENTS_DECODED_COUNTER,      // Term lists read from the direct file.
+    DOCUMENTS_DECOMPRESSED_COUNTER, // Documents retrieved from the collection.
+    BYTES_DECOMPRESSED_COUNTER,     // Text of the documents retrieved.
+    DOCUMENT_CACHE_HITS_COUNTER,
+    RESULT_CACHE_HITS_COUNTER,
+    NUM_COUNTERS
+};
+
+static const char* const COUNTER_NAMES[NUM_COUNTERS] = {
+    "documents_decoded", "documents_decompressed", "bytes_decompressed",
+    "document_cache_hits", "result_cache_hits"
+};
+
+static double monotonic_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+// Per-phase wall-clock timers and event counters of an Index, shared between
+// threads. Disabled by default, in which case recording costs a branch.
+class Instrumentation {
+ public:
+    explicit Instrumentation(const bool enabled = false) : enabled_(enabled) {
+        reset();
+    }
+
+    bool enabled() const {
+        return enabled_.get();
+    }
+
+    void set_enabled(const bool enabled) {
+        enabled_.set(enabled);
+    }
+
+    void add_time(const Phase phase, const double seconds) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        ++calls_[phase];
+        seconds_[phase] += seconds;
+    }
+
+    void increment(const Counter counter, const uint64_t value = 1) {
+        if (!enabled_.get() || value == 0) {
+            return;
+        }
+
+        indri::thread::ScopedLock lock(mutex_);
+
+        counters_[counter] += value;
+    }
+
+    void reset() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        std::fill(calls_, calls_ + NUM_PHASES, 0);
+        std::fill(seconds_, seconds_ + NUM_PHASES, 0.0);
+        std::fill(counters_, counters_ + NUM_COUNTERS, 0);
+    }
+
+    void statistics(uint64_t* const calls, double* const seconds,
+                    uint64_t* const counters) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        std::copy(calls_, calls_ + NUM_PHASES, calls);
+        std::copy(seconds_, seconds_ + NUM_PHASES, seconds);
+        std::copy(counters_, counters_ + NUM_COUNTERS, counters);
+    }
+
+ private:
+    AtomicFlag enabled_;
+
+    indri::thread::Mutex mutex_;
+
+    uint64_t calls_[NUM_PHASES];
+    double seconds_[NUM_PHASES];
+    uint64_t counters_[NUM_COUNTERS];
+};
+
+// Attributes the lifetime of the scope to a phase, if instrumentation was
+// enabled when the scope was entered.
+class ScopedTimer {
+ public:
+    ScopedTimer(Instrumentation* const instrumentation, const Phase phase)
+        : instrumentation_(instrumentation->enabled() ? instrumentation : NULL),
+          phase_(phase),
+          start_(instrumentation_ != NULL ? monotonic_seconds() : 0.0) {}
+
+    ~ScopedTimer() {
+        if (instrumentation_ != NULL) {
+            instrumentation_->add_time(phase_, monotonic_seconds() - start_);
+        }
+    }
+
+ private:
+    Instrumentation* const instrumentation_;
+    const Phase phase_;
+    const double start_;
+};
+
+// Query results.
+
+// Bounded LRU cache of query results, keyed on the normalized query and the
+// parameters that affect its results. Its size is accounted for in bytes.
+class ResultCache {
+ public:
+    ResultCache()
+        : capacity_(0), size_(0), hits_(0), misses_(0), evictions_(0) {}
+
+    static std::string key(const std::string& query,
+                           const long results_requested,
+                           const std::vector<lemur::api::DOCID_T>& document_ids,
+                           const bool include_snippets) {
+        std::string key;
+
+        // Collapse whitespace.
+        for (size_t i = 0; i < query.size(); ++i) {
+            if (!isspace(static_cast<unsigned char>(query[i]))) {
+                key += query[i];
+            } else if (!key.empty() && key[key.size() - 1] != ' ') {
+                key += ' ';
+            }
+        }
+
+        if (!key.empty() && key[key.size() - 1] == ' ') {
+            key.erase(key.size() - 1);
+        }
+
+        std::vector<lemur::api::DOCID_T> sorted_document_ids(document_ids);
+        std::sort(sorted_document_ids.begin(), sorted_document_ids.end());
+
+        const char* const document_set =
+            sorted_document_ids.empty() ?
+                NULL : reinterpret_cast<const char*>(&sorted_document_ids[0]);
+        const size_t document_set_size =
+            sorted_document_ids.size() * sizeof(lemur::api::DOCID_T);
+
+        // FNV-1a hash of the document set, which sets keys of different
+        // document sets apart early on comparison.
+        uint64_t document_set_hash = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < document_set_size; ++i) {
+            document_set_hash ^= static_cast<unsigned char>(document_set[i]);
+            document_set_hash *= 1099511628211ULL;
+        }
+
+        char parameters[128];
+        snprintf(parameters, sizeof(parameters), "%ld:%zu:%016llx:%d",
+                 results_requested,
+                 sorted_document_ids.size(),
+                 static_cast<unsigned long long>(document_set_hash),
+                 include_snippets ? 1 : 0);
+
+        key += '\0';
+        key += parameters;
+
+        // The document set itself follows, such that keys only match if
+        // their document sets do.
+        key += '\0';
+        key.append(document_set, document_set_size);
+
+        return key;
+    }
+
+    bool enabled() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        return capacity_ > 0;
+    }
+
+    bool find(const std::string& key,
+              std::vector<indri::api::ScoredExtentResult>* const results,
+              std::vector<std::string>* const snippets) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        const std::map<std::string, std::list<Entry>::iterator>::iterator it =
+            entries_.find(key);
+
+        if (it == entries_.end()) {
+            ++misses_;
+
+            return false;
+        }
+
+        ++hits_;
+
+        lru_.splice(lru_.begin(), lru_, it->second);
+
+        *results = it->second->results;
+        *snippets = it->second->snippets;
+
+        return true;
+    }
+
+    void insert(const std::string& key,
+                const std::vector<indri::api::ScoredExtentResult>& results,
+                const std::vector<std::string>& snippets) {
+        // Approximate footprint, including bookkeeping.
+        size_t entry_size = 2 * key.size() + sizeof(Entry) + 128 +
+            results.size() * sizeof(indri::api::ScoredExtentResult);
+
+        for (size_t i = 0; i < snippets.size(); ++i) {
+            entry_size += sizeof(std::string) + snippets[i].size();
+        }
+
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (entry_size > capacity_ || entries_.find(key) != entries_.end()) {
+            return;
+        }
+
+        Entry entry;
+        entry.key = key;
+        entry.results = results;
+        entry.snippets = snippets;
+        entry.size = entry_size;
+
+        lru_.push_front(entry);
+        entries_[key] = lru_.begin();
+
+        size_ += entry_size;
+
+        evict();
+    }
+
+    void set_capacity(const size_t capacity) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        capacity_ = capacity;
+
+        evict();
+    }
+
+    void clear() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        entries_.clear();
+        lru_.clear();
+
+        size_ = 0;
+    }
+
+    void statistics(size_t* const capacity, size_t* const size, size_t* const entries,
+                    uint64_t* const hits, uint64_t* const misses,
+                    uint64_t* const evictions) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        *capacity = capacity_;
+        *size = size_;
+        *entries = entries_.size();
+        *hits = hits_;
+        *misses = misses_;
+        *evictions = evictions_;
+    }
+
+ private:
+    struct Entry {
+        std::string key;
+
+        std::vector<indri::api::ScoredExtentResult> results;
+        std::vector<std::string> snippets;
+
+        size_t size;
+    };
+
+    void evict() {
+        while (size_ > capacity_) {
+            size_ -= lru_.back().size;
+
+            entries_.erase(lru_.back().key);
+            lru_.pop_back();
+
+            ++evictions_;
+        }
+    }
+
+    indri::thread::Mutex mutex_;
+
+    size_t capacity_;
+    size_t size_;
+
+    std::list<Entry> lru_;
+    std::map<std::string, std::list<Entry>::iterator> entries_;
+
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t evictions_;
+};
+
+// Snippets.
+
+// Bounded LRU cache of decompressed documents, keyed by internal document
+// identifier. Entries are reference counted, such that documents evicted
+// while in use are only freed once released.
+class DocumentCache {
+ public:
+    class Entry {
+     public:
+        const indri::api::ParsedDocument* document() const {
+            return document_;
+        }
+
+     private:
+        friend class DocumentCache;
+
+        lemur::api::DOCID_T int_document_id_;
+        indri::api::ParsedDocument* document_;
+
+        size_t references_;
+        bool cached_;
+
+        std::list<lemur::api::DOCID_T>::iterator lru_position_;
+    };
+
+    DocumentCache(const size_t capacity, Instrumentation* const instrumentation)
+        : instrumentation_(instrumentation), capacity_(capacity), hits_(0), misses_(0) {}
+
+    ~DocumentCache() {
+        for (std::map<lemur::api::DOCID_T, Entry*>::iterator it = entries_.begin();
+             it != entries_.end();
+             ++it) {
+            delete it->second->document_;
+            delete it->second;
+        }
+    }
+
+    // Returns the document, retrieving it from the collection on a miss, or
+    // NULL if the collection does not store it. The entry must be passed to
+    // release once done. Throws lemur::api::Exception on I/O errors.
+    Entry* acquire(indri::collection::CompressedCollection* const collection,
+                   const lemur::api::DOCID_T int_document_id) {
+        {
+            indri::thread::ScopedLock lock(mutex_);
+
+            Entry* const entry = find(int_document_id);
+
+            if (entry != NULL) {
+                ++hits_;
+                instrumentation_->increment(DOCUMENT_CACHE_HITS_COUNTER);
+
+                return entry;
+            }
+
+            ++misses_;
+        }
+
+        // Decompress outside of the lock; concurrent misses on the same
+        // document are resolved below.
+        indri::api::ParsedDocument* const document = collection->retrieve(int_document_id);
+
+        if (document == NULL) {
+            return NULL;
+        }
+
+        instrumentation_->increment(DOCUMENTS_DECOMPRESSED_COUNTER);
+        instrumentation_->increment(BYTES_DECOMPRESSED_COUNTER, document->textLength);
+
+        indri::thread::ScopedLock lock(mutex_);
+
+        Entry* entry = find(int_document_id);
+
+        if (entry != NULL) {
+            delete document;
+
+            return entry;
+        }
+
+        entry = new Entry;
+        entry->int_document_id_ = int_document_id;
+        entry->document_ = document;
+        entry->references_ = 1;
+        entry->cached_ = true;
+        entry->lru_position_ = lru_.insert(lru_.begin(), int_document_id);
+
+        entries_[int_document_id] = entry;
+
+        evict();
+
+        return entry;
+    }
+
+    void release(Entry* const entry) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        --entry->references_;
+
+        if (entry->references_ == 0 && !entry->cached_) {
+            delete entry->document_;
+            delete entry;
+        }
+    }
+
+    void set_capacity(const size_t capacity) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        capacity_ = capacity;
+
+        evict();
+    }
+
+    void statistics(size_t* const capacity, size_t* const size,
+                    uint64_t* const hits, uint64_t* const misses) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        *capacity = capacity_;
+        *size = entries_.size();
+        *hits = hits_;
+        *misses = misses_;
+    }
+
+ private:
+    // Returns the referenced entry, marked as most recently used, or NULL.
+    Entry* find(const lemur::api::DOCID_T int_document_id) {
+        const std::map<lemur::api::DOCID_T, Entry*>::iterator it =
+            entries_.find(int_document_id);
+
+        if (it == entries_.end()) {
+            return NULL;
+        }
+
+        Entry* const entry = it->second;
+
+        ++entry->references_;
+        lru_.splice(lru_.begin(), lru_, entry->lru_position_);
+
+        return entry;
+    }
+
+    void evict() {
+        while (entries_.size() > capacity_) {
+            const std::map<lemur::api::DOCID_T, Entry*>::iterator it =
+                entries_.find(lru_.back());
+
+            Entry* const entry = it->second;
+
+            entries_.erase(it);
+            lru_.pop_back();
+
+            entry->cached_ = false;
+
+            if (entry->references_ == 0) {
+                delete entry->document_;
+                delete entry;
+            }
+        }
+    }
+
+    Instrumentation* const instrumentation_;
+
+    indri::thread::Mutex mutex_;
+
+    size_t capacity_;
+
+    std::map<lemur::api::DOCID_T, Entry*> entries_;
+    std::list<lemur::api::DOCID_T> lru_;
+
+    uint64_t hits_;
+    uint64_t misses_;
+};
+
+// State shared between the threads building the snippets of a query: the
+// calling thread and helpers from the snippet executor. Helpers may only
+// start once all snippets were built, and the last one to finish deletes
+// the state.
+struct SnippetState {
+    explicit SnippetState(const size_t size)
+        : work_queue(size), remaining(size), references(1) {}
+
+    indri::collection::CompressedCollection* collection;
+    DocumentCache* document_cache;
+    indri::api::QueryAnnotation* query_annotation;
+
+    const std::vector<lemur::api::DOCID_T>* int_document_ids;
+
+    WorkQueue work_queue;
+
+    std::vector<std::string>* snippets;
+    std::vector<char>* failed;
+
+    indri::thread::Mutex mutex;
+    indri::thread::ConditionVariable condition;
+
+    size_t remaining;  // Snippets not built yet.
+    size_t references;
+};
+
+static void process_snippets(SnippetState* const state) {
+    indri::api::SnippetBuilder builder(false /* html */);
+
+    size_t idx;
+    while (state->work_queue.next(&idx)) {
+        const lemur::api::DOCID_T int_document_id = (*state->int_document_ids)[idx];
+
+        DocumentCache::Entry* entry = NULL;
+
+        try {
+            entry = state->document_cache->acquire(state->collection, int_document_id);
+
+            if (entry != NULL) {
+                (*state->snippets)[idx] = builder.build(
+                    int_document_id,
+                    const_cast<indri::api::ParsedDocument*>(entry->document()),
+                    state->query_annotation);
+            } else {
+                (*state->failed)[idx] = true;
+            }
+        } catch (const lemur::api::Exception& e) {
+            (*state->failed)[idx] = true;
+        }
+
+        if (entry != NULL) {
+            state->document_cache->release(entry);
+        }
+
+        indri::thread::ScopedLock lock(state->mutex);
+
+        if (--state->remaining == 0) {
+            state->condition.notifyAll();
+        }
+    }
+}
+
+static void release_snippet_state(SnippetState* const state) {
+    bool last;
+
+    {
+        indri::thread::ScopedLock lock(state->mutex);
+
+        last = --state->references == 0;
+    }
+
+    if (last) {
+        delete state;
+    }
+}
+
+static void snippet_helper(void* data) {
+    SnippetState* const state = static_cast<SnippetState*>(data);
+
+    process_snippets(state);
+    release_snippet_state(state);
+}
+
+// Helper threads building snippets, shared by all queries such that
+// concurrent queries do not start a set of threads each. Created on first
+// use; both are replaced in forked children.
+static indri::thread::Mutex* snippet_executor_lock = new indri::thread::Mutex;
+static TaskExecutor* snippet_executor = NULL;
+
+static TaskExecutor* get_snippet_executor() {
+    indri::thread::ScopedLock lock(snippet_executor_lock);
+
+    if (snippet_executor == NULL) {
+        snippet_executor = new TaskExecutor(snippet_helper, default_num_threads());
+    }
+
+    return snippet_executor;
+}
+
+// Builds the snippets of the documents in parallel; returns false if a
+// document could not be retrieved. Callers must not hold the GIL.
+static bool build_snippets(indri::collection::CompressedCollection* const collection,
+                           DocumentCache* const document_cache,
+                           indri::api::QueryAnnotation* const query_annotation,
+                           const std::vector<lemur::api::DOCID_T>& int_document_ids,
+                           std::vector<std::string>* const snippets) {
+    snippets->assign(int_document_ids.size(), std::string());
+
+    if (int_document_ids.empty()) {
+        return true;
+    }
+
+    std::vector<char> failed(int_document_ids.size(), false);
+
+    SnippetState* const state = new SnippetState(int_document_ids.size());
+    state->collection = collection;
+    state->document_cache = document_cache;
+    state->query_annotation = query_annotation;
+    state->int_document_ids = &int_document_ids;
+    state->snippets = snippets;
+    state->failed = &failed;
+
+    // The calling thread builds snippets as well.
+    const size_t num_helpers =
+        std::min(default_num_threads(), int_document_ids.size()) - 1;
+
+    state->references += num_helpers;
+
+    for (size_t i = 0; i < num_helpers; ++i) {
+        get_snippet_executor()->submit(state);
+    }
+
+    process_snippets(state);
+
+    {
+        indri::thread::ScopedLock lock(state->mutex);
+
+        while (state->remaining > 0) {
+            state->condition.wait(state->mutex);
+        }
+    }
+
+    release_snippet_state(state);
+
+    return std::find(failed.begin(), failed.end(), true) == failed.end();
+}
+
+// Vocabulary
+
+struct VocabularyEntry {
+    std::string term;
+    lemur::api::TERMID_T term_id;
+
+    uint64_t document_frequency;
+    uint64_t term_frequency;
+
+    bool operator<(const VocabularyEntry& other) const {
+        return term < other.term;
+    }
+};
+
+// Reads the complete vocabulary of the index in a single scan.
+static void read_vocabulary(indri::index::DiskIndex* const index,
+                            std::vector<VocabularyEntry>* const entries) {
+    indri::index::VocabularyIterator* const vocabulary_it = index->vocabularyIterator();
+
+    entries->reserve(index->uniqueTermCount());
+
+    try {
+        vocabulary_it->startIteration();
+
+        while (!vocabulary_it->finished()) {
+            indri::index::DiskTermData* const term_data = vocabulary_it->currentEntry();
+
+            VocabularyEntry entry;
+            entry.term = term_data->termData->term;
+            entry.term_id = term_data->termID;
+            entry.document_frequency = term_data->termData->corpus.documentCount;
+            entry.term_frequency = term_data->termData->corpus.totalCount;
+
+            entries->push_back(entry);
+
+            vocabulary_it->nextEntry();
+        }
+    } catch (const lemur::api::Exception& e) {
+        delete vocabulary_it;
+
+        throw;
+    }
+
+    delete vocabulary_it;
+}
+
+// Vocabulary laid out by term identifier: term t is
+// blob[offsets[t]:offsets[t + 1]], with document frequency dfs[t] and
+// collection frequency cfs[t]. Term identifier 0 denotes out-of-vocabulary
+// terms and is empty.
+struct VocabularyArrays {
+    std::string blob;
+    std::vector<int64_t> offsets;
+    std::vector<uint64_t> dfs;
+    std::vector<uint64_t> cfs;
+};
+
+// Reads the complete vocabulary of the index in a single scan, without
+// materializing a string per term.
+static void read_vocabulary_arrays(indri::index::DiskIndex* const index,
+                                   VocabularyArrays* const vocabulary) {
+    const size_t num_terms = index->uniqueTermCount() + 1;
+
+    vocabulary->dfs.assign(num_terms, 0);
+    vocabulary->cfs.assign(num_terms, 0);
+
+    // Terms in the order of the scan, which is not that of their identifiers.
+    std::string scan_blob;
+    std::vector<std::pair<lemur::api::TERMID_T, size_t> > scan_terms;
+
+    scan_terms.reserve(num_terms);
+
+    indri::index::VocabularyIterator* const vocabulary_it = index->vocabularyIterator();
+
+    try {
+        vocabulary_it->startIteration();
+
+        while (!vocabulary_it->finished()) {
+            indri::index::DiskTermData* const term_data = vocabulary_it->currentEntry();
+
+            const lemur::api::TERMID_T term_id = term_data->termID;
+
+            if (static_cast<size_t>(term_id) >= vocabulary->dfs.size()) {
+                vocabulary->dfs.resize(term_id + 1, 0);
+                vocabulary->cfs.resize(term_id + 1, 0);
+            }
+
+            vocabulary->dfs[term_id] = term_data->termData->corpus.documentCount;
+            vocabulary->cfs[term_id] = term_data->termData->corpus.totalCount;
+
+            scan_terms.push_back(std::make_pair(term_id, scan_blob.size()));
+            scan_blob += term_data->termData->term;
+
+            vocabulary_it->nextEntry();
+        }
+    } catch (const lemur::api::Exception& e) {
+        delete vocabulary_it;
+
+        throw;
+    }
+
+    delete vocabulary_it;
+
+    // Lays out the terms by identifier.
+    std::vector<int64_t> sizes(vocabulary->dfs.size(), 0);
+
+    for (size_t i = 0; i < scan_terms.size(); ++i) {
+        const size_t end = i + 1 < scan_terms.size() ?
+            scan_terms[i + 1].second : scan_blob.size();
+
+        sizes[scan_terms[i].first] = end - scan_terms[i].second;
+    }
+
+    vocabulary->offsets.assign(1, 0);
+
+    for (size_t term_id = 0; term_id < sizes.size(); ++term_id) {
+        vocabulary->offsets.push_back(vocabulary->offsets.back() + sizes[term_id]);
+    }
+
+    vocabulary->blob.resize(scan_blob.size());
+
+    for (size_t i = 0; i < scan_terms.size(); ++i) {
+        const lemur::api::TERMID_T term_id = scan_terms[i].first;
+
+        scan_blob.copy(&vocabulary->blob[vocabulary->offsets[term_id]],
+                       sizes[term_id],
+                       scan_terms[i].second);
+    }
+}
+
+// Open-addressing hash table from the terms of the vocabulary to their
+// identifiers, built in a single scan on first use.
+class VocabularyHash {
+ public:
+    VocabularyHash() : built_(false), mask_(0) {}
+
+    // Builds the table unless it was built before; throws
+    // lemur::api::Exception on I/O errors. Must be called before find.
+    void build(indri::index::DiskIndex* const index) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (built_) {
+            return;
+        }
+
+        std::vector<VocabularyEntry> entries;
+        read_vocabulary(index, &entries);
+
+        size_t num_slots = 16;
+
+        while (num_slots < 2 * entries.size()) {
+            num_slots *= 2;
+        }
+
+        mask_ = num_slots - 1;
+        slots_.assign(num_slots, 0);
+
+        offsets_.assign(1, 0);
+        term_ids_.clear();
+        blob_.clear();
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            blob_ += entries[i].term;
+            offsets_.push_back(blob_.size());
+            term_ids_.push_back(entries[i].term_id);
+
+            size_t slot = hash(entries[i].term.data(), entries[i].term.size()) & mask_;
+
+            while (slots_[slot] != 0) {
+                slot = (slot + 1) & mask_;
+            }
+
+            slots_[slot] = i + 1;
+        }
+
+        built_ = true;
+    }
+
+    // Returns the identifier of the term, or 0 if it is out of vocabulary.
+    lemur::api::TERMID_T find(const std::string& term) const {
+        if (slots_.empty()) {
+            return 0;
+        }
+
+        for (size_t slot = hash(term.data(), term.size()) & mask_;
+             slots_[slot] != 0;
+             slot = (slot + 1) & mask_) {
+            const size_t entry = slots_[slot] - 1;
+            const size_t size = offsets_[entry + 1] - offsets_[entry];
+
+            if (size == term.size() &&
+                memcmp(blob_.data() + offsets_[entry], term.data(), size) == 0) {
+                return term_ids_[entry];
+            }
+        }
+
+        return 0;
+    }
+
+ private:
+    // FNV-1a.
+    static uint64_t hash(const char* const data, const size_t size) {
+        uint64_t value = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < size; ++i) {
+            value ^= static_cast<unsigned char>(data[i]);
+            value *= 1099511628211ULL;
+        }
+
+        return value;
+    }
+
+    indri::thread::Mutex mutex_;
+    bool built_;
+
+    size_t mask_;
+
+    // Entry i is term blob_[offsets_[i]:offsets_[i + 1]]; slots hold the
+    // entry plus one, or 0 when empty.
+    std::vector<uint32_t> slots_;
+    std::vector<uint64_t> offsets_;
+    std::vector<lemur::api::TERMID_T> term_ids_;
+    std::string blob_;
+};
+
+// Dictionary snapshots store the vocabulary in a columnar layout that can be
+// memory-mapped (see pyndri.Dictionary.from_snapshot). All integers use the
+// native byte order; with n terms and term identifiers up to m:
+//
+//   header      DictionarySnapshotHeader
+//   offsets     uint64[n + 1]  term i (in sorted order) is blob[offsets[i]:offsets[i + 1]]
+//   dfs         uint64[m + 1]  document frequency, indexed by term identifier
+//   cfs         uint64[m + 1]  collection frequency, indexed by term identifier
+//   term_ids    uint32[n]      term identifier of the i-th term in sorted order
+//   ranks       uint32[m + 1]  sorted position of a term identifier, or 2^32 - 1
+//   blob        uint8[]        the terms, sorted by their bytes
+static const char DICTIONARY_SNAPSHOT_MAGIC[8] = {'P', 'Y', 'N', 'D', 'R', 'I', 'D', 'C'};
+static const uint32_t DICTIONARY_SNAPSHOT_VERSION = 1;
+
+static const char DICTIONARY_SNAPSHOT_FILENAME[] = "pyndri.dictionary";
+
+struct DictionarySnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    uint64_t num_terms;
+    uint64_t max_term_id;
+    uint64_t blob_size;
+};
+
+// Files are written to a temporary path first and then renamed, such that
+// readers never observe a partially written file. The path is unique per
+// process and call, as processes sharing a repository, and threads of one,
+// may write concurrently.
+static std::string temporary_path(const std::string& path) {
+    static uint64_t num_temporary_paths = 0;
+
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".tmp.%ld.%llu",
+             static_cast<long>(getpid()),
+             static_cast<unsigned long long>(
+                 __atomic_fetch_add(&num_temporary_paths, 1, __ATOMIC_RELAXED)));
+
+    return path + suffix;
+}
+
+template <typename T>
+static bool write_array(FILE* const file, const std::vector<T>& values) {
+    return values.empty() ||
+        fwrite(&values[0], sizeof(T), values.size(), file) == values.size();
+}
+
+// Returns false and sets errno when the snapshot could not be written.
+static bool write_dictionary_snapshot(std::vector<VocabularyEntry>* const entries,
+                                      const std::string& path) {
+    std::sort(entries->begin(), entries->end());
+
+    lemur::api::TERMID_T max_term_id = 0;
+
+    for (size_t i = 0; i < entries->size(); ++i) {
+        max_term_id = std::max(max_term_id, (*entries)[i].term_id);
+    }
+
+    std::vector<uint64_t> offsets(1, 0);
+    std::vector<uint64_t> dfs(max_term_id + 1, 0);
+    std::vector<uint64_t> cfs(max_term_id + 1, 0);
+    std::vector<uint32_t> term_ids;
+    std::vector<uint32_t> ranks(max_term_id + 1, UINT32_MAX);
+
+    std::string blob;
+
+    for (size_t rank = 0; rank < entries->size(); ++rank) {
+        const VocabularyEntry& entry = (*entries)[rank];
+
+        blob += entry.term;
+        offsets.push_back(blob.size());
+
+        dfs[entry.term_id] = entry.document_frequency;
+        cfs[entry.term_id] = entry.term_frequency;
+
+        term_ids.push_back(entry.term_id);
+        ranks[entry.term_id] = rank;
+    }
+
+    DictionarySnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, DICTIONARY_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = DICTIONARY_SNAPSHOT_VERSION;
+    header.num_terms = entries->size();
+    header.max_term_id = max_term_id;
+    header.blob_size = blob.size();
+
+    const std::string tmp_path = temporary_path(path);
+
+    FILE* const file = fopen(tmp_path.c_str(), "wb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool success =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        write_array(file, offsets) &&
+        write_array(file, dfs) &&
+        write_array(file, cfs) &&
+        write_array(file, term_ids) &&
+        write_array(file, ranks) &&
+        fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+
+    success = (fclose(file) == 0) && success;
+
+    if (success) {
+        success = rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    if (!success) {
+        remove(tmp_path.c_str());
+    }
+
+    return success;
+}
+
+// Memory-mapped files.
+
+// Read-only, shared memory mapping of a complete file.
+class MappedFile {
+ public:
+    MappedFile() : data_(NULL), size_(0) {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    // Returns false and sets errno if the file could not be mapped.
+    bool open(const std::string& path) {
+        close();
+
+        const int fd = ::open(path.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat file_stat;
+
+        if (fstat(fd, &file_stat) < 0) {
+            ::close(fd);
+
+            return false;
+        }
+
+        size_ = file_stat.st_size;
+
+        if (size_ > 0) {
+            void* const data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+
+                return false;
+            }
+
+            data_ = static_cast<const char*>(data);
+        }
+
+        ::close(fd);
+
+        return true;
+    }
+
+    void swap(MappedFile& other) {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    void close() {
+        if (data_ != NULL) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+
+        data_ = NULL;
+        size_ = 0;
+    }
+
+    bool is_open() const {
+        return data_ != NULL;
+    }
+
+    const char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+ private:
+    const char* data_;
+    size_t size_;
+};
+
+// Document identifiers.
+
+// Docno tables map external document identifiers to internal ones, such
+// that they can be resolved without querying the collection. With n
+// documents, in the native byte order:
+//
+//   header      DocnoTableHeader
+//   offsets     uint64[n + 1]  docno i (in sorted order) is blob[offsets[i]:offsets[i + 1]]
+//   ids         int32[n]       internal identifier of the i-th docno
+//   blob        uint8[]        the docnos, sorted by their bytes
+static const char DOCNO_TABLE_MAGIC[8] = {'P', 'Y', 'N', 'D', 'R', 'I', 'D', 'N'};
+static const uint32_t DOCNO_TABLE_VERSION = 1;
+
+static const char DOCNO_TABLE_FILENAME[] = "pyndri.docnos";
+
+struct DocnoTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    uint64_t num_documents;
+    uint64_t document_maximum;  // Of the index the table was built for.
+    uint64_t blob_size;
+};
+
+struct DocnoEntry {
+    std::string docno;
+    int32_t int_document_id;
+
+    bool operator<(const DocnoEntry& other) const {
+        return docno < other.docno ||
+            (docno == other.docno && int_document_id < other.int_document_id);
+    }
+};
+
+// Returns false and sets errno when the table could not be written.
+static bool write_docno_table(std::vector<DocnoEntry>* const entries,
+                              const uint64_t document_maximum,
+                              const std::string& path) {
+    std::sort(entries->begin(), entries->end());
+
+    std::vector<uint64_t> offsets(1, 0);
+    std::vector<int32_t> int_document_ids;
+
+    std::string blob;
+
+    for (size_t i = 0; i < entries->size(); ++i) {
+        blob += (*entries)[i].docno;
+        offsets.push_back(blob.size());
+
+        int_document_ids.push_back((*entries)[i].int_document_id);
+    }
+
+    DocnoTableHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, DOCNO_TABLE_MAGIC, sizeof(header.magic));
+    header.version = DOCNO_TABLE_VERSION;
+    header.num_documents = entries->size();
+    header.document_maximum = document_maximum;
+    header.blob_size = blob.size();
+
+    const std::string tmp_path = temporary_path(path);
+
+    FILE* const file = fopen(tmp_path.c_str(), "wb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool success =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        write_array(file, offsets) &&
+        write_array(file, int_document_ids) &&
+        fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+
+    success = (fclose(file) == 0) && success;
+
+    if (success) {
+        success = rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    if (!success) {
+        remove(tmp_path.c_str());
+    }
+
+    return success;
+}
+
+// Memory-mapped docno table of an index.
+class DocnoTable {
+ public:
+    DocnoTable() : num_documents_(0), offsets_(NULL), int_document_ids_(NULL), blob_(NULL) {}
+
+    // Loads the docno table, if any; returns false if it is invalid or was
+    // built for a different version of the index.
+    bool load(const std::string& path, const uint64_t document_maximum) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        num_documents_ = 0;
+
+        if (!file_.open(path)) {
+            return true;
+        }
+
+        const DocnoTableHeader* const header =
+            reinterpret_cast<const DocnoTableHeader*>(file_.data());
+
+        if (file_.size() < sizeof(DocnoTableHeader) ||
+            memcmp(header->magic, DOCNO_TABLE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != DOCNO_TABLE_VERSION ||
+            header->document_maximum != document_maximum ||
+            file_.size() != sizeof(DocnoTableHeader) +
+                (header->num_documents + 1) * sizeof(uint64_t) +
+                header->num_documents * sizeof(int32_t) +
+                header->blob_size) {
+            file_.close();
+
+            return false;
+        }
+
+        num_documents_ = header->num_documents;
+
+        offsets_ = reinterpret_cast<const uint64_t*>(
+            file_.data() + sizeof(DocnoTableHeader));
+        int_document_ids_ = reinterpret_cast<const int32_t*>(
+            offsets_ + num_documents_ + 1);
+        blob_ = reinterpret_cast<const char*>(int_document_ids_ + num_documents_);
+
+        return true;
+    }
+
+    bool is_open() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        return file_.is_open();
+    }
+
+    // Appends the internal identifiers of the documents with the docno;
+    // returns false if no table is loaded.
+    bool find(const std::string& docno,
+              std::vector<lemur::api::DOCID_T>* const int_document_ids) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (!file_.is_open()) {
+            return false;
+        }
+
+        // Binary search for the first docno that is not less than docno.
+        size_t begin = 0;
+        size_t end = num_documents_;
+
+        while (begin < end) {
+            const size_t middle = begin + (end - begin) / 2;
+
+            if (compare(middle, docno) < 0) {
+                begin = middle + 1;
+            } else {
+                end = middle;
+            }
+        }
+
+        for (; begin < num_documents_ && compare(begin, docno) == 0; ++begin) {
+            int_document_ids->push_back(int_document_ids_[begin]);
+        }
+
+        return true;
+    }
+
+ private:
+    int compare(const size_t idx, const std::string& docno) const {
+        const size_t size = offsets_[idx + 1] - offsets_[idx];
+        const int result = memcmp(blob_ + offsets_[idx], docno.data(),
+                                  std::min(size, docno.size()));
+
+        if (result != 0) {
+            return result;
+        }
+
+        return size < docno.size() ? -1 : (size > docno.size() ? 1 : 0);
+    }
+
+    indri::thread::Mutex mutex_;
+
+    MappedFile file_;
+
+    uint64_t num_documents_;
+    const uint64_t* offsets_;
+    const int32_t* int_document_ids_;
+    const char* blob_;
+};
+
+// Docnos of the documents of an index, retrieved from the collection on
+// first access and kept in memory as a single blob of at most capacity bytes;
+// docnos beyond that are retrieved again on every access.
+class DocnoCache {
+ public:
+    explicit DocnoCache(const size_t capacity)
+        : capacity_(capacity), document_base_(0), document_maximum_(0), offsets_(1, 0) {}
+
+    void reset(const lemur::api::DOCID_T document_base,
+               const lemur::api::DOCID_T document_maximum) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        document_base_ = document_base;
+        document_maximum_ = document_maximum;
+
+        // Slots are allocated on first access.
+        std::vector<uint32_t>().swap(slots_);
+        offsets_.assign(1, 0);
+        std::string().swap(blob_);
+    }
+
+    // Appends the docno of the document to blob. The identifier must be
+    // within bounds; throws lemur::api::Exception on I/O errors.
+    void append(indri::collection::CompressedCollection* const collection,
+                const lemur::api::DOCID_T int_document_id,
+                std::string* const blob) {
+        const size_t idx = int_document_id - document_base_;
+
+        {
+            indri::thread::ScopedLock lock(mutex_);
+
+            if (slots_.empty()) {
+                slots_.assign(std::max(document_maximum_ - document_base_, 0), 0);
+            }
+
+            if (slots_[idx] > 0) {
+                const size_t slot = slots_[idx];
+
+                blob->append(blob_, offsets_[slot - 1], offsets_[slot] - offsets_[slot - 1]);
+
+                return;
+            }
+        }
+
+        const std::string docno = collection->retrieveMetadatum(int_document_id, "docno");
+
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (slots_[idx] == 0 && blob_.size() + docno.size() <= capacity_) {
+            blob_ += docno;
+            offsets_.push_back(blob_.size());
+
+            slots_[idx] = offsets_.size() - 1;
+        }
+
+        blob->append(docno);
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    const size_t capacity_;
+
+    lemur::api::DOCID_T document_base_;
+    lemur::api::DOCID_T document_maximum_;
+
+    // Docno i is blob_[offsets_[i - 1]:offsets_[i]]; slots_ maps a document
+    // (relative to document_base_) to its docno, or to 0 if not cached.
+    std::vector<uint32_t> slots_;
+    std::vector<uint64_t> offsets_;
+    std::string blob_;
+};
+
+// Collection statistics.
+
+// Statistics sidecars hold the statistics used for scoring, such that
+// processes sharing a repository serve them from the same page cache. With
+// documents [b, e) and term identifiers up to m, in the native byte order:
+//
+//   header      StatisticsHeader
+//   lengths     uint32[e - b]  length of document b + i, padded to 8 bytes
+//   dfs         uint64[m + 1]  document frequency, indexed by term identifier
+//   cfs         uint64[m + 1]  collection frequency, indexed by term identifier
+static const char STATISTICS_MAGIC[8] = {'P', 'Y', 'N', 'D', 'R', 'I', 'S', 'T'};
+static const uint32_t STATISTICS_VERSION = 1;
+
+static const char STATISTICS_FILENAME[] = "pyndri.statistics";
+
+struct StatisticsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    uint64_t document_base;
+    uint64_t document_maximum;
+    uint64_t num_documents;
+    uint64_t total_terms;
+    uint64_t unique_terms;
+    uint64_t max_term_id;
+};
+
+static size_t statistics_lengths_size(const StatisticsHeader& header) {
+    const size_t size =
+        (header.document_maximum - header.document_base) * sizeof(uint32_t);
+
+    return (size + 7) / 8 * 8;
+}
+
+// Returns false and sets errno when the file could not be written.
+static bool write_statistics(const StatisticsHeader& header,
+                             std::vector<uint32_t>* const lengths,
+                             const std::vector<uint64_t>& dfs,
+                             const std::vector<uint64_t>& cfs,
+                             const std::string& path) {
+    lengths->resize(statistics_lengths_size(header) / sizeof(uint32_t), 0);
+
+    const std::string tmp_path = temporary_path(path);
+
+    FILE* const file = fopen(tmp_path.c_str(), "wb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool success =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        write_array(file, *lengths) &&
+        write_array(file, dfs) &&
+        write_array(file, cfs);
+
+    success = (fclose(file) == 0) && success;
+
+    if (success) {
+        success = rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    if (!success) {
+        remove(tmp_path.c_str());
+    }
+
+    return success;
+}
+
+// Memory-mapped statistics sidecar of an index. Once loaded, the mapping is
+// kept for the lifetime of the table, such that the arrays can be read
+// without locking.
+class StatisticsTable {
+ public:
+    StatisticsTable() : header_(NULL) {}
+
+    // Loads the sidecar, if any and unless loaded before; returns false if
+    // it is invalid or was built for a different version of the index. With
+    // reload, a sidecar loaded before is replaced by the current file; the
+    // old mapping is kept until destruction, as its arrays may still be read.
+    bool load(const std::string& path,
+              const uint64_t document_base,
+              const uint64_t document_maximum,
+              const uint64_t total_terms,
+              const uint64_t unique_terms,
+              const bool reload = false) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (file_.is_open() && !reload) {
+            return true;
+        }
+
+        MappedFile file;
+
+        if (!file.open(path)) {
+            return true;
+        }
+
+        const StatisticsHeader* const header =
+            reinterpret_cast<const StatisticsHeader*>(file.data());
+
+        if (file.size() < sizeof(StatisticsHeader) ||
+            memcmp(header->magic, STATISTICS_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != STATISTICS_VERSION ||
+            header->document_base != document_base ||
+            header->document_maximum != document_maximum ||
+            header->total_terms != total_terms ||
+            header->unique_terms != unique_terms ||
+            file.size() != sizeof(StatisticsHeader) +
+                statistics_lengths_size(*header) +
+                2 * (header->max_term_id + 1) * sizeof(uint64_t)) {
+            return false;
+        }
+
+        if (file_.is_open()) {
+            retired_files_.push_back(MappedFile());
+            retired_files_.back().swap(file_);
+        }
+
+        file_.swap(file);
+
+        header_ = header;
+
+        return true;
+    }
+
+    // Returns NULL if no sidecar is loaded.
+    const StatisticsHeader* header() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        return header_;
+    }
+
+    // The arrays that follow a header returned by header(). They are found
+    // from the header, rather than kept alongside it, such that they belong
+    // to the same mapping when another thread reloads the sidecar meanwhile.
+    static const uint32_t* lengths(const StatisticsHeader* const header) {
+        return reinterpret_cast<const uint32_t*>(
+            reinterpret_cast<const char*>(header) + sizeof(StatisticsHeader));
+    }
+
+    static const uint64_t* dfs(const StatisticsHeader* const header) {
+        return reinterpret_cast<const uint64_t*>(
+            reinterpret_cast<const char*>(header) + sizeof(StatisticsHeader) +
+            statistics_lengths_size(*header));
+    }
+
+    static const uint64_t* cfs(const StatisticsHeader* const header) {
+        return dfs(header) + header->max_term_id + 1;
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    MappedFile file_;
+    std::list<MappedFile> retired_files_;
+
+    const StatisticsHeader* header_;
+};
+
+// Dynamic pruning.
+
+// Statistics of the inverted list of a term from which the score upper
+// bounds of the retrieval models are derived.
+struct TermBound {
+    uint32_t max_term_frequency;
+    uint32_t min_document_length;
+};
+
+// Max-score files store the TermBound of every term identifier up to m,
+// in the native byte order:
+//
+//   header      MaxScoreHeader
+//   bounds      TermBound[m + 1]
+static const char MAX_SCORE_MAGIC[8] = {'P', 'Y', 'N', 'D', 'R', 'I', 'M', 'S'};
+static const uint32_t MAX_SCORE_VERSION = 1;
+
+static const char MAX_SCORE_FILENAME[] = "pyndri.max_scores";
+
+struct MaxScoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    uint64_t max_term_id;
+};
+
+// Returns false and sets errno when the file could not be written.
+static bool write_max_scores(const std::vector<TermBound>& bounds,
+                             const std::string& path) {
+    MaxScoreHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, MAX_SCORE_MAGIC, sizeof(header.magic));
+    header.version = MAX_SCORE_VERSION;
+    header.max_term_id = bounds.empty() ? 0 : bounds.size() - 1;
+
+    const std::string tmp_path = temporary_path(path);
+
+    FILE* const file = fopen(tmp_path.c_str(), "wb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool success =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        write_array(file, bounds);
+
+    success = (fclose(file) == 0) && success;
+
+    if (success) {
+        success = rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    if (!success) {
+        remove(tmp_path.c_str());
+    }
+
+    return success;
+}
+
+// Term bounds of an index, served from its max-score file when present and
+// otherwise computed on first use and kept in memory.
+class TermBoundCache {
+ public:
+    // Loads the max-score file, if any; returns false if it is invalid.
+    bool load(const std::string& path) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (!file_.open(path)) {
+            return true;
+        }
+
+        const MaxScoreHeader* const header =
+            reinterpret_cast<const MaxScoreHeader*>(file_.data());
+
+        if (file_.size() < sizeof(MaxScoreHeader) ||
+            memcmp(header->magic, MAX_SCORE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != MAX_SCORE_VERSION ||
+            file_.size() != sizeof(MaxScoreHeader) +
+                (header->max_term_id + 1) * sizeof(TermBound)) {
+            file_.close();
+
+            return false;
+        }
+
+        return true;
+    }
+
+    bool find(const lemur::api::TERMID_T term_id, TermBound* const bound) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        if (file_.is_open()) {
+            const MaxScoreHeader* const header =
+                reinterpret_cast<const MaxScoreHeader*>(file_.data());
+
+            if (static_cast<uint64_t>(term_id) <= header->max_term_id) {
+                *bound = reinterpret_cast<const TermBound*>(
+                    file_.data() + sizeof(MaxScoreHeader))[term_id];
+
+                return true;
+            }
+        }
+
+        const std::map<lemur::api::TERMID_T, TermBound>::const_iterator it =
+            bounds_.find(term_id);
+
+        if (it == bounds_.end()) {
+            return false;
+        }
+
+        *bound = it->second;
+
+        return true;
+    }
+
+    void insert(const lemur::api::TERMID_T term_id, const TermBound& bound) {
+        indri::thread::ScopedLock lock(mutex_);
+
+        bounds_[term_id] = bound;
+    }
+
+ private:
+    indri::thread::Mutex mutex_;
+
+    MappedFile file_;
+    std::map<lemur::api::TERMID_T, TermBound> bounds_;
+};
+
+class DocumentLengths {
+ public:
+    virtual ~DocumentLengths() {}
+
+    virtual int length(const lemur::api::DOCID_T int_document_id) = 0;
+};
+
+struct CollectionStatistics {
+    uint64_t num_documents;
+    uint64_t total_terms;
+};
+
+struct RetrievalTerm {
+    // Zero if the term does not occur in the index.
+    lemur::api::TERMID_T term_id;
+    double weight;
+
+    uint64_t document_frequency;
+    uint64_t term_frequency;
+
+    TermBound bound;
+};
+
+// Bag-of-words retrieval model whose scores decompose into a part that only
+// depends on the document length and per-term contributions of the matching
+// terms, such that WAND can bound them from above.
+class RetrievalModel {
+ public:
+    virtual ~RetrievalModel() {}
+
+    virtual void prepare(const CollectionStatistics& statistics,
+                         const std::vector<RetrievalTerm>& terms) = 0;
+
+    virtual double score(const std::vector<int>& term_frequencies,
+                         const int document_length) const = 0;
+
+    // Upper bound on the score of a document that matches none of the terms.
+    virtual double base_upper_bound() const = 0;
+
+    // Upper bound on the score contribution of matching the i-th term.
+    virtual double term_upper_bound(const size_t i) const = 0;
+};
+
+// Query likelihood with Dirichlet smoothing, scored as Indri does for
+// #combine/#weight queries under its default scoring rules.
+class DirichletModel : public RetrievalModel {
+ public:
+    explicit DirichletModel(const double mu) : mu_(mu) {}
+
+    void prepare(const CollectionStatistics& statistics,
+                 const std::vector<RetrievalTerm>& terms) {
+        weights_.clear();
+        collection_probabilities_.clear();
+        max_term_frequencies_.clear();
+
+        // Documents are only scored if they match a term, and are thus at
+        // least as long as the shortest document that contains one.
+        min_document_length_ = 0;
+        bool matched = false;
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            if (terms[i].bound.max_term_frequency == 0) {
+                continue;
+            }
+
+            min_document_length_ = matched ?
+                std::min(min_document_length_,
+                         static_cast<double>(terms[i].bound.min_document_length)) :
+                terms[i].bound.min_document_length;
+            matched = true;
+        }
+
+        double total_weight = 0.0;
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            total_weight += terms[i].weight;
+        }
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const double total_terms = statistics.total_terms;
+
+            weights_.push_back(terms[i].weight / total_weight);
+            collection_probabilities_.push_back(
+                terms[i].term_frequency > 0 ?
+                terms[i].term_frequency / total_terms :
+                1.0 / (2.0 * total_terms));
+            max_term_frequencies_.push_back(terms[i].bound.max_term_frequency);
+        }
+    }
+
+    double score(const std::vector<int>& term_frequencies,
+                 const int document_length) const {
+        double score = 0.0;
+
+        for (size_t i = 0; i < weights_.size(); ++i) {
+            score += weights_[i] * log(
+                (term_frequencies[i] + mu_ * collection_probabilities_[i]) /
+                (document_length + mu_));
+        }
+
+        return score;
+    }
+
+    // The score of a document d decomposes into the sum over all terms of
+    // log(mu * p / (|d| + mu)), which decreases with |d| and is thus bounded
+    // at the minimum document length, and the sum over the matching terms of
+    // log1p(tf / (mu * p)), which increases with tf and is thus bounded at
+    // the maximum term frequency.
+    double base_upper_bound() const {
+        double bound = 0.0;
+
+        for (size_t i = 0; i < weights_.size(); ++i) {
+            bound += weights_[i] * log(
+                mu_ * collection_probabilities_[i] / (min_document_length_ + mu_));
+        }
+
+        return bound;
+    }
+
+    double term_upper_bound(const size_t i) const {
+        return weights_[i] * log1p(
+            max_term_frequencies_[i] / (mu_ * collection_probabilities_[i]));
+    }
+
+ private:
+    const double mu_;
+
+    double min_document_length_;
+
+    std::vector<double> weights_;
+    std::vector<double> collection_probabilities_;
+    std::vector<double> max_term_frequencies_;
+};
+
+// Okapi BM25 with the non-negative idf of Lucene, log(1 + (N - df + 0.5) /
+// (df + 0.5)); query term weights act as query term frequencies.
+class BM25Model : public RetrievalModel {
+ public:
+    BM25Model(const double k1, const double b) : k1_(k1), b_(b) {}
+
+    void prepare(const CollectionStatistics& statistics,
+                 const std::vector<RetrievalTerm>& terms) {
+        weights_.clear();
+        upper_bounds_.clear();
+
+        average_document_length_ = statistics.num_documents > 0 ?
+            static_cast<double>(statistics.total_terms) / statistics.num_documents : 0.0;
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const double document_frequency = terms[i].document_frequency;
+            const double idf = log1p(
+                (statistics.num_documents - document_frequency + 0.5) /
+                (document_frequency + 0.5));
+
+            weights_.push_back(terms[i].weight * idf);
+
+            // The term contribution increases with the term frequency and
+            // decreases with the document length.
+            upper_bounds_.push_back(
+                terms[i].bound.max_term_frequency > 0 ?
+                weights_[i] * saturate(terms[i].bound.max_term_frequency,
+                                       terms[i].bound.min_document_length) :
+                0.0);
+        }
+    }
+
+    double score(const std::vector<int>& term_frequencies,
+                 const int document_length) const {
+        double score = 0.0;
+
+        for (size_t i = 0; i < weights_.size(); ++i) {
+            if (term_frequencies[i] > 0) {
+                score += weights_[i] * saturate(term_frequencies[i], document_length);
+            }
+        }
+
+        return score;
+    }
+
+    double base_upper_bound() const {
+        return 0.0;
+    }
+
+    double term_upper_bound(const size_t i) const {
+        return upper_bounds_[i];
+    }
+
+ private:
+    double saturate(const double term_frequency, const double document_length) const {
+        const double normalization = average_document_length_ > 0.0 ?
+            document_length / average_document_length_ : 0.0;
+
+        return term_frequency * (k1_ + 1.0) /
+            (term_frequency + k1_ * (1.0 - b_ + b_ * normalization));
+    }
+
+    const double k1_;
+    const double b_;
+
+    double average_document_length_;
+
+    std::vector<double> weights_;
+    std::vector<double> upper_bounds_;
+};
+
+struct ScoredDocument {
+    lemur::api::DOCID_T document;
+    double score;
+};
+
+// Ranks by decreasing score, breaking ties by increasing identifier.
+struct ScoredDocumentRank {
+    bool operator()(const ScoredDocument& first, const ScoredDocument& second) const {
+        return first.score > second.score ||
+            (first.score == second.score && first.document < second.document);
+    }
+};
+
+struct PostingCursor {
+    indri::index::DocListIterator* doc_list_it;
+    size_t term;
+
+    // Current document, or DOCUMENT_END when the list is exhausted.
+    lemur::api::DOCID_T document;
+    double upper_bound;
+
+    static const lemur::api::DOCID_T DOCUMENT_END = INT_MAX;
+
+    bool operator<(const PostingCursor& other) const {
+        return document < other.document;
+    }
+
+    void sync() {
+        document = doc_list_it->finished() ?
+            DOCUMENT_END : doc_list_it->currentEntry()->document;
+    }
+
+    int term_frequency() const {
+        return doc_list_it->currentEntry()->positions.size();
+    }
+};
+
+// Slack on the pruning threshold that absorbs rounding differences between
+// the exact scores and their decomposed upper bounds.
+static const double WAND_EPSILON = 1e-9;
+
+// Computes the top-k documents under the retrieval model using WAND. The
+// cursors must be positioned at the start of their lists and are consumed.
+// Throws lemur::api::Exception on I/O errors.
+static void wand_retrieve(const RetrievalModel& model,
+                          const size_t num_terms,
+                          std::vector<PostingCursor>* const cursors,
+                          DocumentLengths* const document_lengths,
+                          const size_t k,
+                          std::vector<ScoredDocument>* const results) {
+    results->clear();
+
+    if (k == 0) {
+        return;
+    }
+
+    // Min-heap on the rank; its top is the k-th best document so far.
+    std::vector<ScoredDocument> heap;
+    const ScoredDocumentRank rank;
+
+    std::vector<int> term_frequencies(num_terms, 0);
+
+    const double base_upper_bound = model.base_upper_bound();
+
+    for (size_t i = 0; i < cursors->size(); ++i) {
+        (*cursors)[i].upper_bound = model.term_upper_bound((*cursors)[i].term);
+        (*cursors)[i].sync();
+    }
+
+    std::sort(cursors->begin(), cursors->end());
+
+    while (true) {
+        const bool full = heap.size() >= k;
+        const double threshold = full ? heap.front().score : 0.0;
+
+        // Find the first cursor at which the accumulated upper bounds
+        // exceed the threshold; documents before it cannot enter the top-k.
+        size_t pivot = cursors->size();
+        double upper_bound = base_upper_bound;
+
+        for (size_t i = 0; i < cursors->size(); ++i) {
+            if ((*cursors)[i].document == PostingCursor::DOCUMENT_END) {
+                break;
+            }
+
+            upper_bound += (*cursors)[i].upper_bound;
+
+            if (!full ||
+                upper_bound + WAND_EPSILON * (1.0 + fabs(threshold)) > threshold) {
+                pivot = i;
+
+                break;
+            }
+        }
+
+        if (pivot == cursors->size()) {
+            break;
+        }
+
+        const lemur::api::DOCID_T pivot_document = (*cursors)[pivot].document;
+
+        if ((*cursors)[0].document == pivot_document) {
+            std::fill(term_frequencies.begin(), term_frequencies.end(), 0);
+
+            for (size_t i = 0;
+                 i < cursors->size() && (*cursors)[i].document == pivot_document;
+                 ++i) {
+                PostingCursor& cursor = (*cursors)[i];
+
+                term_frequencies[cursor.term] += cursor.term_frequency();
+
+                cursor.doc_list_it->nextEntry();
+                cursor.sync();
+            }
+
+            ScoredDocument scored_document;
+            scored_document.document = pivot_document;
+            scored_document.score = model.score(
+                term_frequencies, document_lengths->length(pivot_document));
+
+            if (!full) {
+                heap.push_back(scored_document);
+                std::push_heap(heap.begin(), heap.end(), rank);
+            } else if (rank(scored_document, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), rank);
+                heap.back() = scored_document;
+                std::push_heap(heap.begin(), heap.end(), rank);
+            }
+        } else {
+            for (size_t i = 0; i < pivot; ++i) {
+                PostingCursor& cursor = (*cursors)[i];
+
+                if (cursor.document < pivot_document) {
+                    cursor.doc_list_it->nextEntry(pivot_document);
+                    cursor.sync();
+                }
+            }
+        }
+
+        std::sort(cursors->begin(), cursors->end());
+    }
+
+    std::sort_heap(heap.begin(), heap.end(), rank);
+    results->swap(heap);
+}
+
 // Index
 
-typedef struct {
-    PyObject_HEAD
+static const size_t DEFAULT_DOCUMENT_CACHE_SIZE = 1024;
+static const size_t DOCNO_CACHE_SIZE = 64 << 20;  // Bytes.
+
+typedef struct {
+    PyObject_HEAD
+
+    indri::api::Parameters* parameters_;
+    std::string* repository_path_;
+    std::string* index_path_;  // Relative to repository_path_.
+
+    // Constructor arguments, kept to reset and pickle the index.
+    Py_ssize_t document_cache_size_;
+    Py_ssize_t result_cache_size_;
+    bool shared_;
+    // Whether share_sidecars succeeded, such that forked children load the
+    // sidecars as they are. Accessed atomically.
+    bool sidecars_shared_;
+
+    // Set, atomically, by the first call of __init__; the handles above are
+    // read without locks, so an index cannot be initialized again.
+    bool initialized_;
+
+    // Name of the stemmer applied during indexing, empty if none.
+    std::string* stemmer_;
+    // Words removed during indexing by the stopper.
+    std::set<std::string>* stopwords_;
+
+    indri::collection::CompressedCollection* collection_;
+    indri::index::DiskIndex* index_;
+
+    // Serializes random-access reads from index_, as they share file buffers
+    // and may happen without holding the GIL.
+    indri::thread::Mutex* index_lock_;
+
+    QueryEnvironmentPool* query_env_pool_;
+    DiskIndexPool* index_pool_;
+
+    Instrumentation* instrumentation_;
+
+    TermBoundCache* term_bounds_;
+    DocumentCache* document_cache_;
+    ResultCache* result_cache_;
+    DocnoTable* docno_table_;
+    DocnoCache* docno_cache_;
+    VocabularyHash* vocabulary_;
+    StatisticsTable* statistics_;
+
+    // Components that may be used, and those opened so far (masks of
+    // IndexComponent); see require_components.
+    int components_;
+    int opened_components_;
+    indri::thread::Mutex* open_lock_;
+
+    // Process that owns the locks and handles above; forked children reset
+    // them on first use (see Index_reset_after_fork).
+    pid_t pid_;
+} Index;
+
+// Serializes the resets of indexes inherited by a forked child.
+static indri::thread::Mutex* fork_reset_lock = new indri::thread::Mutex;
+
+// Components.
+
+// Subsystems of an index, each opened on first use, such that a process that
+// only reads, e.g., document lengths does not pay for opening the others.
+enum IndexComponent {
+    INDEX_COMPONENT = 1,       // DiskIndex and the sidecars next to it.
+    COLLECTION_COMPONENT = 2,  // CompressedCollection: docnos and text.
+    QUERY_COMPONENT = 4        // Pooled QueryEnvironments.
+};
+
+static const int ALL_COMPONENTS =
+    INDEX_COMPONENT | COLLECTION_COMPONENT | QUERY_COMPONENT;
+
+static const struct {
+    const char* name;
+    int component;
+} COMPONENTS[] = {
+    {"index", INDEX_COMPONENT},
+    {"collection", COLLECTION_COMPONENT},
+    {"query", QUERY_COMPONENT},
+};
+
+static const size_t NUM_COMPONENTS = sizeof(COMPONENTS) / sizeof(COMPONENTS[0]);
+
+// Loads the sidecars next to the opened DiskIndex; shared indexes (re)build
+// missing or outdated sidecars instead (see share_sidecars), until they were
+// shared once. Does not require the GIL. Returns false and sets *error if a
+// sidecar is invalid.
+static bool load_index_sidecars(Index* self, std::string* const error) {
+    const std::string& repository_path = *self->repository_path_;
+
+    if (!self->term_bounds_->load(
+            indri::file::Path::combine(repository_path, MAX_SCORE_FILENAME))) {
+        *error = "Max-score file is corrupt or outdated.";
+
+        return false;
+    }
+
+    self->docno_cache_->reset(self->index_->documentBase(),
+                              self->index_->documentMaximum());
+
+    if (self->shared_ && !__atomic_load_n(&self->sidecars_shared_, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    if (!self->docno_table_->load(
+            indri::file::Path::combine(repository_path, DOCNO_TABLE_FILENAME),
+            self->index_->documentMaximum())) {
+        *error = "Docno table is corrupt or outdated.";
+
+        return false;
+    }
+
+    if (!self->statistics_->load(
+            indri::file::Path::combine(repository_path, STATISTICS_FILENAME),
+            self->index_->documentBase(),
+            self->index_->documentMaximum(),
+            self->index_->termCount(),
+            self->index_->uniqueTermCount())) {
+        *error = "Statistics sidecar is corrupt or outdated.";
+
+        return false;
+    }
+
+    return true;
+}
+
+// Opens the component. Does not require the GIL; must be called with
+// open_lock_ held. Returns false and sets *error on failure.
+static bool open_component(Index* self, const int component, std::string* const error) {
+    const std::string& repository_path = *self->repository_path_;
+
+    try {
+        switch (component) {
+            case INDEX_COMPONENT:
+                self->index_->open(repository_path, *self->index_path_);
+
+                // Closed again, such that the next attempt reopens it.
+                if (!load_index_sidecars(self, error)) {
+                    self->index_->close();
+
+                    return false;
+                }
+
+                break;
+            case COLLECTION_COMPONENT:
+                self->collection_->open(
+                    indri::file::Path::combine(repository_path, "collection"));
+
+                break;
+            case QUERY_COMPONENT:
+                // Opens the first pooled QueryEnvironment, such that errors
+                // surface here; others are opened by the pool on demand.
+                self->query_env_pool_->release(self->query_env_pool_->acquire());
+
+                break;
+        }
+    } catch (const lemur::api::Exception& e) {
+        *error = e.what().empty() ? "Unable to open " + repository_path + "." : e.what();
+
+        return false;
+    }
+
+    self->opened_components_ |= component;
+
+    return true;
+}
+
+// Replaces the locks and handles of an index inherited by a forked child, as
+// other threads of the parent may have held them at the time of the fork;
+// the old ones are deliberately leaked. The collection, which serializes
+// reads under an internal lock, is reopened if it was open; pooled handles
+// are reopened on first use. Sidecars are mapped again, as their tables are
+// guarded by locks of their own; the mappings share the parent's pages.
+// Sets *error if the collection fails to reopen or a sidecar fails to load.
+static void reset_handles(Index* self, std::string* const error) {
+    const std::string& repository_path = *self->repository_path_;
+
+    self->index_lock_ = new indri::thread::Mutex;
+    self->open_lock_ = new indri::thread::Mutex;
+
+    self->collection_ = new indri::collection::CompressedCollection;
+
+    if (self->opened_components_ & COLLECTION_COMPONENT) {
+        try {
+            self->collection_->open(
+                indri::file::Path::combine(repository_path, "collection"));
+        } catch (const lemur::api::Exception& e) {
+            // Reopened by require_components on the next attempt.
+            self->opened_components_ &= ~COLLECTION_COMPONENT;
+
+            *error = e.what().empty() ?
+                "Unable to reopen the collection of " + repository_path + "." : e.what();
+        }
+    }
+
+    // The first pooled QueryEnvironment of the child is opened on demand.
+    self->opened_components_ &= ~QUERY_COMPONENT;
+
+    self->query_env_pool_ = new QueryEnvironmentPool;
+    self->query_env_pool_->set_repository_path(repository_path);
+
+    self->index_pool_ = new DiskIndexPool;
+    self->index_pool_->set_path(repository_path, *self->index_path_);
+
+    // Keeps counting, from zero, if enabled in the parent.
+    self->instrumentation_ = new Instrumentation(self->instrumentation_->enabled());
+
+    self->term_bounds_ = new TermBoundCache;
+    self->document_cache_ = new DocumentCache(self->document_cache_size_,
+                                              self->instrumentation_);
+
+    self->result_cache_ = new ResultCache;
+    self->result_cache_->set_capacity(self->result_cache_size_);
+
+    self->docno_table_ = new DocnoTable;
+    self->docno_cache_ = new DocnoCache(DOCNO_CACHE_SIZE);
+    self->vocabulary_ = new VocabularyHash;
+    self->statistics_ = new StatisticsTable;
+
+    // The DiskIndex itself is only read under index_lock_, and is kept.
+    if (!(self->opened_components_ & INDEX_COMPONENT)) {
+        return;
+    }
+
+    std::string sidecar_error;
+
+    if (!load_index_sidecars(self, &sidecar_error)) {
+        // Reopened, and the error raised again, by require_components, as
+        // when the parent opened the index.
+        self->index_->close();
+        self->opened_components_ &= ~INDEX_COMPONENT;
+
+        if (error->empty()) {
+            *error = sidecar_error;
+        }
+    }
+}
+
+// Resets the index if it was inherited from the parent of a forked process.
+// Sets an exception and returns false if the collection fails to reopen or a
+// sidecar fails to load.
+// Requires the GIL.
+static bool Index_reset_after_fork(Index* self) {
+    if (__atomic_load_n(&self->pid_, __ATOMIC_ACQUIRE) == getpid()) {
+        return true;
+    }
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    {
+        indri::thread::ScopedLock lock(fork_reset_lock);
+
+        if (self->pid_ != getpid()) {
+            if (!self->repository_path_->empty()) {
+                reset_handles(self, &error);
+            }
+
+            __atomic_store_n(&self->pid_, getpid(), __ATOMIC_RELEASE);
+        }
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return false;
+    }
+
+    return true;
+}
+
+// Opens the components (a mask of IndexComponent) that were not opened yet.
+// Sets an exception and returns false if a component fails to open, or was
+// excluded when the index was constructed. Requires the GIL.
+static bool require_components(Index* self, const int components) {
+    if (!Index_reset_after_fork(self)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < NUM_COMPONENTS; ++i) {
+        if ((components & COMPONENTS[i].component) &&
+            !(self->components_ & COMPONENTS[i].component)) {
+            PyErr_Format(PyExc_RuntimeError,
+                         "Index was opened without the %s component.",
+                         COMPONENTS[i].name);
+
+            return false;
+        }
+    }
+
+    {
+        indri::thread::ScopedLock lock(self->open_lock_);
+
+        if ((self->opened_components_ & components) == components) {
+            return true;
+        }
+    }
+
+    std::string error;
+
+    // Opening may take long on network filesystems; other threads proceed
+    // meanwhile, unless they require the same index.
+    Py_BEGIN_ALLOW_THREADS
+
+    {
+        indri::thread::ScopedLock lock(self->open_lock_);
+
+        for (size_t i = 0; i < NUM_COMPONENTS && error.empty(); ++i) {
+            if ((components & COMPONENTS[i].component) &&
+                !(self->opened_components_ & COMPONENTS[i].component)) {
+                open_component(self, COMPONENTS[i].component, &error);
+            }
+        }
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return false;
+    }
+
+    return true;
+}
+
+// Sidecars.
+
+// Sidecar builders do not require the GIL. They return false and set *error
+// on read errors, or leave *error empty and set errno on write errors.
+
+static bool build_docno_table(Index* self,
+                              const std::string& path,
+                              std::string* const error) {
+    const lemur::api::DOCID_T document_maximum = self->index_->documentMaximum();
+
+    std::vector<DocnoEntry> entries;
+
+    try {
+        for (lemur::api::DOCID_T int_document_id = self->index_->documentBase();
+             int_document_id < document_maximum;
+             ++int_document_id) {
+            DocnoEntry entry;
+            entry.docno = self->collection_->retrieveMetadatum(int_document_id, "docno");
+            entry.int_document_id = int_document_id;
+
+            if (!entry.docno.empty()) {
+                entries.push_back(entry);
+            }
+        }
+    } catch (const lemur::api::Exception& e) {
+        *error = e.what().empty() ? "Unable to read document metadata." : e.what();
+
+        return false;
+    }
+
+    return write_docno_table(&entries, document_maximum, path);
+}
+
+static bool build_statistics(Index* self,
+                             const std::vector<VocabularyEntry>& entries,
+                             const std::string& path) {
+    StatisticsHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, STATISTICS_MAGIC, sizeof(header.magic));
+    header.version = STATISTICS_VERSION;
+    header.document_base = self->index_->documentBase();
+    header.document_maximum = self->index_->documentMaximum();
+    header.num_documents = self->index_->documentCount();
+    header.total_terms = self->index_->termCount();
+    header.unique_terms = self->index_->uniqueTermCount();
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        header.max_term_id = std::max(
+            header.max_term_id, static_cast<uint64_t>(entries[i].term_id));
+    }
+
+    std::vector<uint32_t> lengths;
+    lengths.reserve(header.document_maximum - header.document_base);
+
+    {
+        indri::thread::ScopedLock lock(self->index_lock_);
+
+        for (lemur::api::DOCID_T int_document_id = header.document_base;
+             int_document_id < static_cast<lemur::api::DOCID_T>(header.document_maximum);
+             ++int_document_id) {
+            lengths.push_back(self->index_->documentLength(int_document_id));
+        }
+    }
+
+    std::vector<uint64_t> dfs(header.max_term_id + 1, 0);
+    std::vector<uint64_t> cfs(header.max_term_id + 1, 0);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        dfs[entries[i].term_id] = entries[i].document_frequency;
+        cfs[entries[i].term_id] = entries[i].term_frequency;
+    }
+
+    return write_statistics(header, &lengths, dfs, cfs, path);
+}
+
+// Returns whether the dictionary snapshot exists and covers the vocabulary.
+static bool dictionary_snapshot_is_current(const std::string& path,
+                                           const uint64_t unique_terms) {
+    MappedFile file;
+
+    if (!file.open(path) || file.size() < sizeof(DictionarySnapshotHeader)) {
+        return false;
+    }
+
+    const DictionarySnapshotHeader* const header =
+        reinterpret_cast<const DictionarySnapshotHeader*>(file.data());
+
+    return memcmp(header->magic, DICTIONARY_SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == DICTIONARY_SNAPSHOT_VERSION &&
+        header->num_terms == unique_terms;
+}
+
+// Raises the error of a failed sidecar builder.
+static void set_build_error(const std::string& error, const std::string& path) {
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+    } else {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path.c_str());
+    }
+}
+
+// Builds the sidecars that processes sharing the repository map: the docno
+// table, the dictionary snapshot and the statistics. Current sidecars are
+// kept. Sets an exception and returns false on failure.
+static bool share_sidecars(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return false;
+    }
+
+    const std::string docnos_path = indri::file::Path::combine(
+        *self->repository_path_, DOCNO_TABLE_FILENAME);
+    const std::string dictionary_path = indri::file::Path::combine(
+        *self->repository_path_, DICTIONARY_SNAPSHOT_FILENAME);
+    const std::string statistics_path = indri::file::Path::combine(
+        *self->repository_path_, STATISTICS_FILENAME);
+
+    const lemur::api::DOCID_T document_base = self->index_->documentBase();
+    const lemur::api::DOCID_T document_maximum = self->index_->documentMaximum();
+    const uint64_t total_terms = self->index_->termCount();
+    const uint64_t unique_terms = self->index_->uniqueTermCount();
+
+    const bool docnos_current =
+        self->docno_table_->load(docnos_path, document_maximum) &&
+        self->docno_table_->is_open();
+    const bool statistics_current =
+        self->statistics_->load(statistics_path, document_base, document_maximum,
+                                total_terms, unique_terms) &&
+        self->statistics_->header() != NULL;
+    const bool dictionary_current = dictionary_snapshot_is_current(
+        dictionary_path, unique_terms);
+
+    // Only the docno table is built from the collection.
+    if (!docnos_current && !require_components(self, COLLECTION_COMPONENT)) {
+        return false;
+    }
+
+    std::string error;
+    std::string failed_path;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    if (!docnos_current && !build_docno_table(self, docnos_path, &error)) {
+        failed_path = docnos_path;
+    }
+
+    if (failed_path.empty() && (!statistics_current || !dictionary_current)) {
+        std::vector<VocabularyEntry> entries;
+
+        try {
+            ScopedDiskIndex index(self->index_pool_);
+
+            read_vocabulary(index.get(), &entries);
+        } catch (const lemur::api::Exception& e) {
+            error = e.what().empty() ? "Unable to read vocabulary." : e.what();
+            failed_path = dictionary_path;
+        }
+
+        if (failed_path.empty() && !statistics_current &&
+            !build_statistics(self, entries, statistics_path)) {
+            failed_path = statistics_path;
+        }
+
+        if (failed_path.empty() && !dictionary_current &&
+            !write_dictionary_snapshot(&entries, dictionary_path)) {
+            failed_path = dictionary_path;
+        }
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!failed_path.empty()) {
+        set_build_error(error, failed_path);
+
+        return false;
+    }
+
+    if (!self->docno_table_->load(docnos_path, document_maximum)) {
+        PyErr_SetString(PyExc_IOError, "Docno table is corrupt or outdated.");
+
+        return false;
+    }
+
+    if (!self->statistics_->load(statistics_path, document_base, document_maximum,
+                                 total_terms, unique_terms)) {
+        PyErr_SetString(PyExc_IOError, "Statistics sidecar is corrupt or outdated.");
+
+        return false;
+    }
+
+    __atomic_store_n(&self->sidecars_shared_, true, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Replaces the module-wide locks and pools in a forked child, as the parent
+// may have held them at the time of the fork. Indexes are only reset on first
+// use in the child, outside of the handler.
+static void fork_child() {
+    krovetz_stemmers = new KrovetzStemmerPool;
+
+    text_tokenizer_lock = new indri::thread::Mutex;
+    text_tokenizer = NULL;
+
+    snippet_executor_lock = new indri::thread::Mutex;
+    snippet_executor = NULL;
+
+    async_executor_lock = new indri::thread::Mutex;
+    async_executor = NULL;
+
+    fork_reset_lock = new indri::thread::Mutex;
+}
+
+static void Index_dealloc(Index* self) {
+    delete self->parameters_;
+    delete self->repository_path_;
+    delete self->index_path_;
+    delete self->stemmer_;
+    delete self->stopwords_;
+
+    // Locks and handles inherited from the parent of a forked process, but
+    // never reset, are leaked as they would have been on reset.
+    if (self->pid_ != getpid()) {
+        return;
+    }
+
+    // self->collection_->close();
+
+    if (self->opened_components_ & INDEX_COMPONENT) {
+        self->index_->close();
+    }
+
+    // delete self->collection_;
+    delete self->index_;
+    delete self->index_lock_;
+    delete self->query_env_pool_;
+    delete self->index_pool_;
+    delete self->term_bounds_;
+    delete self->document_cache_;
+    delete self->instrumentation_;
+    delete self->result_cache_;
+    delete self->docno_table_;
+    delete self->docno_cache_;
+    delete self->vocabulary_;
+    delete self->statistics_;
+    delete self->open_lock_;
+}
+
+static PyObject* Index_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    Index* self;
+
+    self = (Index*) type->tp_alloc(type, 0);
+    if (self != NULL) {
+        self->parameters_ = new indri::api::Parameters;
+        self->repository_path_ = new std::string;
+        self->index_path_ = new std::string;
+        self->stemmer_ = new std::string;
+        self->stopwords_ = new std::set<std::string>;
+
+        self->document_cache_size_ = DEFAULT_DOCUMENT_CACHE_SIZE;
+        self->result_cache_size_ = 0;
+        self->shared_ = false;
+        self->sidecars_shared_ = false;
+        self->initialized_ = false;
+
+        self->collection_ = new indri::collection::CompressedCollection;
+        self->index_ = new indri::index::DiskIndex;
+        self->index_lock_ = new indri::thread::Mutex;
+
+        self->query_env_pool_ = new QueryEnvironmentPool;
+        self->index_pool_ = new DiskIndexPool;
+
+        self->instrumentation_ = new Instrumentation;
+
+        self->term_bounds_ = new TermBoundCache;
+        self->document_cache_ = new DocumentCache(DEFAULT_DOCUMENT_CACHE_SIZE,
+                                                  self->instrumentation_);
+        self->result_cache_ = new ResultCache;
+        self->docno_table_ = new DocnoTable;
+        self->docno_cache_ = new DocnoCache(DOCNO_CACHE_SIZE);
+        self->vocabulary_ = new VocabularyHash;
+        self->statistics_ = new StatisticsTable;
+
+        self->components_ = ALL_COMPONENTS;
+        self->opened_components_ = 0;
+        self->open_lock_ = new indri::thread::Mutex;
+
+        self->pid_ = getpid();
+    }
+
+    return (PyObject*) self;
+}
+
+// Returns the mask of the components named in the sequence, or -1 with an
+// exception set.
+static int read_components(PyObject* const names) {
+    std::vector<std::string> components;
+
+    if (PyUnicode_Check(names)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a sequence of component names.");
+
+        return -1;
+    }
+
+    if (!read_strings(names, &components)) {
+        return -1;
+    }
+
+    int mask = 0;
+
+    for (size_t i = 0; i < components.size(); ++i) {
+        size_t j = 0;
+
+        while (j < NUM_COMPONENTS && components[i] != COMPONENTS[j].name) {
+            ++j;
+        }
+
+        if (j == NUM_COMPONENTS) {
+            PyErr_Format(PyExc_ValueError,
+                         "Unknown component %s; expected index, collection or query.",
+                         components[i].c_str());
+
+            return -1;
+        }
+
+        mask |= COMPONENTS[j].component;
+    }
+
+    return mask;
+}
+
+static int Index_init(Index* self, PyObject* args, PyObject* kwds) {
+    char* repository_path = "";
+    Py_ssize_t document_cache_size = DEFAULT_DOCUMENT_CACHE_SIZE;
+    Py_ssize_t result_cache_size = 0;
+    int shared = 0;
+    PyObject* components = Py_None;
+
+    static char* kwlist[] = {"repository_path",
+                             "document_cache_size",
+                             "result_cache_size",
+                             "shared",
+                             "components",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|nnpO", kwlist,
+                                     &repository_path,
+                                     &document_cache_size,
+                                     &result_cache_size,
+                                     &shared,
+                                     &components)) {
+        return -1;
+    }
+
+    if (__atomic_exchange_n(&self->initialized_, true, __ATOMIC_ACQ_REL)) {
+        PyErr_SetString(PyExc_RuntimeError, "Index is already initialized.");
+
+        return -1;
+    }
+
+    if (document_cache_size < 0 || result_cache_size < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Cache sizes should be non-negative.");
+
+        return -1;
+    }
+
+    // Without an explicit list, all components are opened on first use.
+    self->components_ = ALL_COMPONENTS;
+
+    if (components != Py_None &&
+        (self->components_ = read_components(components)) < 0) {
+        return -1;
+    }
+
+    self->document_cache_->set_capacity(document_cache_size);
+    self->result_cache_->set_capacity(result_cache_size);
+
+    self->document_cache_size_ = document_cache_size;
+    self->result_cache_size_ = result_cache_size;
+    self->shared_ = shared;
+
+    // Load parameters.
+    self->parameters_->loadFile(indri::file::Path::combine(repository_path, "manifest"));
+
+    *self->repository_path_ = repository_path;
+
+    if (self->parameters_->exists("stemmer")) {
+        indri::api::Parameters stemmer = (*self->parameters_)["stemmer"];
+
+        if (stemmer.exists("name")) {
+            *self->stemmer_ = (std::string) stemmer["name"];
+        }
+    }
+
+    self->stopwords_->clear();
+
+    if (self->parameters_->exists("stopper")) {
+        indri::api::Parameters stopper = (*self->parameters_)["stopper"];
+
+        if (stopper.exists("word")) {
+            indri::api::Parameters words = stopper["word"];
+
+            for (size_t i = 0; i < words.size(); ++i) {
+                self->stopwords_->insert((std::string) words[i]);
+            }
+        }
+    }
+
+    // Locate index.
+    std::string index_path = "index";
+
+    indri::api::Parameters container = (*self->parameters_)["indexes"];
+
+    if(container.exists("index")) {
+        indri::api::Parameters indexes = container["index"];
+
+        if (indexes.size() != 1) {
+            PyErr_SetString(PyExc_IOError, "Indri repository contain more than one index.");
+
+            return -1;
+        }
+
+        index_path = indri::file::Path::combine(
+            index_path, (std::string) indexes[static_cast<size_t>(0)]);
+    } else {
+        PyErr_SetString(PyExc_IOError, "Indri repository does not contain an index.");
+
+        return -1;
+    }
+
+    self->query_env_pool_->set_repository_path(repository_path);
+    self->index_pool_->set_path(repository_path, index_path);
+
+    *self->index_path_ = index_path;
+
+    // Explicitly listed components are opened now, such that errors surface
+    // here.
+    if (components != Py_None &&
+        !require_components(self, self->components_)) {
+        return -1;
+    }
+
+    // Shared indexes (re)build missing or outdated sidecars.
+    if (self->shared_) {
+        return share_sidecars(self) ? 0 : -1;
+    }
+
+    return 0;
+}
+
+static PyMemberDef Index_members[] = {
+    {NULL}  /* Sentinel */
+};
+
+// Requires what lookup_docno reads: the docno table, or else the collection.
+static bool require_docno_lookup(Index* self) {
+    return require_components(self, INDEX_COMPONENT) &&
+        (self->docno_table_->is_open() ||
+         require_components(self, COLLECTION_COMPONENT));
+}
+
+// Appends the internal identifiers of the documents with the docno, from
+// the docno table if present. Does not require the GIL; throws
+// lemur::api::Exception on I/O errors.
+static void lookup_docno(Index* self,
+                         const std::string& ext_document_id,
+                         std::vector<lemur::api::DOCID_T>* const int_document_ids) {
+    if (self->docno_table_->find(ext_document_id, int_document_ids)) {
+        return;
+    }
+
+    const std::vector<lemur::api::DOCID_T> matches =
+        self->collection_->retrieveIDByMetadatum("docno", ext_document_id);
+
+    int_document_ids->insert(int_document_ids->end(), matches.begin(), matches.end());
+}
+
+static PyObject* Index_get_document_ids(Index* self, PyObject* args) {
+    if (!require_docno_lookup(self)) {
+        return NULL;
+    }
+
+    PyObject* external_doc_ids = NULL;
+
+    if (!PyArg_ParseTuple(args, "O", &external_doc_ids)) {
+        return NULL;
+    }
+
+    std::vector<std::string> ext_document_ids;
+
+    if (!read_strings(external_doc_ids, &ext_document_ids)) {
+        return NULL;
+    }
+
+    // The external identifier of each match is known from the request and
+    // does not need to be looked up again.
+    std::vector<size_t> positions;
+    std::vector<lemur::api::DOCID_T> int_doc_ids;
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        for (size_t pos = 0; pos < ext_document_ids.size(); ++pos) {
+            lookup_docno(self, ext_document_ids[pos], &int_doc_ids);
+
+            positions.resize(int_doc_ids.size(), pos);
+        }
+    } catch (const lemur::api::Exception& e) {
+        error = e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const doc_ids_tuple = PyTuple_New(int_doc_ids.size());
+
+    for (size_t i = 0; i < int_doc_ids.size(); ++i) {
+        PyTuple_SetItem(doc_ids_tuple,
+                        i,
+                        PyTuple_Pack(2,
+                            decode_string(ext_document_ids[positions[i]]),
+                            PyLong_FromLong(int_doc_ids[i])));
+    }
+
+    return doc_ids_tuple;
+}
+
+static PyObject* Index_resolve_document_ids(Index* self, PyObject* args) {
+    if (!require_docno_lookup(self)) {
+        return NULL;
+    }
+
+    PyObject* external_doc_ids = NULL;
+
+    if (!PyArg_ParseTuple(args, "O", &external_doc_ids)) {
+        return NULL;
+    }
+
+    std::vector<std::string> ext_document_ids;
+
+    if (!read_strings(external_doc_ids, &ext_document_ids)) {
+        return NULL;
+    }
+
+    std::vector<int32_t> int_document_ids(ext_document_ids.size(), -1);
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    std::vector<lemur::api::DOCID_T> matches;
+
+    try {
+        for (size_t pos = 0; pos < ext_document_ids.size(); ++pos) {
+            matches.clear();
+            lookup_docno(self, ext_document_ids[pos], &matches);
+
+            if (!matches.empty()) {
+                int_document_ids[pos] = *std::min_element(matches.begin(), matches.end());
+            }
+        }
+    } catch (const lemur::api::Exception& e) {
+        error = e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    return Array_from_vector(&int_document_ids);
+}
+
+// Returns the docnos of the documents as a (blob, offsets) pair, where docno
+// i is blob[offsets[i]:offsets[i + 1]].
+static PyObject* docnos_to_tuple(Index* self,
+                                 const std::vector<int64_t>& int_document_ids) {
+    std::string blob;
+    std::vector<int64_t> offsets(1, 0);
+    offsets.reserve(int_document_ids.size() + 1);
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        for (size_t i = 0; i < int_document_ids.size(); ++i) {
+            self->docno_cache_->append(self->collection_, int_document_ids[i], &blob);
+            offsets.push_back(blob.size());
+        }
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read document metadata." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const blob_object = PyBytes_FromStringAndSize(blob.data(), blob.size());
+
+    if (blob_object == NULL) {
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", blob_object, Array_from_vector(&offsets));
+}
+
+static PyObject* Index_docnos(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT | COLLECTION_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* int_document_ids_object;
+
+    if (!PyArg_ParseTuple(args, "O", &int_document_ids_object)) {
+        return NULL;
+    }
+
+    std::vector<int64_t> int_document_ids;
+
+    if (!read_integers(int_document_ids_object, &int_document_ids)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < int_document_ids.size(); ++i) {
+        if (int_document_ids[i] < self->index_->documentBase() ||
+            int_document_ids[i] >= self->index_->documentMaximum()) {
+            PyErr_SetString(
+                PyExc_IndexError,
+                "Specified internal document identifier is out of bounds.");
+
+            return NULL;
+        }
+    }
+
+    return docnos_to_tuple(self, int_document_ids);
+}
+
+static PyObject* Index_all_docnos(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT | COLLECTION_COMPONENT)) {
+        return NULL;
+    }
+
+    std::vector<int64_t> int_document_ids;
+
+    for (lemur::api::DOCID_T int_document_id = self->index_->documentBase();
+         int_document_id < self->index_->documentMaximum();
+         ++int_document_id) {
+        int_document_ids.push_back(int_document_id);
+    }
+
+    return docnos_to_tuple(self, int_document_ids);
+}
+
+static PyObject* Index_share(Index* self) {
+    if (!share_sidecars(self)) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* Index_reduce(Index* self) {
+    PyObject* components = Py_None;
+
+    if (self->components_ == ALL_COMPONENTS) {
+        Py_INCREF(components);
+    } else {
+        components = PyList_New(0);
+
+        for (size_t i = 0; i < NUM_COMPONENTS; ++i) {
+            if (self->components_ & COMPONENTS[i].component) {
+                PyObject* const name = PyUnicode_FromString(COMPONENTS[i].name);
+
+                PyList_Append(components, name);
+                Py_DECREF(name);
+            }
+        }
+    }
+
+    return Py_BuildValue("(O(s#nnON))",
+                         Py_TYPE(self),
+                         self->repository_path_->data(),
+                         static_cast<Py_ssize_t>(self->repository_path_->size()),
+                         self->document_cache_size_,
+                         self->result_cache_size_,
+                         self->shared_ ? Py_True : Py_False,
+                         components);
+}
+
+static PyObject* Index_build_docno_table(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT | COLLECTION_COMPONENT)) {
+        return NULL;
+    }
+
+    const std::string path = indri::file::Path::combine(
+        *self->repository_path_, DOCNO_TABLE_FILENAME);
+
+    std::string error;
+    bool success;
+
+    Py_BEGIN_ALLOW_THREADS
+    success = build_docno_table(self, path, &error);
+    Py_END_ALLOW_THREADS
+
+    if (!success) {
+        set_build_error(error, path);
+
+        return NULL;
+    }
+
+    if (!self->docno_table_->load(path, self->index_->documentMaximum())) {
+        PyErr_SetString(PyExc_IOError, "Docno table is corrupt or outdated.");
+
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// Reads the docno and terms of a document through a pooled DiskIndex. Does
+// not require the GIL; throws lemur::api::Exception on I/O errors.
+static void read_document(Index* self,
+                          const lemur::api::DOCID_T int_document_id,
+                          std::string* const ext_document_id,
+                          std::vector<int32_t>* const terms) {
+    *ext_document_id = self->collection_->retrieveMetadatum(
+        int_document_id, "docno");
+
+    ScopedTimer timer(self->instrumentation_, DOCUMENTS_PHASE);
+    ScopedDiskIndex index(self->index_pool_);
+
+    const indri::index::TermList* const term_list = index->termList(int_document_id);
+
+    if (term_list != NULL) {
+        terms->assign(term_list->terms().begin(), term_list->terms().end());
+
+        delete term_list;
+
+        self->instrumentation_->increment(DOCUMENTS_DECODED_COUNTER);
+    }
+}
+
+// Reads a document with the GIL released. Sets an exception and returns
+// false on failure.
+static bool read_document_without_gil(Index* self,
+                                      const int int_document_id,
+                                      std::string* const ext_document_id,
+                                      std::vector<int32_t>* const terms) {
+    if (int_document_id < self->index_->documentBase() ||
+        int_document_id >= self->index_->documentMaximum()) {
+        PyErr_SetString(
+            PyExc_IndexError,
+            "Specified internal document identifier is out of bounds.");
+
+        return false;
+    }
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        read_document(self, int_document_id, ext_document_id, terms);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read document." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return false;
+    }
+
+    return true;
+}
+
+// Converts a document to an (ext_document_id, (term_id, ...)) pair.
+static PyObject* document_to_tuple(const std::string& ext_document_id,
+                                   const std::vector<int32_t>& term_ids) {
+    PyObject* const terms = PyTuple_New(term_ids.size());
+
+    for (size_t pos = 0; pos < term_ids.size(); ++pos) {
+        PyTuple_SetItem(terms, pos, PyLong_FromLong(term_ids[pos]));
+    }
+
+    return Py_BuildValue("(NN)", decode_string(ext_document_id), terms);
+}
+
+static PyObject* Index_document(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT | COLLECTION_COMPONENT)) {
+        return NULL;
+    }
+
+    int int_document_id;
+
+    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
+        return NULL;
+    }
+
+    string ext_document_id;
+    std::vector<int32_t> term_ids;
+
+    if (!read_document_without_gil(self, int_document_id, &ext_document_id, &term_ids)) {
+        return NULL;
+    }
+
+    return document_to_tuple(ext_document_id, term_ids);
+}
+
+static PyObject* Index_document_array(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT | COLLECTION_COMPONENT)) {
+        return NULL;
+    }
+
+    int int_document_id;
+
+    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
+        return NULL;
+    }
+
+    string ext_document_id;
+    std::vector<int32_t> terms;
+
+    if (!read_document_without_gil(self, int_document_id, &ext_document_id, &terms)) {
+        return NULL;
+    }
+
+    PyObject* const terms_array = Array_from_vector(&terms);
+
+    if (terms_array == NULL) {
+        return NULL;
+    }
+
+    PyObject* const result = PyTuple_Pack(
+        2, decode_string(ext_document_id), terms_array);
+
+    Py_DECREF(terms_array);
+
+    return result;
+}
+
+static PyObject* Index_document_range(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    int start_document_id;
+    int end_document_id;
+
+    if (!PyArg_ParseTuple(args, "ii", &start_document_id, &end_document_id)) {
+        return NULL;
+    }
+
+    if (start_document_id < self->index_->documentBase() ||
+        end_document_id > self->index_->documentMaximum() ||
+        start_document_id > end_document_id) {
+        PyErr_SetString(
+            PyExc_IndexError,
+            "Specified internal document identifier range is out of bounds.");
+
+        return NULL;
+    }
+
+    std::vector<int32_t> terms;
+    std::vector<int64_t> offsets;
+
+    offsets.reserve(end_document_id - start_document_id + 1);
+    offsets.push_back(0);
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        ScopedTimer timer(self->instrumentation_, DOCUMENTS_PHASE);
+        ScopedDiskIndex index(self->index_pool_);
+
+        uint64_t num_decoded = 0;
+
+        for (int int_document_id = start_document_id;
+             int_document_id < end_document_id;
+             ++int_document_id) {
+            const indri::index::TermList* const term_list =
+                index->termList(int_document_id);
+
+            if (term_list != NULL) {
+                terms.insert(terms.end(),
+                             term_list->terms().begin(),
+                             term_list->terms().end());
+
+                delete term_list;
+
+                ++num_decoded;
+            }
+
+            offsets.push_back(terms.size());
+        }
+
+        self->instrumentation_->increment(DOCUMENTS_DECODED_COUNTER, num_decoded);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read term lists." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const terms_array = Array_from_vector(&terms);
+    PyObject* const offsets_array = Array_from_vector(&offsets);
+
+    if (terms_array == NULL || offsets_array == NULL) {
+        Py_XDECREF(terms_array);
+        Py_XDECREF(offsets_array);
+
+        return NULL;
+    }
+
+    PyObject* const result = PyTuple_Pack(2, terms_array, offsets_array);
+
+    Py_DECREF(terms_array);
+    Py_DECREF(offsets_array);
+
+    return result;
+}
+
+// Document vectors: the terms of documents along with their field extents,
+// such that passages and fields can be scored without re-parsing the stored
+// documents. Term positions are offsets into the terms of a document; field
+// i of a document spans its terms [begins[i], ends[i]).
+struct DocumentVectors {
+    std::vector<int32_t> terms;
+    std::vector<int64_t> term_offsets;
+
+    std::vector<int32_t> field_ids;
+    std::vector<int32_t> begins;
+    std::vector<int32_t> ends;
+    std::vector<int64_t> field_offsets;
+};
+
+// Appends the vectors of the documents; documents without a term list are
+// left empty. Does not require the GIL; throws lemur::api::Exception on I/O
+// errors.
+static void read_document_vectors(Index* self,
+                                  const std::vector<lemur::api::DOCID_T>& int_document_ids,
+                                  DocumentVectors* const vectors) {
+    ScopedTimer timer(self->instrumentation_, DOCUMENTS_PHASE);
+    ScopedDiskIndex index(self->index_pool_);
+
+    vectors->term_offsets.push_back(0);
+    vectors->field_offsets.push_back(0);
+
+    uint64_t num_decoded = 0;
+
+    for (size_t i = 0; i < int_document_ids.size(); ++i) {
+        const indri::index::TermList* const term_list =
+            index->termList(int_document_ids[i]);
+
+        if (term_list != NULL) {
+            vectors->terms.insert(vectors->terms.end(),
+                                  term_list->terms().begin(),
+                                  term_list->terms().end());
+
+            const indri::utility::greedy_vector<indri::index::FieldExtent>& fields =
+                term_list->fields();
+
+            for (size_t pos = 0; pos < fields.size(); ++pos) {
+                vectors->field_ids.push_back(fields[pos].id);
+                vectors->begins.push_back(fields[pos].begin);
+                vectors->ends.push_back(fields[pos].end);
+            }
+
+            delete term_list;
+
+            ++num_decoded;
+        }
+
+        vectors->term_offsets.push_back(vectors->terms.size());
+        vectors->field_offsets.push_back(vectors->field_ids.size());
+    }
+
+    self->instrumentation_->increment(DOCUMENTS_DECODED_COUNTER, num_decoded);
+}
+
+// Reads the document vectors with the GIL released and returns them as
+// (terms, term_offsets, field_ids, begins, ends, field_offsets) arrays, or
+// only (terms, field_ids, begins, ends) for a single document.
+static PyObject* document_vectors_to_tuple(Index* self,
+                                           const std::vector<lemur::api::DOCID_T>& int_document_ids,
+                                           const bool single_document) {
+    DocumentVectors vectors;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        read_document_vectors(self, int_document_ids, &vectors);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read term lists." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const terms = Array_from_vector(&vectors.terms);
+    PyObject* const field_ids = Array_from_vector(&vectors.field_ids);
+    PyObject* const begins = Array_from_vector(&vectors.begins);
+    PyObject* const ends = Array_from_vector(&vectors.ends);
+
+    if (single_document) {
+        if (terms == NULL || field_ids == NULL || begins == NULL || ends == NULL) {
+            Py_XDECREF(terms);
+            Py_XDECREF(field_ids);
+            Py_XDECREF(begins);
+            Py_XDECREF(ends);
+
+            return NULL;
+        }
+
+        return Py_BuildValue("(NNNN)", terms, field_ids, begins, ends);
+    }
+
+    PyObject* const term_offsets = Array_from_vector(&vectors.term_offsets);
+    PyObject* const field_offsets = Array_from_vector(&vectors.field_offsets);
+
+    if (terms == NULL || term_offsets == NULL || field_ids == NULL ||
+        begins == NULL || ends == NULL || field_offsets == NULL) {
+        Py_XDECREF(terms);
+        Py_XDECREF(term_offsets);
+        Py_XDECREF(field_ids);
+        Py_XDECREF(begins);
+        Py_XDECREF(ends);
+        Py_XDECREF(field_offsets);
+
+        return NULL;
+    }
+
+    return Py_BuildValue("(NNNNNN)",
+                         terms, term_offsets, field_ids, begins, ends, field_offsets);
+}
+
+static PyObject* Index_document_vector(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    int int_document_id;
+
+    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
+        return NULL;
+    }
+
+    if (int_document_id < self->index_->documentBase() ||
+        int_document_id >= self->index_->documentMaximum()) {
+        PyErr_SetString(
+            PyExc_IndexError,
+            "Specified internal document identifier is out of bounds.");
+
+        return NULL;
+    }
+
+    return document_vectors_to_tuple(
+        self, std::vector<lemur::api::DOCID_T>(1, int_document_id),
+        true /* single_document */);
+}
+
+static PyObject* Index_document_vectors(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* int_document_ids_object;
+
+    if (!PyArg_ParseTuple(args, "O", &int_document_ids_object)) {
+        return NULL;
+    }
+
+    std::vector<int64_t> int_document_ids;
+
+    if (!read_integers(int_document_ids_object, &int_document_ids)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < int_document_ids.size(); ++i) {
+        if (int_document_ids[i] < self->index_->documentBase() ||
+            int_document_ids[i] >= self->index_->documentMaximum()) {
+            PyErr_SetString(
+                PyExc_IndexError,
+                "Specified internal document identifier is out of bounds.");
+
+            return NULL;
+        }
+    }
+
+    return document_vectors_to_tuple(
+        self,
+        std::vector<lemur::api::DOCID_T>(int_document_ids.begin(), int_document_ids.end()),
+        false /* single_document */);
+}
+
+static PyObject* Index_document_vector_range(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    int start_document_id;
+    int end_document_id;
+
+    if (!PyArg_ParseTuple(args, "ii", &start_document_id, &end_document_id)) {
+        return NULL;
+    }
+
+    if (start_document_id < self->index_->documentBase() ||
+        end_document_id > self->index_->documentMaximum() ||
+        start_document_id > end_document_id) {
+        PyErr_SetString(
+            PyExc_IndexError,
+            "Specified internal document identifier range is out of bounds.");
+
+        return NULL;
+    }
+
+    std::vector<lemur::api::DOCID_T> int_document_ids;
+    int_document_ids.reserve(end_document_id - start_document_id);
+
+    for (int int_document_id = start_document_id;
+         int_document_id < end_document_id;
+         ++int_document_id) {
+        int_document_ids.push_back(int_document_id);
+    }
+
+    return document_vectors_to_tuple(self, int_document_ids, false /* single_document */);
+}
+
+// Returns the names of the indexed fields, keyed by field identifier. Fields
+// are numbered from one in the order of the repository manifest.
+static PyObject* Index_field_names(Index* self) {
+    PyObject* const field_names = PyDict_New();
+
+    if (!self->parameters_->exists("field")) {
+        return field_names;
+    }
+
+    indri::api::Parameters fields = (*self->parameters_)["field"];
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+        PyObject* const key = PyLong_FromSize_t(i + 1);
+        PyObject* const value = decode_string((std::string) fields[i]["name"]);
+
+        PyDict_SetItem(field_names, key, value);
+
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+
+    return field_names;
+}
+
+// Number of consecutive documents handed to a to_csr worker at a time.
+static const size_t CSR_CHUNK_SIZE = 1024;
+
+// A block of consecutive rows of a CSR matrix; row i spans
+// indices[indptr[i]:indptr[i + 1]], with indptr relative to the block.
+struct CSRChunk {
+    std::vector<int64_t> indptr;
+    std::vector<int32_t> indices;
+    std::vector<int32_t> data;
+};
+
+// State shared between the worker threads of a single to_csr call.
+struct CSRState {
+    lemur::api::DOCID_T start_document_id;
+    lemur::api::DOCID_T end_document_id;
+
+    // Terms with keep[term_id] == 0 are left out; empty to keep all terms.
+    const std::vector<char>* keep;
+
+    Instrumentation* instrumentation;
+    WorkQueue* work_queue;
+
+    std::vector<CSRChunk>* chunks;
+    std::vector<std::string>* errors;
+};
+
+struct CSRWorker {
+    CSRState* state;
+    indri::index::DiskIndex* index;
+};
+
+static void csr_worker(void* data) {
+    CSRWorker* const worker = static_cast<CSRWorker*>(data);
+    CSRState* const state = worker->state;
+
+    std::vector<lemur::api::TERMID_T> terms;
+
+    size_t idx;
+    while (state->work_queue->next(&idx)) {
+        const lemur::api::DOCID_T begin_document_id =
+            state->start_document_id + idx * CSR_CHUNK_SIZE;
+        const lemur::api::DOCID_T end_document_id = std::min(
+            state->end_document_id,
+            static_cast<lemur::api::DOCID_T>(begin_document_id + CSR_CHUNK_SIZE));
+
+        CSRChunk& chunk = (*state->chunks)[idx];
+        chunk.indptr.push_back(0);
+
+        try {
+            for (lemur::api::DOCID_T int_document_id = begin_document_id;
+                 int_document_id < end_document_id;
+                 ++int_document_id) {
+                const indri::index::TermList* const term_list =
+                    worker->index->termList(int_document_id);
+
+                if (term_list != NULL) {
+                    terms.assign(term_list->terms().begin(), term_list->terms().end());
+
+                    delete term_list;
+                } else {
+                    terms.clear();
+                }
+
+                std::sort(terms.begin(), terms.end());
+
+                for (size_t begin = 0, end = 0; begin < terms.size(); begin = end) {
+                    while (end < terms.size() && terms[end] == terms[begin]) {
+                        ++end;
+                    }
+
+                    const lemur::api::TERMID_T term_id = terms[begin];
+
+                    // Skip out-of-vocabulary terms and filtered terms.
+                    if (term_id <= 0 ||
+                        (!state->keep->empty() &&
+                         (static_cast<size_t>(term_id) >= state->keep->size() ||
+                          !(*state->keep)[term_id]))) {
+                        continue;
+                    }
+
+                    chunk.indices.push_back(term_id);
+                    chunk.data.push_back(end - begin);
+                }
+
+                chunk.indptr.push_back(chunk.indices.size());
+            }
+
+            state->instrumentation->increment(
+                DOCUMENTS_DECODED_COUNTER, end_document_id - begin_document_id);
+        } catch (const lemur::api::Exception& e) {
+            (*state->errors)[idx] = e.what();
+
+            if ((*state->errors)[idx].empty()) {
+                (*state->errors)[idx] = "Unable to read term lists.";
+            }
+        }
+    }
+}
+
+static PyObject* Index_to_csr(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    int start_document_id = self->index_->documentBase();
+    int end_document_id = self->index_->documentMaximum();
+    long num_threads = 0;
+    long min_df = 0;
+
+    static char* kwlist[] = {"start", "end", "num_threads", "min_df", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iill", kwlist,
+                                     &start_document_id,
+                                     &end_document_id,
+                                     &num_threads,
+                                     &min_df)) {
+        return NULL;
+    }
+
+    if (start_document_id < self->index_->documentBase() ||
+        end_document_id > self->index_->documentMaximum() ||
+        start_document_id > end_document_id) {
+        PyErr_SetString(
+            PyExc_IndexError,
+            "Specified internal document identifier range is out of bounds.");
+
+        return NULL;
+    }
+
+    const size_t num_chunks =
+        (end_document_id - start_document_id + CSR_CHUNK_SIZE - 1) / CSR_CHUNK_SIZE;
+
+    if (num_threads <= 0) {
+        num_threads = default_num_threads();
+    }
+
+    num_threads = std::max(
+        std::min(static_cast<size_t>(num_threads), num_chunks), static_cast<size_t>(1));
+
+    std::vector<char> keep;
+
+    std::vector<CSRChunk> chunks(num_chunks);
+    std::vector<std::string> errors(num_chunks);
+
+    WorkQueue work_queue(num_chunks);
+
+    CSRState state;
+    state.start_document_id = start_document_id;
+    state.end_document_id = end_document_id;
+    state.keep = &keep;
+    state.instrumentation = self->instrumentation_;
+    state.work_queue = &work_queue;
+    state.chunks = &chunks;
+    state.errors = &errors;
+
+    std::vector<CSRWorker> workers;
+    std::string open_error;
+
+    std::vector<int64_t> indptr(1, 0);
+    std::vector<int32_t> indices;
+    std::vector<int32_t> data;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    // Every worker reads its documents through its own DiskIndex.
+    try {
+        for (long i = 0; i < num_threads; ++i) {
+            CSRWorker worker;
+            worker.state = &state;
+            worker.index = self->index_pool_->acquire();
+
+            workers.push_back(worker);
+        }
+
+        if (min_df > 0) {
+            std::vector<VocabularyEntry> entries;
+            read_vocabulary(workers[0].index, &entries);
+
+            keep.assign(self->index_->uniqueTermCount() + 1, 0);
+
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (static_cast<size_t>(entries[i].term_id) >= keep.size()) {
+                    keep.resize(entries[i].term_id + 1, 0);
+                }
+
+                keep[entries[i].term_id] =
+                    entries[i].document_frequency >= static_cast<uint64_t>(min_df);
+            }
+        }
+    } catch (const lemur::api::Exception& e) {
+        open_error = e.what().empty() ? "Unable to open index." : e.what();
+    }
+
+    if (open_error.empty()) {
+        run_threads(csr_worker, &workers);
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        self->index_pool_->release(workers[i].index);
+    }
+
+    // Concatenate the chunks in document order.
+    if (open_error.empty()) {
+        size_t nnz = 0;
+
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            nnz += chunks[i].indices.size();
+        }
+
+        indptr.reserve(end_document_id - start_document_id + 1);
+        indices.reserve(nnz);
+        data.reserve(nnz);
+
+        for (size_t i = 0; i < chunks.size() && errors[i].empty(); ++i) {
+            const int64_t base = indices.size();
+
+            for (size_t j = 1; j < chunks[i].indptr.size(); ++j) {
+                indptr.push_back(base + chunks[i].indptr[j]);
+            }
+
+            indices.insert(indices.end(), chunks[i].indices.begin(), chunks[i].indices.end());
+            data.insert(data.end(), chunks[i].data.begin(), chunks[i].data.end());
+
+            std::vector<int32_t>().swap(chunks[i].indices);
+            std::vector<int32_t>().swap(chunks[i].data);
+        }
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!open_error.empty()) {
+        PyErr_SetString(PyExc_IOError, open_error.c_str());
+
+        return NULL;
+    }
+
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            PyErr_SetString(PyExc_IOError, errors[i].c_str());
+
+            return NULL;
+        }
+    }
+
+    PyObject* const data_array = Array_from_vector(&data);
+    PyObject* const indices_array = Array_from_vector(&indices);
+    PyObject* const indptr_array = Array_from_vector(&indptr);
+
+    if (data_array == NULL || indices_array == NULL || indptr_array == NULL) {
+        Py_XDECREF(data_array);
+        Py_XDECREF(indices_array);
+        Py_XDECREF(indptr_array);
+
+        return NULL;
+    }
+
+    return Py_BuildValue("(NNN)", data_array, indices_array, indptr_array);
+}
+
+static PyObject* Index_document_base(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    return PyLong_FromLong(self->index_->documentBase());
+}
+
+static PyObject* Index_maximum_document(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    return PyLong_FromLong(self->index_->documentMaximum());
+}
+
+static PyObject* Index_document_count(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    return PyLong_FromLong(self->index_->documentCount());
+}
+
+static PyObject* Index_total_terms(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    return PyLong_FromLong(self->index_->termCount());
+}
+
+static PyObject* Index_unique_terms(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    return PyLong_FromLong(self->index_->uniqueTermCount());
+}
+
+static PyObject* Index_term_count(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    char* term_object;
+
+    if (!PyArg_ParseTuple(args, "s", &term_object)) {
+        return NULL;
+    }
+
+    uint64_t term_count;
+
+    Py_BEGIN_ALLOW_THREADS
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    term_count = self->index_->termCount(term_object);
+
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    return PyLong_FromUnsignedLongLong(term_count);
+}
+
+static PyObject* Index_term_counts(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* terms_object;
+
+    if (!PyArg_ParseTuple(args, "O", &terms_object)) {
+        return NULL;
+    }
+
+    PyObject* const iterator = PyObject_GetIter(terms_object);
+
+    if (iterator == NULL) {
+        return NULL;
+    }
+
+    std::vector<std::string> terms;
+
+    PyObject* item;
+    while ((item = PyIter_Next(iterator))) {
+        if (!PyUnicode_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "Terms should be strings.");
+
+            Py_DECREF(item);
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+
+        PyObject* const item_bytes = PyUnicode_AsEncodedString(item, ENCODING, "strict");
+        Py_DECREF(item);
+
+        if (item_bytes == NULL) {
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+
+        terms.push_back(PyBytes_AsString(item_bytes));
+
+        Py_DECREF(item_bytes);
+    }
+
+    Py_DECREF(iterator);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    std::vector<uint64_t> term_counts(terms.size());
+
+    // With a statistics sidecar, only term identifiers are looked up.
+    const StatisticsHeader* const header = self->statistics_->header();
+
+    Py_BEGIN_ALLOW_THREADS
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    for (size_t i = 0; i < terms.size(); ++i) {
+        if (header == NULL) {
+            term_counts[i] = self->index_->termCount(terms[i]);
+
+            continue;
+        }
+
+        const lemur::api::TERMID_T term_id = self->index_->term(terms[i]);
+
+        term_counts[i] = term_id > 0 && static_cast<uint64_t>(term_id) <= header->max_term_id ?
+            StatisticsTable::cfs(header)[term_id] : 0;
+    }
+
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    return Array_from_vector(&term_counts);
+}
+
+// Returns the document lengths of the statistics sidecar, indexed from the
+// document base, or NULL if none is loaded.
+static const uint32_t* shared_document_lengths(Index* self) {
+    const StatisticsHeader* const header = self->statistics_->header();
+
+    return header != NULL ? StatisticsTable::lengths(header) : NULL;
+}
+
+// Returns the length of a document within bounds, from the statistics
+// sidecar if loaded. Callers must hold index_lock_ unless lengths is set.
+static int32_t document_length(Index* self,
+                               const uint32_t* const lengths,
+                               const lemur::api::DOCID_T int_document_id) {
+    if (lengths != NULL) {
+        return lengths[int_document_id - self->index_->documentBase()];
+    }
+
+    return self->index_->documentLength(int_document_id);
+}
+
+static PyObject* Index_document_length(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    int int_document_id;
+
+    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
+        return NULL;
+    }
+
+    const uint32_t* const lengths = shared_document_lengths(self);
+
+    if (lengths != NULL &&
+        int_document_id >= self->index_->documentBase() &&
+        int_document_id < self->index_->documentMaximum()) {
+        return PyLong_FromLong(document_length(self, lengths, int_document_id));
+    }
+
+    int document_length;
+
+    Py_BEGIN_ALLOW_THREADS
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    document_length = self->index_->documentLength(int_document_id);
+
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    return PyLong_FromLong(document_length);
+}
+
+static PyObject* Index_document_lengths(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* int_document_ids_object;
+
+    if (!PyArg_ParseTuple(args, "O", &int_document_ids_object)) {
+        return NULL;
+    }
+
+    std::vector<int64_t> int_document_ids;
+
+    if (!read_integers(int_document_ids_object, &int_document_ids)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < int_document_ids.size(); ++i) {
+        if (int_document_ids[i] < self->index_->documentBase() ||
+            int_document_ids[i] >= self->index_->documentMaximum()) {
+            PyErr_SetString(
+                PyExc_IndexError,
+                "Specified internal document identifier is out of bounds.");
+
+            return NULL;
+        }
+    }
+
+    std::vector<int32_t> lengths(int_document_ids.size());
+
+    const uint32_t* const shared_lengths = shared_document_lengths(self);
+
+    Py_BEGIN_ALLOW_THREADS
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    for (size_t i = 0; i < int_document_ids.size(); ++i) {
+        lengths[i] = document_length(self, shared_lengths, int_document_ids[i]);
+    }
+
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    return Array_from_vector(&lengths);
+}
+
+static PyObject* Index_document_length_statistics(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    long bin_width = 1;
+
+    static char* kwlist[] = {"bin_width", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|l", kwlist, &bin_width)) {
+        return NULL;
+    }
+
+    if (bin_width <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "bin_width should be strictly positive.");
+
+        return NULL;
+    }
+
+    const lemur::api::DOCID_T document_base = self->index_->documentBase();
+    const lemur::api::DOCID_T document_maximum = self->index_->documentMaximum();
+
+    uint64_t num_documents = 0;
+    uint64_t total_length = 0;
+    int32_t min_length = 0;
+    int32_t max_length = 0;
+
+    // Welford's algorithm, in line with examples/statistics.py.
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    std::vector<uint64_t> histogram;
+
+    const uint32_t* const lengths = shared_document_lengths(self);
+
+    Py_BEGIN_ALLOW_THREADS
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    for (lemur::api::DOCID_T int_document_id = document_base;
+         int_document_id < document_maximum;
+         ++int_document_id) {
+        const int32_t length = document_length(self, lengths, int_document_id);
+
+        if (num_documents == 0) {
+            min_length = max_length = length;
+        } else {
+            min_length = std::min(min_length, length);
+            max_length = std::max(max_length, length);
+        }
+
+        ++num_documents;
+        total_length += length;
+
+        const double delta = length - mean;
+        mean += delta / num_documents;
+        m2 += delta * (length - mean);
+
+        const size_t bin = length / bin_width;
+
+        if (bin >= histogram.size()) {
+            histogram.resize(bin + 1, 0);
+        }
+
+        ++histogram[bin];
+    }
+
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    const double variance = num_documents > 1 ? m2 / (num_documents - 1) : 0.0;
+
+    PyObject* const histogram_array = Array_from_vector(&histogram);
+
+    if (histogram_array == NULL) {
+        return NULL;
+    }
+
+    return Py_BuildValue(
+        "{s:K,s:K,s:i,s:i,s:d,s:d,s:d,s:l,s:N}",
+        "num_documents", static_cast<unsigned long long>(num_documents),
+        "total_length", static_cast<unsigned long long>(total_length),
+        "min", min_length,
+        "max", max_length,
+        "mean", mean,
+        "variance", variance,
+        "std", sqrt(variance),
+        "bin_width", bin_width,
+        "histogram", histogram_array);
+}
+
+// Evaluates the query on a pooled QueryEnvironment, such that threads can
+// query the same Index concurrently, and builds the snippets of its results
+// if requested; snippets are skipped once *cancelled is set. Results are
+// looked up in and added to the result cache. Does not require the GIL;
+// returns false and sets *error on failure.
+static bool evaluate_query(Index* self,
+                           const std::string& query,
+                           const std::vector<lemur::api::DOCID_T>& document_ids,
+                           const long results_requested,
+                           const bool annotate,
+                           const bool include_snippets,
+                           const AtomicFlag* const cancelled,
+                           std::vector<indri::api::ScoredExtentResult>* const query_results,
+                           std::vector<std::string>* const snippets,
+                           std::string* const error) {
+    std::string cache_key;
+
+    if (self->result_cache_->enabled()) {
+        cache_key = ResultCache::key(
+            query, results_requested, document_ids, include_snippets);
+
+        if (self->result_cache_->find(cache_key, query_results, snippets)) {
+            self->instrumentation_->increment(RESULT_CACHE_HITS_COUNTER);
+
+            return true;
+        }
+    }
+
+    indri::api::QueryAnnotation* query_annotation = NULL;
+    indri::api::QueryEnvironment* query_env = NULL;
+
+    bool snippets_built = true;
+
+    // Building the annotation tree and its match extents is only worth it
+    // when they are used.
+    try {
+        ScopedTimer timer(self->instrumentation_, QUERY_PHASE);
+
+        query_env = self->query_env_pool_->acquire();
+
+        if (annotate) {
+            if (document_ids.empty()) {
+                query_annotation = query_env->runAnnotatedQuery(
+                    query, results_requested);
+            } else{
+                query_annotation = query_env->runAnnotatedQuery(
+                    query, document_ids, results_requested);
+            }
+
+            *query_results = query_annotation->getResults();
+        } else {
+            if (document_ids.empty()) {
+                *query_results = query_env->runQuery(
+                    query, results_requested);
+            } else {
+                *query_results = query_env->runQuery(
+                    query, document_ids, results_requested);
+            }
+        }
+    } catch (const lemur::api::Exception& e) {
+        *error = e.what().empty() ? "Unable to evaluate query." : e.what();
+    }
+
+    if (error->empty() && include_snippets && (cancelled == NULL || !cancelled->get())) {
+        ScopedTimer timer(self->instrumentation_, SNIPPETS_PHASE);
+
+        std::vector<lemur::api::DOCID_T> result_document_ids(query_results->size(), 0);
+
+        for (size_t i = 0; i < query_results->size(); ++i) {
+            result_document_ids[i] = (*query_results)[i].document;
+        }
+
+        snippets_built = build_snippets(self->collection_,
+                                        self->document_cache_,
+                                        query_annotation,
+                                        result_document_ids,
+                                        snippets);
+    }
+
+    delete query_annotation;
+
+    if (query_env != NULL) {
+        self->query_env_pool_->release(query_env);
+    }
+
+    if (!error->empty()) {
+        return false;
+    }
+
+    if (include_snippets && !snippets_built) {
+        *error = "Unable to retrieve snippets. "
+                 "Make sure storeDocs is enabled "
+                 "in your Indri configuration.";
+
+        return false;
+    }
+
+    if (!cache_key.empty() && (cancelled == NULL || !cancelled->get())) {
+        self->result_cache_->insert(cache_key, *query_results, *snippets);
+    }
+
+    return true;
+}
+
+static PyObject* Index_run_query(Index* self, PyObject* args, PyObject* kwds) {
+    PyObject* query = NULL;
+    PyObject* document_set = NULL;
+    long results_requested = 0;
+    bool include_snippets = false;
+    bool annotate = false;
+
+    static char* kwlist[] = {"query_str",
+                             "document_set",
+                             "results_requested",
+                             "include_snippets",
+                             "annotate",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "U|Olbb", kwlist,
+                                     &query,
+                                     &document_set,
+                                     &results_requested,
+                                     &include_snippets,
+                                     &annotate)) {
+        return NULL;
+    }
+
+    if (!require_components(
+            self,
+            QUERY_COMPONENT | (include_snippets ? COLLECTION_COMPONENT : 0))) {
+        return NULL;
+    }
+
+    // Snippets are built from the annotation of the query.
+    annotate = annotate || include_snippets;
+
+    CHECK(PyUnicode_Check(query));
+
+    PyObject* query_bytes = PyUnicode_AsEncodedString(query, ENCODING, "strict");
+    char* query_str = PyBytes_AsString(query_bytes);
+
+    std::vector<lemur::api::DOCID_T> document_ids;
+
+    if (document_set != NULL) {
+        CHECK(PyIter_Check(document_set));
+
+        PyObject* const iterator = PyObject_GetIter(document_set);
+        PyObject *item;
+
+        if (iterator == NULL) {
+            PyErr_SetString(
+                PyExc_TypeError,
+                "Passed object for document_set not iterable.");
+
+            Py_DECREF(iterator);
+            Py_DECREF(query_bytes);
+
+            return NULL;
+        }
+
+        while (item = PyIter_Next(iterator)) {
+            CHECK(PyLong_CheckExact(item));
+
+            const lemur::api::DOCID_T int_doc_id = PyLong_AsLong(item);
+            if (int_doc_id < 0) {
+                continue;
+            }
+
+            document_ids.push_back(int_doc_id);
+
+            Py_DECREF(item);
+        }
+
+        Py_DECREF(iterator);
+    }
+
+    if (results_requested <= 0) {
+        if (document_set != NULL) {
+            results_requested = document_ids.size();
+        } else {
+            results_requested = 100;
+        }
+    }
+
+    CHECK_GE(results_requested, 0);
+
+    std::vector<indri::api::ScoredExtentResult> query_results;
+    std::vector<std::string> snippets;
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    evaluate_query(self, query_str, document_ids, results_requested,
+                   annotate, include_snippets, NULL /* cancelled */,
+                   &query_results, &snippets, &error);
+
+    Py_END_ALLOW_THREADS
+
+    Py_DECREF(query_bytes);
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    ScopedTimer timer(self->instrumentation_, RESULTS_PHASE);
+
+    return results_to_tuple(query_results, include_snippets ? &snippets : NULL);
+}
+
+// State shared between the worker threads of a single batch_query call.
+struct BatchQueryState {
+    const std::vector<std::string>* queries;
+    long results_requested;
+
+    ResultCache* result_cache;
+    Instrumentation* instrumentation;
+
+    WorkQueue* work_queue;
+
+    std::vector<std::vector<indri::api::ScoredExtentResult> >* results;
+    std::vector<std::string>* errors;
+};
+
+struct BatchQueryWorker {
+    BatchQueryState* state;
+    indri::api::QueryEnvironment* query_env;
+};
+
+static void batch_query_worker(void* data) {
+    BatchQueryWorker* const worker = static_cast<BatchQueryWorker*>(data);
+    BatchQueryState* const state = worker->state;
+
+    const bool use_cache = state->result_cache->enabled();
+
+    std::vector<std::string> no_snippets;
+
+    size_t idx;
+    while (state->work_queue->next(&idx)) {
+        std::string cache_key;
+
+        if (use_cache) {
+            cache_key = ResultCache::key(
+                (*state->queries)[idx], state->results_requested,
+                std::vector<lemur::api::DOCID_T>(), false /* include_snippets */);
+
+            if (state->result_cache->find(
+                    cache_key, &(*state->results)[idx], &no_snippets)) {
+                state->instrumentation->increment(RESULT_CACHE_HITS_COUNTER);
+
+                continue;
+            }
+        }
+
+        try {
+            ScopedTimer timer(state->instrumentation, QUERY_PHASE);
+
+            (*state->results)[idx] = worker->query_env->runQuery(
+                (*state->queries)[idx], state->results_requested);
+
+            if (use_cache) {
+                state->result_cache->insert(
+                    cache_key, (*state->results)[idx], no_snippets);
+            }
+        } catch (const lemur::api::Exception& e) {
+            (*state->errors)[idx] = e.what();
+
+            // Guarantee that an empty message still flags the failure.
+            if ((*state->errors)[idx].empty()) {
+                (*state->errors)[idx] = "Unable to evaluate query.";
+            }
+        }
+    }
+}
+
+static PyObject* Index_batch_query(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, QUERY_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* queries = NULL;
+    long results_requested = 100;
+    long num_threads = 0;
+
+    static char* kwlist[] = {"queries",
+                             "results_requested",
+                             "num_threads",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|ll", kwlist,
+                                     &queries,
+                                     &results_requested,
+                                     &num_threads)) {
+        return NULL;
+    }
+
+    if (results_requested <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "results_requested should be strictly positive.");
+
+        return NULL;
+    }
+
+    PyObject* const iterator = PyObject_GetIter(queries);
+
+    if (iterator == NULL) {
+        return NULL;
+    }
+
+    // Encode every query up front, as the GIL is released during evaluation.
+    std::vector<std::string> query_strs;
+
+    PyObject* item;
+    while ((item = PyIter_Next(iterator))) {
+        if (!PyUnicode_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "Queries should be strings.");
+
+            Py_DECREF(item);
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+
+        PyObject* const item_bytes = PyUnicode_AsEncodedString(item, ENCODING, "strict");
+        Py_DECREF(item);
+
+        if (item_bytes == NULL) {
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+
+        query_strs.push_back(PyBytes_AsString(item_bytes));
+
+        Py_DECREF(item_bytes);
+    }
+
+    Py_DECREF(iterator);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    if (query_strs.empty()) {
+        return PyTuple_New(0);
+    }
+
+    if (num_threads <= 0) {
+        num_threads = default_num_threads();
+    }
+
+    num_threads = std::min(static_cast<size_t>(num_threads), query_strs.size());
+
+    std::vector<std::vector<indri::api::ScoredExtentResult> > results(query_strs.size());
+    std::vector<std::string> errors(query_strs.size());
+
+    WorkQueue work_queue(query_strs.size());
+
+    BatchQueryState state;
+    state.queries = &query_strs;
+    state.results_requested = results_requested;
+    state.result_cache = self->result_cache_;
+    state.instrumentation = self->instrumentation_;
+    state.work_queue = &work_queue;
+    state.results = &results;
+    state.errors = &errors;
+
+    std::vector<BatchQueryWorker> workers;
+    std::string open_error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    // Every worker evaluates its queries on its own QueryEnvironment.
+    try {
+        for (long i = 0; i < num_threads; ++i) {
+            BatchQueryWorker worker;
+            worker.state = &state;
+            worker.query_env = self->query_env_pool_->acquire();
+
+            workers.push_back(worker);
+        }
+    } catch (const lemur::api::Exception& e) {
+        open_error = e.what();
+    }
+
+    if (open_error.empty()) {
+        run_threads(batch_query_worker, &workers);
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        self->query_env_pool_->release(workers[i].query_env);
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!open_error.empty()) {
+        PyErr_SetString(PyExc_IOError, open_error.c_str());
+
+        return NULL;
+    }
+
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            PyErr_Format(PyExc_IOError, "Query %zu failed: %s", i, errors[i].c_str());
+
+            return NULL;
+        }
+    }
+
+    ScopedTimer timer(self->instrumentation_, RESULTS_PHASE);
+
+    PyObject* const batch_results = PyTuple_New(results.size());
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        PyTuple_SetItem(batch_results, i, results_to_tuple(results[i]));
+    }
+
+    return batch_results;
+}
+
+// Asynchronous queries.
+
+enum AsyncTaskKind {
+    QUERY_TASK,
+    DOCUMENTS_TASK
+};
+
+// A query or document lookup evaluated on the executor on behalf of an
+// asyncio future, which is resolved on its event loop. Owned by a capsule,
+// which the executor references until completion and the done callback of
+// the future for as long as the future references it.
+struct AsyncTask {
+    AsyncTaskKind kind;
+
+    Index* index;
+    PyObject* loop;
+    PyObject* future;  // Released on completion.
+    PyObject* capsule;
+
+    // Set on the event loop once the future is cancelled.
+    AtomicFlag cancelled;
+
+    std::string query;
+    long results_requested;
+    bool include_snippets;
+
+    std::vector<lemur::api::DOCID_T> document_ids;
+
+    std::vector<indri::api::ScoredExtentResult> query_results;
+    std::vector<std::string> snippets;
+
+    std::vector<std::string> ext_document_ids;
+    std::vector<std::vector<int32_t> > terms;
+
+    std::string error;
+};
+
+static void AsyncTask_destroy(PyObject* capsule) {
+    AsyncTask* const task = static_cast<AsyncTask*>(PyCapsule_GetPointer(capsule, NULL));
+
+    Py_XDECREF(task->future);
+    Py_DECREF(task->loop);
+    Py_DECREF((PyObject*) task->index);
+
+    delete task;
+}
+
+// Resolves the future, unless it was cancelled meanwhile. Scheduled on the
+// event loop of the future.
+static PyObject* resolve_future(PyObject* self, PyObject* args) {
+    PyObject* future;
+    PyObject* result;
+    PyObject* exception;
+
+    if (!PyArg_ParseTuple(args, "OOO", &future, &result, &exception)) {
+        return NULL;
+    }
+
+    PyObject* const done = PyObject_CallMethod(future, "done", NULL);
+
+    if (done == NULL) {
+        return NULL;
+    }
+
+    const int is_done = PyObject_IsTrue(done);
+    Py_DECREF(done);
+
+    if (is_done) {
+        Py_RETURN_NONE;
+    }
+
+    PyObject* const ret = exception != Py_None ?
+        PyObject_CallMethod(future, "set_exception", "(O)", exception) :
+        PyObject_CallMethod(future, "set_result", "(O)", result);
+
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    Py_DECREF(ret);
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef resolve_future_def = {
+    "resolve_future", (PyCFunction) resolve_future, METH_VARARGS, NULL
+};
+
+// Done callback of the future of a task: flags the task once the future is
+// cancelled, such that the executor skips the work that remains.
+static PyObject* cancel_async_task(PyObject* capsule, PyObject* future) {
+    PyObject* const cancelled = PyObject_CallMethod(future, "cancelled", NULL);
+
+    if (cancelled == NULL) {
+        return NULL;
+    }
+
+    if (PyObject_IsTrue(cancelled)) {
+        static_cast<AsyncTask*>(PyCapsule_GetPointer(capsule, NULL))->cancelled.set(true);
+    }
+
+    Py_DECREF(cancelled);
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef cancel_async_task_def = {
+    "cancel_async_task", (PyCFunction) cancel_async_task, METH_O, NULL
+};
+
+// Converts the outcome of the task and schedules the resolution of its
+// future on its event loop. Requires the GIL; releases the reference of the
+// executor to the task.
+static void complete_async_task(AsyncTask* const task) {
+    if (!task->cancelled.get()) {
+        PyObject* result = NULL;
+        PyObject* exception = NULL;
+
+        if (!task->error.empty()) {
+            exception = PyObject_CallFunction(PyExc_IOError, "s", task->error.c_str());
+        } else if (task->kind == QUERY_TASK) {
+            ScopedTimer timer(task->index->instrumentation_, RESULTS_PHASE);
+
+            result = results_to_tuple(task->query_results,
+                                      task->include_snippets ? &task->snippets : NULL);
+        } else {
+            result = PyTuple_New(task->document_ids.size());
+
+            for (size_t i = 0; i < task->document_ids.size(); ++i) {
+                PyTuple_SetItem(result, i, document_to_tuple(task->ext_document_ids[i],
+                                                             task->terms[i]));
+            }
+        }
+
+        if (PyErr_Occurred()) {
+            Py_CLEAR(result);
+            Py_CLEAR(exception);
+
+            PyObject* type;
+            PyObject* traceback;
+
+            PyErr_Fetch(&type, &exception, &traceback);
+            PyErr_NormalizeException(&type, &exception, &traceback);
+
+            Py_XDECREF(type);
+            Py_XDECREF(traceback);
+        }
+
+        PyObject* const resolve = PyCFunction_New(&resolve_future_def, NULL);
+        PyObject* const ret = resolve == NULL ? NULL : PyObject_CallMethod(
+            task->loop, "call_soon_threadsafe", "OOOO",
+            resolve,
+            task->future,
+            result != NULL ? result : Py_None,
+            exception != NULL ? exception : Py_None);
+
+        // Fails once the event loop has been closed, in which case nobody
+        // awaits the future anymore.
+        if (ret == NULL) {
+            PyErr_Clear();
+        }
+
+        Py_XDECREF(ret);
+        Py_XDECREF(resolve);
+        Py_XDECREF(result);
+        Py_XDECREF(exception);
+    }
+
+    Py_CLEAR(task->future);
+    Py_DECREF(task->capsule);
+}
+
+// Evaluates the task without the GIL, checking for cancellation between
+// steps, as a running Indri evaluation cannot be interrupted.
+static void process_async_task(void* data) {
+    AsyncTask* const task = static_cast<AsyncTask*>(data);
+    Index* const self = task->index;
+
+    if (task->cancelled.get()) {
+        // Skipped.
+    } else if (task->kind == QUERY_TASK) {
+        evaluate_query(self, task->query, std::vector<lemur::api::DOCID_T>(),
+                       task->results_requested,
+                       task->include_snippets /* annotate */,
+                       task->include_snippets,
+                       &task->cancelled,
+                       &task->query_results, &task->snippets, &task->error);
+    } else {
+        task->ext_document_ids.resize(task->document_ids.size());
+        task->terms.resize(task->document_ids.size());
+
+        try {
+            for (size_t i = 0; i < task->document_ids.size() && !task->cancelled.get(); ++i) {
+                read_document(self, task->document_ids[i],
+                              &task->ext_document_ids[i], &task->terms[i]);
+            }
+        } catch (const lemur::api::Exception& e) {
+            task->error = e.what().empty() ? "Unable to read document." : e.what();
+        }
+    }
+
+    PyGILState_STATE state = PyGILState_Ensure();
+    complete_async_task(task);
+    PyGILState_Release(state);
+}
+
+static TaskExecutor* get_async_executor() {
+    indri::thread::ScopedLock lock(async_executor_lock);
+
+    if (async_executor == NULL) {
+#if PY_VERSION_HEX < 0x03070000
+        // Worker threads acquire the GIL to resolve futures.
+        PyEval_InitThreads();
+#endif
+
+        async_executor = new TaskExecutor(process_async_task, default_num_threads());
+    }
+
+    return async_executor;
+}
+
+// Returns the event loop of the calling thread, or sets an exception.
+static PyObject* get_running_loop() {
+    PyObject* const asyncio = PyImport_ImportModule("asyncio");
+
+    if (asyncio == NULL) {
+        return NULL;
+    }
+
+    // asyncio.get_running_loop was only added in Python 3.7.
+    PyObject* const loop = PyObject_CallMethod(
+        asyncio,
+        PyObject_HasAttrString(asyncio, "get_running_loop") ?
+            "get_running_loop" : "get_event_loop",
+        NULL);
+
+    Py_DECREF(asyncio);
+
+    return loop;
+}
+
+// Submits the task to the executor, taking ownership of it, and returns the
+// future it resolves on the event loop of the calling thread. Sets an
+// exception and returns NULL on failure.
+static PyObject* submit_async_task(Index* self, AsyncTask* const task) {
+    PyObject* const loop = get_running_loop();
+    PyObject* const future =
+        loop == NULL ? NULL : PyObject_CallMethod(loop, "create_future", NULL);
+
+    if (future == NULL) {
+        Py_XDECREF(loop);
+        delete task;
+
+        return NULL;
+    }
+
+    Py_INCREF(self);
+
+    task->index = self;
+    task->loop = loop;
+    task->future = future;
+    task->cancelled.set(false);
+    task->capsule = PyCapsule_New(task, NULL, AsyncTask_destroy);
+
+    if (task->capsule == NULL) {
+        Py_DECREF(future);
+        Py_DECREF(loop);
+        Py_DECREF(self);
+        delete task;
+
+        return NULL;
+    }
+
+    PyObject* const callback = PyCFunction_New(&cancel_async_task_def, task->capsule);
+    PyObject* const ret = callback == NULL ? NULL :
+        PyObject_CallMethod(future, "add_done_callback", "(O)", callback);
+
+    Py_XDECREF(callback);
+
+    if (ret == NULL) {
+        Py_DECREF(task->capsule);
+
+        return NULL;
+    }
+
+    Py_DECREF(ret);
+
+    TaskExecutor* const executor = get_async_executor();
+
+    // The reference to the capsule passes to the executor.
+    Py_INCREF(future);
+    executor->submit(task);
+
+    return future;
+}
+
+static PyObject* Index_aquery(Index* self, PyObject* args, PyObject* kwds) {
+    char* query_str;
+    long results_requested = 100;
+    int include_snippets = false;
+
+    static char* kwlist[] = {"query_str",
+                             "results_requested",
+                             "include_snippets",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "es|lp", kwlist,
+                                     ENCODING, &query_str,
+                                     &results_requested,
+                                     &include_snippets)) {
+        return NULL;
+    }
+
+    const std::string query(query_str);
+    PyMem_Free(query_str);
+
+    if (!require_components(
+            self,
+            QUERY_COMPONENT | (include_snippets ? COLLECTION_COMPONENT : 0))) {
+        return NULL;
+    }
+
+    if (results_requested <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "results_requested should be strictly positive.");
+
+        return NULL;
+    }
+
+    AsyncTask* const task = new AsyncTask;
+    task->kind = QUERY_TASK;
+    task->query = query;
+    task->results_requested = results_requested;
+    task->include_snippets = include_snippets;
+
+    return submit_async_task(self, task);
+}
+
+static PyObject* Index_adocuments(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT | COLLECTION_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* int_document_ids_object;
+
+    if (!PyArg_ParseTuple(args, "O", &int_document_ids_object)) {
+        return NULL;
+    }
+
+    std::vector<int64_t> int_document_ids;
+
+    if (!read_integers(int_document_ids_object, &int_document_ids)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < int_document_ids.size(); ++i) {
+        if (int_document_ids[i] < self->index_->documentBase() ||
+            int_document_ids[i] >= self->index_->documentMaximum()) {
+            PyErr_SetString(
+                PyExc_IndexError,
+                "Specified internal document identifier is out of bounds.");
+
+            return NULL;
+        }
+    }
+
+    AsyncTask* const task = new AsyncTask;
+    task->kind = DOCUMENTS_TASK;
+    task->document_ids.assign(int_document_ids.begin(), int_document_ids.end());
+
+    return submit_async_task(self, task);
+}
+
+// Reads the vocabulary through a pooled DiskIndex with the GIL released.
+// Sets an exception and returns false on failure.
+static bool read_vocabulary_without_gil(Index* self,
+                                        std::vector<VocabularyEntry>* const entries) {
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        ScopedTimer timer(self->instrumentation_, VOCABULARY_PHASE);
+        ScopedDiskIndex index(self->index_pool_);
+
+        read_vocabulary(index.get(), entries);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read vocabulary." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return false;
+    }
+
+    return true;
+}
+
+static PyObject* Index_vocabulary(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    VocabularyArrays vocabulary;
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        ScopedTimer timer(self->instrumentation_, VOCABULARY_PHASE);
+        ScopedDiskIndex index(self->index_pool_);
+
+        read_vocabulary_arrays(index.get(), &vocabulary);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read vocabulary." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const blob = PyBytes_FromStringAndSize(vocabulary.blob.data(),
+                                                     vocabulary.blob.size());
+
+    if (blob == NULL) {
+        return NULL;
+    }
+
+    return Py_BuildValue("(NNNN)",
+                         blob,
+                         Array_from_vector(&vocabulary.offsets),
+                         Array_from_vector(&vocabulary.dfs),
+                         Array_from_vector(&vocabulary.cfs));
+}
+
+static PyObject* Index_get_dictionary(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    std::vector<VocabularyEntry> entries;
+
+    if (!read_vocabulary_without_gil(self, &entries)) {
+        return NULL;
+    }
+
+    PyObject* const token2id = PyDict_New();
+    PyObject* const id2token = PyDict_New();
+    PyObject* const id2df = PyDict_New();
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const lemur::api::TERMID_T term_id = entries[i].term_id;
+        const string& term = entries[i].term;
+
+        const unsigned int document_frequency = entries[i].document_frequency;
+        CHECK_GT(document_frequency, 0);
+
+        PyDict_SetItem(token2id,
+                       PyUnicode_Decode(term.c_str(),
+                                        term.size(),
+                                        ENCODING,
+                                        "strict"),
+                       PyLong_FromLong(term_id));
+
+        PyDict_SetItem(id2token,
+                       PyLong_FromLong(term_id),
+                       PyUnicode_Decode(term.c_str(),
+                                        term.size(),
+                                        ENCODING,
+                                        "strict"));
+
+        PyDict_SetItem(id2df,
+                       PyLong_FromLong(term_id),
+                       PyLong_FromLong(document_frequency));
+    }
+
+    CHECK_EQ(PyDict_Size(token2id), self->index_->uniqueTermCount());
+    CHECK_EQ(PyDict_Size(id2token), self->index_->uniqueTermCount());
+    CHECK_EQ(PyDict_Size(id2df), self->index_->uniqueTermCount());
+
+    return PyTuple_Pack(3, token2id, id2token, id2df);
+}
+
+static PyObject* Index_get_term_frequencies(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    std::vector<VocabularyEntry> entries;
+
+    if (!read_vocabulary_without_gil(self, &entries)) {
+        return NULL;
+    }
+
+    PyObject* const id2tf = PyDict_New();
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const uint64_t term_frequency = entries[i].term_frequency;
+        CHECK_GT(term_frequency, 0);
+
+        PyDict_SetItem(id2tf,
+                       PyLong_FromLong(entries[i].term_id),
+                       PyLong_FromLong(term_frequency));
+    }
+
+    CHECK_EQ(PyDict_Size(id2tf), self->index_->uniqueTermCount());
+
+    return id2tf;
+}
+
+// DocumentIterator
+
+// A batch of consecutive documents decoded from the direct file; document i
+// spans terms[offsets[i]:offsets[i + 1]].
+struct DocumentBatch {
+    std::vector<lemur::api::DOCID_T> document_ids;
+
+    std::vector<int32_t> terms;
+    std::vector<int64_t> offsets;
+};
+
+// Sequentially decodes the term lists within [start, end) on a background
+// thread, keeping at most one decoded batch ahead of the consumer.
+class DocumentPrefetcher {
+ public:
+    DocumentPrefetcher(indri::index::TermListFileIterator* const term_list_it,
+                       const lemur::api::DOCID_T document_base,
+                       const lemur::api::DOCID_T start,
+                       const lemur::api::DOCID_T end,
+                       const size_t batch_size)
+            : term_list_it_(term_list_it),
+              next_document_id_(document_base),
+              start_(start), end_(end),
+              batch_size_(batch_size),
+              ready_(NULL), done_(false), stop_(false) {
+        thread_ = new indri::thread::Thread(DocumentPrefetcher::run, this);
+    }
+
+    ~DocumentPrefetcher() {
+        {
+            indri::thread::ScopedLock lock(mutex_);
+
+            stop_ = true;
+            condition_.notifyAll();
+        }
+
+        thread_->join();
+        delete thread_;
+
+        delete ready_;
+        delete term_list_it_;
+    }
+
+    // Blocks until the next batch is available; returns NULL once the range
+    // has been exhausted or decoding failed (see error()).
+    DocumentBatch* next_batch() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        while (ready_ == NULL && !done_) {
+            condition_.wait(mutex_);
+        }
+
+        DocumentBatch* const batch = ready_;
+        ready_ = NULL;
+
+        condition_.notifyAll();
+
+        return batch;
+    }
+
+    std::string error() {
+        indri::thread::ScopedLock lock(mutex_);
+
+        return error_;
+    }
+
+ private:
+    static void run(void* data) {
+        static_cast<DocumentPrefetcher*>(data)->prefetch();
+    }
+
+    void prefetch() {
+        std::string error;
+
+        try {
+            term_list_it_->startIteration();
+
+            // The direct file can only be read front to back.
+            while (next_document_id_ < start_ && !term_list_it_->finished()) {
+                term_list_it_->nextEntry();
+                ++next_document_id_;
+            }
+        } catch (const lemur::api::Exception& e) {
+            error = e.what().empty() ? "Unable to read term lists." : e.what();
+        }
+
+        while (error.empty()) {
+            DocumentBatch* const batch = new DocumentBatch;
+            batch->offsets.push_back(0);
+
+            try {
+                while (batch->document_ids.size() < batch_size_ &&
+                       next_document_id_ < end_ &&
+                       !term_list_it_->finished()) {
+                    const indri::index::TermList* const term_list =
+                        term_list_it_->currentEntry();
+
+                    batch->document_ids.push_back(next_document_id_);
+                    batch->terms.insert(batch->terms.end(),
+                                        term_list->terms().begin(),
+                                        term_list->terms().end());
+                    batch->offsets.push_back(batch->terms.size());
+
+                    term_list_it_->nextEntry();
+                    ++next_document_id_;
+                }
+            } catch (const lemur::api::Exception& e) {
+                error = e.what().empty() ? "Unable to read term lists." : e.what();
+            }
+
+            indri::thread::ScopedLock lock(mutex_);
+
+            while (ready_ != NULL && !stop_) {
+                condition_.wait(mutex_);
+            }
+
+            if (stop_ || !error.empty() || batch->document_ids.empty()) {
+                delete batch;
+
+                break;
+            }
+
+            ready_ = batch;
+            condition_.notifyAll();
+        }
+
+        indri::thread::ScopedLock lock(mutex_);
+
+        error_ = error;
+        done_ = true;
+
+        condition_.notifyAll();
+    }
+
+    indri::index::TermListFileIterator* const term_list_it_;
+    lemur::api::DOCID_T next_document_id_;
+
+    const lemur::api::DOCID_T start_;
+    const lemur::api::DOCID_T end_;
+    const size_t batch_size_;
+
+    indri::thread::Thread* thread_;
+
+    indri::thread::Mutex mutex_;
+    indri::thread::ConditionVariable condition_;
+
+    // Guarded by mutex_.
+    DocumentBatch* ready_;
+    bool done_;
+    bool stop_;
+    std::string error_;
+};
+
+typedef struct {
+    PyObject_HEAD
+
+    // Keeps the underlying index open while iterating.
+    PyObject* index_;
+
+    DocumentPrefetcher* prefetcher_;
+
+    DocumentBatch* batch_;
+    size_t position_;
+} DocumentIterator;
+
+static void DocumentIterator_dealloc(DocumentIterator* self) {
+    Py_BEGIN_ALLOW_THREADS
+    delete self->prefetcher_;
+    Py_END_ALLOW_THREADS
+
+    delete self->batch_;
+
+    Py_XDECREF(self->index_);
+
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static PyObject* DocumentIterator_iter(DocumentIterator* self) {
+    Py_INCREF(self);
+
+    return (PyObject*) self;
+}
+
+static PyObject* DocumentIterator_iternext_unlocked(DocumentIterator* self) {
+    if (self->prefetcher_ == NULL) {
+        return NULL;
+    }
+
+    if (self->batch_ == NULL ||
+        self->position_ >= self->batch_->document_ids.size()) {
+        delete self->batch_;
+
+        DocumentBatch* batch;
+
+        Py_BEGIN_ALLOW_THREADS
+        batch = self->prefetcher_->next_batch();
+        Py_END_ALLOW_THREADS
+
+        self->batch_ = batch;
+        self->position_ = 0;
+
+        if (self->batch_ == NULL) {
+            const std::string error = self->prefetcher_->error();
+
+            Py_BEGIN_ALLOW_THREADS
+            delete self->prefetcher_;
+            Py_END_ALLOW_THREADS
+
+            self->prefetcher_ = NULL;
+
+            if (!error.empty()) {
+                PyErr_SetString(PyExc_IOError, error.c_str());
+            }
+
+            // Signals the end of iteration, unless an exception was set.
+            return NULL;
+        }
+
+        ((Index*) self->index_)->instrumentation_->increment(
+            DOCUMENTS_DECODED_COUNTER, self->batch_->document_ids.size());
+    }
+
+    const DocumentBatch& batch = *self->batch_;
+    const size_t pos = self->position_++;
+
+    std::vector<int32_t> terms(batch.terms.begin() + batch.offsets[pos],
+                               batch.terms.begin() + batch.offsets[pos + 1]);
+
+    PyObject* const terms_array = Array_from_vector(&terms);
+
+    if (terms_array == NULL) {
+        return NULL;
+    }
+
+    PyObject* const document_id = PyLong_FromLong(batch.document_ids[pos]);
+    PyObject* const result = PyTuple_Pack(2, document_id, terms_array);
+
+    Py_DECREF(document_id);
+    Py_DECREF(terms_array);
+
+    return result;
+}
+
+static PyObject* DocumentIterator_iternext(DocumentIterator* self) {
+    PyObject* result;
+
+    BEGIN_CRITICAL_SECTION(self);
+    result = DocumentIterator_iternext_unlocked(self);
+    END_CRITICAL_SECTION();
+
+    return result;
+}
+
+static PyTypeObject DocumentIteratorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyndri.DocumentIterator",  /* tp_name */
+    sizeof(DocumentIterator),  /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) DocumentIterator_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "Iterator over (int_document_id, terms) pairs", /* tp_doc */
+    0,                   /* tp_traverse */
+    0,                   /* tp_clear */
+    0,                   /* tp_richcompare */
+    0,                   /* tp_weaklistoffset */
+    (getiterfunc) DocumentIterator_iter,         /* tp_iter */
+    (iternextfunc) DocumentIterator_iternext,    /* tp_iternext */
+};
+
+static PyObject* Index_iter_documents(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    int start_document_id = self->index_->documentBase();
+    int end_document_id = self->index_->documentMaximum();
+    long batch_size = 1024;
+
+    static char* kwlist[] = {"start", "end", "batch_size", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iil", kwlist,
+                                     &start_document_id,
+                                     &end_document_id,
+                                     &batch_size)) {
+        return NULL;
+    }
+
+    if (start_document_id < self->index_->documentBase() ||
+        end_document_id > self->index_->documentMaximum() ||
+        start_document_id > end_document_id) {
+        PyErr_SetString(
+            PyExc_IndexError,
+            "Specified internal document identifier range is out of bounds.");
+
+        return NULL;
+    }
+
+    if (batch_size <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "batch_size should be strictly positive.");
+
+        return NULL;
+    }
+
+    indri::index::TermListFileIterator* term_list_it = 0;
+
+    try {
+        term_list_it = self->index_->termListFileIterator();
+    } catch (const lemur::api::Exception& e) {
+        PyErr_SetString(PyExc_IOError, e.what().c_str());
+
+        return NULL;
+    }
+
+    DocumentIterator* const iterator =
+        PyObject_New(DocumentIterator, &DocumentIteratorType);
+
+    if (iterator == NULL) {
+        delete term_list_it;
+
+        return NULL;
+    }
+
+    Py_INCREF(self);
+    iterator->index_ = (PyObject*) self;
+
+    iterator->prefetcher_ = new DocumentPrefetcher(
+        term_list_it, self->index_->documentBase(),
+        start_document_id, end_document_id, batch_size);
+
+    iterator->batch_ = NULL;
+    iterator->position_ = 0;
+
+    return (PyObject*) iterator;
+}
+
+static PyObject* Index_export_dictionary(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    char* path;
+
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+
+    std::vector<VocabularyEntry> entries;
+
+    if (!read_vocabulary_without_gil(self, &entries)) {
+        return NULL;
+    }
+
+    CHECK_EQ(entries.size(), self->index_->uniqueTermCount());
+
+    bool success;
+
+    Py_BEGIN_ALLOW_THREADS
+    success = write_dictionary_snapshot(&entries, path);
+    Py_END_ALLOW_THREADS
+
+    if (!success) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// PostingIterator
+
+// Lazy cursor over the inverted list of a term. Iterating yields
+// (int_document_id, tf) pairs, starting from the current posting.
+typedef struct {
+    PyObject_HEAD
+
+    // Keeps the underlying index open while iterating.
+    PyObject* index_;
+
+    // NULL when the term does not occur in the index.
+    indri::index::DocListIterator* doc_list_it_;
+} PostingIterator;
+
+static void PostingIterator_dealloc(PostingIterator* self) {
+    delete self->doc_list_it_;
+
+    Py_XDECREF(self->index_);
+
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static indri::index::DocListIterator::DocumentData* PostingIterator_current(
+        PostingIterator* self) {
+    if (self->doc_list_it_ == NULL || self->doc_list_it_->finished()) {
+        return NULL;
+    }
+
+    return self->doc_list_it_->currentEntry();
+}
+
+static PyObject* PostingIterator_iter(PostingIterator* self) {
+    Py_INCREF(self);
+
+    return (PyObject*) self;
+}
+
+static PyObject* PostingIterator_iternext_unlocked(PostingIterator* self) {
+    const indri::index::DocListIterator::DocumentData* const entry =
+        PostingIterator_current(self);
+
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    PyObject* const result = Py_BuildValue(
+        "(ln)", static_cast<long>(entry->document),
+        static_cast<Py_ssize_t>(entry->positions.size()));
+
+    try {
+        self->doc_list_it_->nextEntry();
+    } catch (const lemur::api::Exception& e) {
+        PyErr_SetString(PyExc_IOError, e.what().c_str());
+
+        Py_XDECREF(result);
+
+        return NULL;
+    }
+
+    return result;
+}
+
+static PyObject* PostingIterator_iternext(PostingIterator* self) {
+    PyObject* result;
+
+    BEGIN_CRITICAL_SECTION(self);
+    result = PostingIterator_iternext_unlocked(self);
+    END_CRITICAL_SECTION();
+
+    return result;
+}
+
+static PyObject* PostingIterator_next_geq_unlocked(PostingIterator* self, PyObject* args) {
+    int int_document_id;
+
+    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
+        return NULL;
+    }
+
+    const indri::index::DocListIterator::DocumentData* entry =
+        PostingIterator_current(self);
+
+    if (entry != NULL && entry->document < int_document_id) {
+        try {
+            self->doc_list_it_->nextEntry(int_document_id);
+        } catch (const lemur::api::Exception& e) {
+            PyErr_SetString(PyExc_IOError, e.what().c_str());
+
+            return NULL;
+        }
+
+        entry = PostingIterator_current(self);
+    }
+
+    if (entry == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    return PyLong_FromLong(entry->document);
+}
+
+static PyObject* PostingIterator_next_geq(PostingIterator* self, PyObject* args) {
+    PyObject* result;
+
+    BEGIN_CRITICAL_SECTION(self);
+    result = PostingIterator_next_geq_unlocked(self, args);
+    END_CRITICAL_SECTION();
+
+    return result;
+}
+
+static PyObject* PostingIterator_get_document_unlocked(PostingIterator* self, void* closure) {
+    const indri::index::DocListIterator::DocumentData* const entry =
+        PostingIterator_current(self);
+
+    if (entry == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    return PyLong_FromLong(entry->document);
+}
+
+static PyObject* PostingIterator_get_document(PostingIterator* self, void* closure) {
+    PyObject* result;
+
+    BEGIN_CRITICAL_SECTION(self);
+    result = PostingIterator_get_document_unlocked(self, closure);
+    END_CRITICAL_SECTION();
+
+    return result;
+}
+
+static PyObject* PostingIterator_get_tf_unlocked(PostingIterator* self, void* closure) {
+    const indri::index::DocListIterator::DocumentData* const entry =
+        PostingIterator_current(self);
+
+    if (entry == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    return PyLong_FromSsize_t(entry->positions.size());
+}
+
+static PyObject* PostingIterator_get_tf(PostingIterator* self, void* closure) {
+    PyObject* result;
+
+    BEGIN_CRITICAL_SECTION(self);
+    result = PostingIterator_get_tf_unlocked(self, closure);
+    END_CRITICAL_SECTION();
+
+    return result;
+}
+
+static PyObject* PostingIterator_get_positions_unlocked(PostingIterator* self, void* closure) {
+    const indri::index::DocListIterator::DocumentData* const entry =
+        PostingIterator_current(self);
+
+    if (entry == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    std::vector<int32_t> positions(entry->positions.begin(),
+                                   entry->positions.end());
+
+    return Array_from_vector(&positions);
+}
+
+static PyObject* PostingIterator_get_positions(PostingIterator* self, void* closure) {
+    PyObject* result;
+
+    BEGIN_CRITICAL_SECTION(self);
+    result = PostingIterator_get_positions_unlocked(self, closure);
+    END_CRITICAL_SECTION();
+
+    return result;
+}
+
+static PyMethodDef PostingIterator_methods[] = {
+    {"next_geq", (PyCFunction) PostingIterator_next_geq, METH_VARARGS,
+     "Advances to the first posting with an internal document identifier "
+     "greater than or equal to the given one, and returns its identifier "
+     "(or None if the list is exhausted)."},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef PostingIterator_getset[] = {
+    {"document", (getter) PostingIterator_get_document, NULL,
+     "Internal document identifier of the current posting, or None.", NULL},
+    {"tf", (getter) PostingIterator_get_tf, NULL,
+     "Term frequency of the current posting, or None.", NULL},
+    {"positions", (getter) PostingIterator_get_positions, NULL,
+     "Term positions (int32 Array) of the current posting, or None.", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject PostingIteratorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyndri.PostingIterator",   /* tp_name */
+    sizeof(PostingIterator),   /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) PostingIterator_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "Cursor over the (int_document_id, tf) postings of a term", /* tp_doc */
+    0,                   /* tp_traverse */
+    0,                   /* tp_clear */
+    0,                   /* tp_richcompare */
+    0,                   /* tp_weaklistoffset */
+    (getiterfunc) PostingIterator_iter,          /* tp_iter */
+    (iternextfunc) PostingIterator_iternext,     /* tp_iternext */
+    PostingIterator_methods,   /* tp_methods */
+    0,                         /* tp_members */
+    PostingIterator_getset,    /* tp_getset */
+};
+
+// Returns NULL, without setting an exception, if the term does not occur in
+// the index. Throws lemur::api::Exception on I/O errors.
+static indri::index::DocListIterator* open_doc_list(Index* self,
+                                                    const lemur::api::TERMID_T term_id) {
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    indri::index::DocListIterator* const doc_list_it =
+        self->index_->docListIterator(term_id);
+
+    if (doc_list_it != NULL) {
+        doc_list_it->startIteration();
+    }
+
+    return doc_list_it;
+}
+
+static bool check_term_id(Index* self, const long term_id) {
+    if (term_id <= 0 ||
+        static_cast<UINT64>(term_id) > self->index_->uniqueTermCount()) {
+        PyErr_SetString(PyExc_IndexError,
+                        "Specified term identifier is out of bounds.");
+
+        return false;
+    }
+
+    return true;
+}
+
+static PyObject* Index_postings(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    long term_id;
+    int include_positions = 0;
+
+    static char* kwlist[] = {"term_id", "include_positions", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "l|p", kwlist,
+                                     &term_id,
+                                     &include_positions)) {
+        return NULL;
+    }
+
+    if (!check_term_id(self, term_id)) {
+        return NULL;
+    }
+
+    std::vector<int32_t> document_ids;
+    std::vector<int32_t> term_frequencies;
+    std::vector<int32_t> positions;
+    std::vector<int64_t> position_offsets(1, 0);
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    indri::index::DocListIterator* doc_list_it = NULL;
+
+    try {
+        doc_list_it = open_doc_list(self, term_id);
+
+        while (doc_list_it != NULL && !doc_list_it->finished()) {
+            const indri::index::DocListIterator::DocumentData* const entry =
+                doc_list_it->currentEntry();
+
+            document_ids.push_back(entry->document);
+            term_frequencies.push_back(entry->positions.size());
+
+            if (include_positions) {
+                positions.insert(positions.end(),
+                                 entry->positions.begin(),
+                                 entry->positions.end());
+                position_offsets.push_back(positions.size());
+            }
+
+            doc_list_it->nextEntry();
+        }
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read inverted list." : e.what();
+    }
+
+    delete doc_list_it;
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    if (include_positions) {
+        return Py_BuildValue("(NNNN)",
+                             Array_from_vector(&document_ids),
+                             Array_from_vector(&term_frequencies),
+                             Array_from_vector(&positions),
+                             Array_from_vector(&position_offsets));
+    } else {
+        return Py_BuildValue("(NN)",
+                             Array_from_vector(&document_ids),
+                             Array_from_vector(&term_frequencies));
+    }
+}
+
+static PyObject* Index_posting_iterator(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    long term_id;
+
+    if (!PyArg_ParseTuple(args, "l", &term_id)) {
+        return NULL;
+    }
+
+    if (!check_term_id(self, term_id)) {
+        return NULL;
+    }
+
+    indri::index::DocListIterator* doc_list_it = NULL;
+
+    try {
+        doc_list_it = open_doc_list(self, term_id);
+    } catch (const lemur::api::Exception& e) {
+        PyErr_SetString(PyExc_IOError, e.what().c_str());
+
+        return NULL;
+    }
+
+    PostingIterator* const iterator =
+        PyObject_New(PostingIterator, &PostingIteratorType);
+
+    if (iterator == NULL) {
+        delete doc_list_it;
+
+        return NULL;
+    }
+
+    Py_INCREF(self);
+    iterator->index_ = (PyObject*) self;
+    iterator->doc_list_it_ = doc_list_it;
+
+    return (PyObject*) iterator;
+}
+
+// Statistics.
+
+static PyObject* Index_build_statistics(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    const std::string path = indri::file::Path::combine(
+        *self->repository_path_, STATISTICS_FILENAME);
+
+    std::vector<VocabularyEntry> entries;
+
+    if (!read_vocabulary_without_gil(self, &entries)) {
+        return NULL;
+    }
+
+    bool success;
+
+    Py_BEGIN_ALLOW_THREADS
+    success = build_statistics(self, entries, path);
+    Py_END_ALLOW_THREADS
+
+    if (!success) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path.c_str());
+
+        return NULL;
+    }
+
+    // Replaces the sidecar loaded before, if any.
+    if (!self->statistics_->load(path,
+                                 self->index_->documentBase(),
+                                 self->index_->documentMaximum(),
+                                 self->index_->termCount(),
+                                 self->index_->uniqueTermCount(),
+                                 true)) {
+        PyErr_SetString(PyExc_IOError, "Statistics sidecar is corrupt or outdated.");
+
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* Index_collection_statistics(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    const StatisticsHeader* const header = self->statistics_->header();
+
+    const uint64_t num_documents =
+        header != NULL ? header->num_documents : self->index_->documentCount();
+    const uint64_t total_terms =
+        header != NULL ? header->total_terms : self->index_->termCount();
+    const uint64_t unique_terms =
+        header != NULL ? header->unique_terms : self->index_->uniqueTermCount();
+
+    return Py_BuildValue(
+        "{s:K,s:K,s:K,s:d}",
+        "num_documents", static_cast<unsigned long long>(num_documents),
+        "total_terms", static_cast<unsigned long long>(total_terms),
+        "unique_terms", static_cast<unsigned long long>(unique_terms),
+        "average_document_length",
+        num_documents > 0 ? static_cast<double>(total_terms) / num_documents : 0.0);
+}
+
+// Returns the lengths of all documents, indexed from the document base; with
+// a statistics sidecar, without copying.
+static PyObject* Index_all_document_lengths(Index* self) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    const StatisticsHeader* const header = self->statistics_->header();
+
+    if (header != NULL) {
+        return Array_from_memory(StatisticsTable::lengths(header),
+                                 header->document_maximum - header->document_base,
+                                 (PyObject*) self);
+    }
+
+    const lemur::api::DOCID_T document_base = self->index_->documentBase();
+    const lemur::api::DOCID_T document_maximum = self->index_->documentMaximum();
+
+    std::vector<uint32_t> lengths;
+    lengths.reserve(document_maximum - document_base);
+
+    Py_BEGIN_ALLOW_THREADS
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    for (lemur::api::DOCID_T int_document_id = document_base;
+         int_document_id < document_maximum;
+         ++int_document_id) {
+        lengths.push_back(self->index_->documentLength(int_document_id));
+    }
+
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+
+    return Array_from_vector(&lengths);
+}
+
+// Returns the document (or else collection) frequencies of the term
+// identifiers, or of all term identifiers, indexed by identifier, if none are
+// passed. Served from the statistics sidecar if loaded.
+static PyObject* term_frequencies(Index* self, PyObject* args,
+                                  const bool document_frequency) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* term_ids_object = NULL;
+
+    if (!PyArg_ParseTuple(args, "|O", &term_ids_object)) {
+        return NULL;
+    }
+
+    const StatisticsHeader* const header = self->statistics_->header();
+    const uint64_t* const frequencies = header == NULL ? NULL :
+        (document_frequency ? StatisticsTable::dfs(header) : StatisticsTable::cfs(header));
+
+    if (term_ids_object == NULL) {
+        if (frequencies != NULL) {
+            return Array_from_memory(frequencies, header->max_term_id + 1, (PyObject*) self);
+        }
+
+        std::vector<VocabularyEntry> entries;
+
+        if (!read_vocabulary_without_gil(self, &entries)) {
+            return NULL;
+        }
+
+        std::vector<uint64_t> values(self->index_->uniqueTermCount() + 1, 0);
+
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (static_cast<size_t>(entries[i].term_id) >= values.size()) {
+                values.resize(entries[i].term_id + 1, 0);
+            }
+
+            values[entries[i].term_id] = document_frequency ?
+                entries[i].document_frequency : entries[i].term_frequency;
+        }
+
+        return Array_from_vector(&values);
+    }
+
+    std::vector<int64_t> term_ids;
+
+    if (!read_integers(term_ids_object, &term_ids)) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < term_ids.size(); ++i) {
+        if (!check_term_id(self, term_ids[i])) {
+            return NULL;
+        }
+    }
+
+    std::vector<uint64_t> values(term_ids.size(), 0);
+
+    Py_BEGIN_ALLOW_THREADS
+
+    if (frequencies != NULL) {
+        for (size_t i = 0; i < term_ids.size(); ++i) {
+            if (static_cast<uint64_t>(term_ids[i]) <= header->max_term_id) {
+                values[i] = frequencies[term_ids[i]];
+            }
+        }
+    } else {
+        indri::thread::ScopedLock lock(self->index_lock_);
+
+        for (size_t i = 0; i < term_ids.size(); ++i) {
+            const std::string term = self->index_->term(term_ids[i]);
+
+            values[i] = document_frequency ?
+                self->index_->documentCount(term) : self->index_->termCount(term);
+        }
+    }
+
+    Py_END_ALLOW_THREADS
+
+    return Array_from_vector(&values);
+}
+
+static PyObject* Index_document_frequencies(Index* self, PyObject* args) {
+    return term_frequencies(self, args, true);
+}
+
+static PyObject* Index_collection_frequencies(Index* self, PyObject* args) {
+    return term_frequencies(self, args, false);
+}
+
+// Bag-of-words.
+
+// Determines whether terms are Krovetz-stemmed, as the index was. Sets an
+// exception and returns false if the stemmer of the index is unsupported.
+static bool check_stemmer(Index* self, bool* const krovetz) {
+    *krovetz = *self->stemmer_ == "krovetz" || *self->stemmer_ == "kstem";
+
+    if (!self->stemmer_->empty() && !*krovetz) {
+        PyErr_Format(PyExc_NotImplementedError,
+                     "Unsupported stemmer %s.", self->stemmer_->c_str());
+
+        return false;
+    }
+
+    return true;
+}
+
+// A document passed to doc2bow, either as raw text or as tokens.
+struct BagOfWordsInput {
+    bool is_text;
+
+    std::string text;
+    std::vector<std::string> tokens;
+};
+
+// Reads a document given as a str (raw text) or as an iterable of str
+// tokens. Sets an exception and returns false on failure.
+static bool read_bag_of_words_input(PyObject* const document,
+                                    BagOfWordsInput* const input) {
+    input->is_text = PyUnicode_Check(document);
+
+    if (!input->is_text) {
+        return read_strings(document, &input->tokens);
+    }
+
+    PyObject* const document_bytes =
+        PyUnicode_AsEncodedString(document, ENCODING, "strict");
+
+    if (document_bytes == NULL) {
+        return false;
+    }
+
+    input->text.assign(PyBytes_AS_STRING(document_bytes),
+                       PyBytes_GET_SIZE(document_bytes));
+
+    Py_DECREF(document_bytes);
+
+    return true;
+}
+
+// Maps a document to its sorted term identifiers and their counts; raw text
+// is tokenized first and terms are stemmed if krovetz is set.
+// Out-of-vocabulary terms are skipped.
+static void bag_of_words(const VocabularyHash& vocabulary,
+                         const bool krovetz,
+                         BagOfWordsInput* const input,
+                         std::vector<int32_t>* const term_ids,
+                         std::vector<int32_t>* const counts) {
+    std::vector<std::string> terms;
+
+    if (input->is_text) {
+        tokenize_document(input->text, &terms);
+    } else {
+        terms.swap(input->tokens);
+    }
+
+    if (krovetz) {
+        krovetz_stem(&terms);
+    }
+
+    std::vector<int32_t> ids;
+    ids.reserve(terms.size());
+
+    for (size_t i = 0; i < terms.size(); ++i) {
+        const lemur::api::TERMID_T term_id = vocabulary.find(terms[i]);
+
+        if (term_id > 0) {
+            ids.push_back(term_id);
+        }
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    for (size_t begin = 0, end = 0; begin < ids.size(); begin = end) {
+        while (end < ids.size() && ids[end] == ids[begin]) {
+            ++end;
+        }
+
+        term_ids->push_back(ids[begin]);
+        counts->push_back(end - begin);
+    }
+}
+
+// Builds the vocabulary hash on first use. Callers must not hold the GIL.
+static void build_vocabulary(Index* self) {
+    ScopedDiskIndex index(self->index_pool_);
+
+    self->vocabulary_->build(index.get());
+}
+
+static PyObject* Index_doc2bow(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* document;
+
+    if (!PyArg_ParseTuple(args, "O", &document)) {
+        return NULL;
+    }
+
+    bool krovetz;
+
+    if (!check_stemmer(self, &krovetz)) {
+        return NULL;
+    }
+
+    BagOfWordsInput input;
+
+    if (!read_bag_of_words_input(document, &input)) {
+        return NULL;
+    }
+
+    std::vector<int32_t> term_ids;
+    std::vector<int32_t> counts;
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        build_vocabulary(self);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read vocabulary." : e.what();
+    }
+
+    if (error.empty()) {
+        bag_of_words(*self->vocabulary_, krovetz, &input, &term_ids, &counts);
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const term_ids_array = Array_from_vector(&term_ids);
+    PyObject* const counts_array = Array_from_vector(&counts);
+
+    if (term_ids_array == NULL || counts_array == NULL) {
+        Py_XDECREF(term_ids_array);
+        Py_XDECREF(counts_array);
+
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", term_ids_array, counts_array);
+}
+
+// State shared between the worker threads of a single batch_doc2bow call.
+struct BagOfWordsState {
+    const VocabularyHash* vocabulary;
+    bool krovetz;
+
+    WorkQueue* work_queue;
+
+    std::vector<BagOfWordsInput>* inputs;
+    std::vector<std::vector<int32_t> >* term_ids;
+    std::vector<std::vector<int32_t> >* counts;
+};
+
+static void bag_of_words_worker(void* data) {
+    BagOfWordsState* const state = *static_cast<BagOfWordsState**>(data);
+
+    size_t idx;
+    while (state->work_queue->next(&idx)) {
+        bag_of_words(*state->vocabulary, state->krovetz,
+                     &(*state->inputs)[idx],
+                     &(*state->term_ids)[idx],
+                     &(*state->counts)[idx]);
+    }
+}
+
+static PyObject* Index_batch_doc2bow(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* documents;
+    long num_threads = 0;
+
+    static char* kwlist[] = {"documents", "num_threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|l", kwlist,
+                                     &documents,
+                                     &num_threads)) {
+        return NULL;
+    }
+
+    bool krovetz;
+
+    if (!check_stemmer(self, &krovetz)) {
+        return NULL;
+    }
+
+    PyObject* const iterator = PyObject_GetIter(documents);
+
+    if (iterator == NULL) {
+        return NULL;
+    }
+
+    // Read every document up front, as the GIL is released during the
+    // conversion.
+    std::vector<BagOfWordsInput> inputs;
+
+    PyObject* item;
+    while ((item = PyIter_Next(iterator))) {
+        inputs.push_back(BagOfWordsInput());
+
+        const bool success = read_bag_of_words_input(item, &inputs.back());
+        Py_DECREF(item);
+
+        if (!success) {
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+    }
+
+    Py_DECREF(iterator);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    if (num_threads <= 0) {
+        num_threads = default_num_threads();
+    }
+
+    num_threads = std::max(
+        std::min(static_cast<size_t>(num_threads), inputs.size()), static_cast<size_t>(1));
+
+    std::vector<std::vector<int32_t> > term_ids(inputs.size());
+    std::vector<std::vector<int32_t> > counts(inputs.size());
+
+    WorkQueue work_queue(inputs.size());
+
+    BagOfWordsState state;
+    state.vocabulary = self->vocabulary_;
+    state.krovetz = krovetz;
+    state.work_queue = &work_queue;
+    state.inputs = &inputs;
+    state.term_ids = &term_ids;
+    state.counts = &counts;
+
+    std::vector<BagOfWordsState*> workers(num_threads, &state);
+
+    std::vector<int64_t> indptr(1, 0);
+    std::vector<int32_t> indices;
+    std::vector<int32_t> data;
+
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        build_vocabulary(self);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read vocabulary." : e.what();
+    }
+
+    if (error.empty()) {
+        run_threads(bag_of_words_worker, &workers);
+
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            indices.insert(indices.end(), term_ids[i].begin(), term_ids[i].end());
+            data.insert(data.end(), counts[i].begin(), counts[i].end());
+
+            indptr.push_back(indices.size());
+        }
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const data_array = Array_from_vector(&data);
+    PyObject* const indices_array = Array_from_vector(&indices);
+    PyObject* const indptr_array = Array_from_vector(&indptr);
+
+    if (data_array == NULL || indices_array == NULL || indptr_array == NULL) {
+        Py_XDECREF(data_array);
+        Py_XDECREF(indices_array);
+        Py_XDECREF(indptr_array);
+
+        return NULL;
+    }
+
+    return Py_BuildValue("(NNN)", data_array, indices_array, indptr_array);
+}
+
+// Retrieval with dynamic pruning.
+
+// Document lengths from the statistics sidecar if loaded, or else from a
+// pooled DiskIndex held from the first lookup on, such that scans over many
+// postings do not take index_lock_ for every document. Lookups throw
+// lemur::api::Exception if the pooled index cannot be opened.
+class IndexDocumentLengths : public DocumentLengths {
+ public:
+    explicit IndexDocumentLengths(Index* const index)
+        : index_(index), lengths_(shared_document_lengths(index)), disk_index_(NULL) {}
+
+    ~IndexDocumentLengths() {
+        if (disk_index_ != NULL) {
+            index_->index_pool_->release(disk_index_);
+        }
+    }
+
+    int length(const lemur::api::DOCID_T int_document_id) {
+        if (lengths_ != NULL) {
+            return document_length(index_, lengths_, int_document_id);
+        }
+
+        if (disk_index_ == NULL) {
+            disk_index_ = index_->index_pool_->acquire();
+        }
+
+        return disk_index_->documentLength(int_document_id);
+    }
+
+ private:
+    Index* const index_;
+    const uint32_t* const lengths_;
+
+    indri::index::DiskIndex* disk_index_;
+};
+
+// Splits a bag-of-words query into lowercase terms, and stops and stems them
+// as the index was. Sets an exception and returns false on failure.
+static bool tokenize_query(Index* self,
+                           const std::string& query,
+                           std::vector<std::string>* const terms) {
+    if (query.find('#') != std::string::npos) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Only bag-of-words queries are supported; "
+                        "query operators are not.");
+
+        return false;
+    }
+
+    bool krovetz;
+
+    if (!check_stemmer(self, &krovetz)) {
+        return false;
+    }
+
+    tokenize_text(query, terms);
+
+    // As during indexing, stopwords are removed before stemming.
+    if (!self->stopwords_->empty()) {
+        std::vector<std::string>::iterator end = terms->begin();
+
+        for (std::vector<std::string>::iterator it = terms->begin();
+             it != terms->end(); ++it) {
+            if (self->stopwords_->find(*it) == self->stopwords_->end()) {
+                *end++ = *it;
+            }
+        }
+
+        terms->erase(end, terms->end());
+    }
+
+    if (krovetz) {
+        krovetz_stem(terms);
+    }
+
+    return true;
+}
+
+// Resolves the weighted terms against the index; duplicate terms are merged.
+// Frequencies are read from the statistics sidecar if loaded.
+static void resolve_terms(Index* self,
+                          const std::vector<std::string>& terms,
+                          const std::vector<double>& weights,
+                          std::vector<RetrievalTerm>* const retrieval_terms) {
+    const StatisticsHeader* const header = self->statistics_->header();
+
+    std::map<std::string, size_t> positions;
+
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    for (size_t i = 0; i < terms.size(); ++i) {
+        const std::map<std::string, size_t>::const_iterator it =
+            positions.find(terms[i]);
+
+        if (it != positions.end()) {
+            (*retrieval_terms)[it->second].weight += weights[i];
+
+            continue;
+        }
+
+        positions[terms[i]] = retrieval_terms->size();
+
+        RetrievalTerm retrieval_term;
+        retrieval_term.term_id = self->index_->term(terms[i]);
+        retrieval_term.weight = weights[i];
+        retrieval_term.document_frequency = 0;
+        retrieval_term.term_frequency = 0;
+        retrieval_term.bound.max_term_frequency = 0;
+        retrieval_term.bound.min_document_length = 0;
+
+        if (retrieval_term.term_id > 0 && header != NULL &&
+                static_cast<uint64_t>(retrieval_term.term_id) <= header->max_term_id) {
+            retrieval_term.document_frequency =
+                StatisticsTable::dfs(header)[retrieval_term.term_id];
+            retrieval_term.term_frequency =
+                StatisticsTable::cfs(header)[retrieval_term.term_id];
+        } else if (retrieval_term.term_id > 0) {
+            retrieval_term.document_frequency = self->index_->documentCount(terms[i]);
+            retrieval_term.term_frequency = self->index_->termCount(terms[i]);
+        }
+
+        retrieval_terms->push_back(retrieval_term);
+    }
+}
+
+// Computes the bound of a term by scanning its inverted list, unless it is
+// known already. Throws lemur::api::Exception on I/O errors.
+static TermBound get_term_bound(Index* self,
+                                const lemur::api::TERMID_T term_id,
+                                DocumentLengths* const document_lengths) {
+    TermBound bound;
+
+    if (self->term_bounds_->find(term_id, &bound)) {
+        return bound;
+    }
+
+    bound.max_term_frequency = 0;
+    bound.min_document_length = UINT32_MAX;
+
+    indri::index::DocListIterator* const doc_list_it = open_doc_list(self, term_id);
+
+    try {
+        while (doc_list_it != NULL && !doc_list_it->finished()) {
+            const indri::index::DocListIterator::DocumentData* const entry =
+                doc_list_it->currentEntry();
+
+            bound.max_term_frequency = std::max(
+                bound.max_term_frequency,
+                static_cast<uint32_t>(entry->positions.size()));
+            bound.min_document_length = std::min(
+                bound.min_document_length,
+                static_cast<uint32_t>(document_lengths->length(entry->document)));
+
+            doc_list_it->nextEntry();
+        }
+    } catch (const lemur::api::Exception& e) {
+        delete doc_list_it;
+
+        throw;
+    }
+
+    delete doc_list_it;
+
+    if (bound.max_term_frequency == 0) {
+        bound.min_document_length = 0;
+    }
+
+    self->term_bounds_->insert(term_id, bound);
+
+    return bound;
+}
+
+// Retrieves the top-k documents for the terms with WAND, scored under the
+// collection statistics. Throws lemur::api::Exception on I/O errors.
+static void retrieve_top_k(Index* self,
+                           RetrievalModel* const model,
+                           const CollectionStatistics& statistics,
+                           std::vector<RetrievalTerm>* const terms,
+                           const size_t k,
+                           std::vector<ScoredDocument>* const results) {
+    ScopedTimer timer(self->instrumentation_, WAND_PHASE);
+
+    IndexDocumentLengths document_lengths(self);
+
+    for (size_t i = 0; i < terms->size(); ++i) {
+        if ((*terms)[i].term_id > 0) {
+            (*terms)[i].bound = get_term_bound(
+                self, (*terms)[i].term_id, &document_lengths);
+        }
+    }
+
+    model->prepare(statistics, *terms);
+
+    std::vector<PostingCursor> cursors;
+
+    try {
+        for (size_t i = 0; i < terms->size(); ++i) {
+            if ((*terms)[i].term_id <= 0) {
+                continue;
+            }
+
+            PostingCursor cursor;
+            cursor.doc_list_it = open_doc_list(self, (*terms)[i].term_id);
+            cursor.term = i;
+
+            if (cursor.doc_list_it != NULL) {
+                cursors.push_back(cursor);
+            }
+        }
+
+        wand_retrieve(*model, terms->size(), &cursors, &document_lengths, k, results);
+    } catch (const lemur::api::Exception& e) {
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            delete cursors[i].doc_list_it;
+        }
+
+        throw;
+    }
+
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        delete cursors[i].doc_list_it;
+    }
+}
+
+// Creates the retrieval model with the given name, or sets an exception and
+// returns NULL.
+static RetrievalModel* create_retrieval_model(const char* const name,
+                                              const double mu,
+                                              const double k1,
+                                              const double b) {
+    if (strcmp(name, "dirichlet") == 0) {
+        if (mu <= 0.0) {
+            PyErr_SetString(PyExc_ValueError, "mu should be strictly positive.");
+
+            return NULL;
+        }
+
+        return new DirichletModel(mu);
+    } else if (strcmp(name, "bm25") == 0) {
+        if (k1 < 0.0 || b < 0.0 || b > 1.0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "k1 should be non-negative and b within [0, 1].");
+
+            return NULL;
+        }
+
+        return new BM25Model(k1, b);
+    }
+
+    PyErr_Format(PyExc_ValueError,
+                 "Unknown retrieval model %s; expected dirichlet or bm25.", name);
+
+    return NULL;
+}
+
+static PyObject* scored_documents_to_tuple(const std::vector<ScoredDocument>& results) {
+    PyObject* const tuple = PyTuple_New(results.size());
+
+    for (size_t pos = 0; pos < results.size(); ++pos) {
+        PyTuple_SetItem(tuple, pos,
+                        PyTuple_Pack(2,
+                            PyLong_FromLong(results[pos].document),
+                            PyFloat_FromDouble(results[pos].score)));
+    }
+
+    return tuple;
+}
+
+static PyObject* Index_wand_query(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    char* query_str;
+    long results_requested = 100;
+    char* model_name = "dirichlet";
+    double mu = 2500.0;
+    double k1 = 1.2;
+    double b = 0.75;
+
+    static char* kwlist[] = {"query_str",
+                             "results_requested",
+                             "model",
+                             "mu",
+                             "k1",
+                             "b",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "es|lsddd", kwlist,
+                                     ENCODING, &query_str,
+                                     &results_requested,
+                                     &model_name,
+                                     &mu, &k1, &b)) {
+        return NULL;
+    }
+
+    const std::string query(query_str);
+    PyMem_Free(query_str);
+
+    if (results_requested <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "results_requested should be strictly positive.");
+
+        return NULL;
+    }
+
+    RetrievalModel* const model = create_retrieval_model(model_name, mu, k1, b);
+
+    if (model == NULL) {
+        return NULL;
+    }
+
+    std::vector<std::string> terms;
+
+    if (!tokenize_query(self, query, &terms)) {
+        delete model;
+
+        return NULL;
+    }
+
+    std::vector<RetrievalTerm> retrieval_terms;
+    resolve_terms(self, terms, std::vector<double>(terms.size(), 1.0), &retrieval_terms);
+
+    CollectionStatistics statistics;
+    statistics.num_documents = self->index_->documentCount();
+    statistics.total_terms = self->index_->termCount();
+
+    std::vector<ScoredDocument> results;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        retrieve_top_k(self, model, statistics, &retrieval_terms, results_requested, &results);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to evaluate query." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    delete model;
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    ScopedTimer timer(self->instrumentation_, RESULTS_PHASE);
+
+    return scored_documents_to_tuple(results);
+}
+
+// Pseudo-relevance feedback.
+
+struct ExpansionTerm {
+    lemur::api::TERMID_T term_id;
+    double weight;
+
+    std::string term;
+};
+
+struct ExpansionTermRank {
+    bool operator()(const ExpansionTerm& first, const ExpansionTerm& second) const {
+        if (first.weight != second.weight) {
+            return first.weight > second.weight;
+        }
+
+        return first.term_id < second.term_id;
+    }
+};
+
+// Estimates a relevance model (RM1) from the feedback documents, as Indri
+// does: P(w|R) is proportional to the sum over documents d of P(d|Q) times
+// the maximum-likelihood estimate of P(w|d), where P(d|Q) is proportional to
+// the exponentiated query likelihood. Keeps the num_terms most likely terms,
+// with weights normalized to sum to one. Throws lemur::api::Exception on I/O
+// errors.
+static void estimate_relevance_model(Index* self,
+                                     const std::vector<ScoredDocument>& feedback,
+                                     const size_t num_terms,
+                                     std::vector<ExpansionTerm>* const expansion) {
+    if (feedback.empty() || num_terms == 0) {
+        return;
+    }
+
+    // Scores are log-likelihoods; shift them before exponentiating.
+    double max_score = feedback[0].score;
+
+    for (size_t i = 1; i < feedback.size(); ++i) {
+        max_score = std::max(max_score, feedback[i].score);
+    }
+
+    double total_likelihood = 0.0;
+
+    for (size_t i = 0; i < feedback.size(); ++i) {
+        total_likelihood += exp(feedback[i].score - max_score);
+    }
+
+    std::map<lemur::api::TERMID_T, double> relevance_model;
+
+    {
+        ScopedDiskIndex index(self->index_pool_);
+
+        for (size_t i = 0; i < feedback.size(); ++i) {
+            const indri::index::TermList* const term_list =
+                index->termList(feedback[i].document);
+
+            if (term_list == NULL) {
+                continue;
+            }
+
+            self->instrumentation_->increment(DOCUMENTS_DECODED_COUNTER);
+
+            const indri::utility::greedy_vector<lemur::api::TERMID_T>& terms =
+                term_list->terms();
+
+            if (terms.size() > 0) {
+                const double document_weight =
+                    exp(feedback[i].score - max_score) / total_likelihood / terms.size();
+
+                for (size_t pos = 0; pos < terms.size(); ++pos) {
+                    // Stopwords are stored as the out-of-vocabulary term.
+                    if (terms[pos] > 0) {
+                        relevance_model[terms[pos]] += document_weight;
+                    }
+                }
+            }
+
+            delete term_list;
+        }
+    }
+
+    for (std::map<lemur::api::TERMID_T, double>::const_iterator it = relevance_model.begin();
+         it != relevance_model.end();
+         ++it) {
+        ExpansionTerm expansion_term;
+        expansion_term.term_id = it->first;
+        expansion_term.weight = it->second;
+
+        expansion->push_back(expansion_term);
+    }
+
+    const size_t size = std::min(num_terms, expansion->size());
+
+    std::partial_sort(expansion->begin(), expansion->begin() + size, expansion->end(),
+                      ExpansionTermRank());
+    expansion->resize(size);
+
+    double total_weight = 0.0;
+
+    for (size_t i = 0; i < expansion->size(); ++i) {
+        total_weight += (*expansion)[i].weight;
+    }
+
+    indri::thread::ScopedLock lock(self->index_lock_);
+
+    for (size_t i = 0; i < expansion->size(); ++i) {
+        (*expansion)[i].weight /= total_weight;
+        (*expansion)[i].term = self->index_->term((*expansion)[i].term_id);
+    }
+}
+
+// Evaluates a bag-of-words query with RM3 pseudo-relevance feedback: the
+// query is expanded with the terms of a relevance model estimated from its
+// top-ranked documents and evaluated again, equivalent to the Indri query
+//
+//   #weight(orig_weight #combine(query)
+//           (1 - orig_weight) #weight(w_1 t_1 ... w_n t_n))
+//
+// under Dirichlet smoothing, without going through the query parser.
+static PyObject* Index_rm3_query(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    char* query_str;
+    long results_requested = 100;
+    long fb_docs = 10;
+    long fb_terms = 10;
+    double orig_weight = 0.5;
+    double mu = 2500.0;
+
+    static char* kwlist[] = {"query_str",
+                             "results_requested",
+                             "fb_docs",
+                             "fb_terms",
+                             "orig_weight",
+                             "mu",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "es|llldd", kwlist,
+                                     ENCODING, &query_str,
+                                     &results_requested,
+                                     &fb_docs,
+                                     &fb_terms,
+                                     &orig_weight,
+                                     &mu)) {
+        return NULL;
+    }
+
+    const std::string query(query_str);
+    PyMem_Free(query_str);
+
+    if (results_requested <= 0 || fb_docs <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "results_requested and fb_docs should be strictly positive.");
+
+        return NULL;
+    }
+
+    if (fb_terms < 0) {
+        PyErr_SetString(PyExc_ValueError, "fb_terms should be non-negative.");
+
+        return NULL;
+    }
+
+    if (orig_weight < 0.0 || orig_weight > 1.0) {
+        PyErr_SetString(PyExc_ValueError, "orig_weight should be within [0, 1].");
+
+        return NULL;
+    }
+
+    if (mu <= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "mu should be strictly positive.");
+
+        return NULL;
+    }
+
+    std::vector<std::string> terms;
+
+    if (!tokenize_query(self, query, &terms)) {
+        return NULL;
+    }
+
+    const StatisticsHeader* const header = self->statistics_->header();
+
+    CollectionStatistics statistics;
+    statistics.num_documents =
+        header != NULL ? header->num_documents : self->index_->documentCount();
+    statistics.total_terms =
+        header != NULL ? header->total_terms : self->index_->termCount();
+
+    std::vector<ExpansionTerm> expansion;
+    std::vector<ScoredDocument> results;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try {
+        DirichletModel model(mu);
+
+        std::vector<RetrievalTerm> retrieval_terms;
+        resolve_terms(self, terms, std::vector<double>(terms.size(), 1.0), &retrieval_terms);
+
+        std::vector<ScoredDocument> feedback;
+        retrieve_top_k(self, &model, statistics, &retrieval_terms, fb_docs, &feedback);
+
+        estimate_relevance_model(self, feedback, fb_terms, &expansion);
+
+        // Flattens the interpolation into a single weighted query; the
+        // weights of terms that occur in both parts add up.
+        std::vector<std::string> expanded_terms;
+        std::vector<double> expanded_weights;
+
+        const double expansion_weight = expansion.empty() ? 0.0 : 1.0 - orig_weight;
+        const double term_weight = expansion.empty() ? 1.0 : orig_weight;
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            expanded_terms.push_back(terms[i]);
+            expanded_weights.push_back(term_weight / terms.size());
+        }
+
+        for (size_t i = 0; i < expansion.size(); ++i) {
+            expanded_terms.push_back(expansion[i].term);
+            expanded_weights.push_back(expansion_weight * expansion[i].weight);
+        }
+
+        retrieval_terms.clear();
+        resolve_terms(self, expanded_terms, expanded_weights, &retrieval_terms);
+
+        retrieve_top_k(self, &model, statistics, &retrieval_terms, results_requested, &results);
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to evaluate query." : e.what();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    PyObject* const expansion_tuple = PyTuple_New(expansion.size());
+
+    for (size_t i = 0; i < expansion.size(); ++i) {
+        PyTuple_SetItem(expansion_tuple, i,
+                        Py_BuildValue("(Nd)",
+                                      decode_string(expansion[i].term),
+                                      expansion[i].weight));
+    }
+
+    return Py_BuildValue("(NN)", scored_documents_to_tuple(results), expansion_tuple);
+}
+
+static PyObject* Index_build_max_scores(Index* self, PyObject* args) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    const std::string path = indri::file::Path::combine(
+        *self->repository_path_, MAX_SCORE_FILENAME);
+
+    std::vector<TermBound> bounds;
+    std::string error;
+    bool success = false;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    TermBound empty_bound;
+    empty_bound.max_term_frequency = 0;
+    empty_bound.min_document_length = UINT32_MAX;
+
+    bounds.resize(self->index_->uniqueTermCount() + 1, empty_bound);
+
+    IndexDocumentLengths document_lengths(self);
+
+    indri::index::TermListFileIterator* term_list_it = NULL;
+
+    // A single sequential pass over the direct file.
+    try {
+        {
+            indri::thread::ScopedLock lock(self->index_lock_);
+            term_list_it = self->index_->termListFileIterator();
+        }
+
+        std::vector<lemur::api::TERMID_T> terms;
+
+        lemur::api::DOCID_T int_document_id = self->index_->documentBase();
+
+        for (term_list_it->startIteration();
+             !term_list_it->finished();
+             term_list_it->nextEntry(), ++int_document_id) {
+            const indri::index::TermList* const term_list = term_list_it->currentEntry();
+
+            terms.assign(term_list->terms().begin(), term_list->terms().end());
+            std::sort(terms.begin(), terms.end());
+
+            const uint32_t length = document_lengths.length(int_document_id);
+
+            for (size_t begin = 0, end = 0; begin < terms.size(); begin = end) {
+                while (end < terms.size() && terms[end] == terms[begin]) {
+                    ++end;
+                }
+
+                const lemur::api::TERMID_T term_id = terms[begin];
+
+                if (term_id <= 0) {
+                    continue;
+                }
+
+                if (static_cast<size_t>(term_id) >= bounds.size()) {
+                    bounds.resize(term_id + 1, empty_bound);
+                }
+
+                TermBound& bound = bounds[term_id];
+
+                bound.max_term_frequency = std::max(
+                    bound.max_term_frequency, static_cast<uint32_t>(end - begin));
+                bound.min_document_length = std::min(
+                    bound.min_document_length, length);
+            }
+        }
+    } catch (const lemur::api::Exception& e) {
+        error = e.what().empty() ? "Unable to read term lists." : e.what();
+    }
+
+    delete term_list_it;
+
+    if (error.empty()) {
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            if (bounds[i].max_term_frequency == 0) {
+                bounds[i].min_document_length = 0;
+            }
+        }
+
+        success = write_max_scores(bounds, path);
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+
+        return NULL;
+    }
+
+    if (!success) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path.c_str());
+
+        return NULL;
+    }
+
+    if (!self->term_bounds_->load(path)) {
+        PyErr_SetString(PyExc_IOError, "Max-score file is corrupt or outdated.");
+
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// Feature extraction.
+
+// Features of a (query, candidate document) pair for learning to rank.
+enum Feature {
+    QL_FEATURE,         // Dirichlet-smoothed query likelihood, as wand_query.
+    BM25_FEATURE,       // Okapi BM25, as wand_query.
+    TFIDF_FEATURE,      // Sum of tf * log(N / df) over the query terms.
+    TF_FEATURE,         // Number of occurrences of the query terms.
+    COVERAGE_FEATURE,   // Fraction of the distinct query terms that occur.
+    PROXIMITY_FEATURE,  // Co-occurrences of adjacent query terms within a window.
+    LENGTH_FEATURE      // Document length.
+};
+
+static const struct {
+    const char* name;
+    Feature feature;
+} FEATURES[] = {
+    {"ql", QL_FEATURE},
+    {"bm25", BM25_FEATURE},
+    {"tfidf", TFIDF_FEATURE},
+    {"tf", TF_FEATURE},
+    {"coverage", COVERAGE_FEATURE},
+    {"proximity", PROXIMITY_FEATURE},
+    {"document_length", LENGTH_FEATURE},
+};
+
+static const size_t NUM_FEATURES = sizeof(FEATURES) / sizeof(FEATURES[0]);
+
+// A query and its candidates, whose features fill rows [row, row + |candidates|).
+struct FeatureQuery {
+    std::vector<RetrievalTerm> terms;
+
+    // Index in terms of every query token, in query order.
+    std::vector<size_t> sequence;
+
+    std::vector<lemur::api::DOCID_T> candidates;
+    size_t row;
+};
+
+// Counts the positions in first that lie within window positions of one in
+// second; both are sorted.
+static int count_co_occurrences(const std::vector<int>& first,
+                                const std::vector<int>& second,
+                                const long window) {
+    int count = 0;
+
+    for (size_t i = 0, j = 0; i < first.size(); ++i) {
+        while (j < second.size() && second[j] <= first[i] - window) {
+            ++j;
+        }
+
+        if (j < second.size() && second[j] < first[i] + window) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+// State shared between the worker threads of a single extract_features call.
+struct FeatureExtractionState {
+    std::vector<Feature> features;
+
+    double mu;
+    double k1;
+    double b;
+    long window;
+
+    CollectionStatistics statistics;
+
+    // Document lengths of the statistics sidecar, or NULL.
+    const uint32_t* lengths;
+    lemur::api::DOCID_T document_base;
+
+    WorkQueue* work_queue;
+
+    std::vector<FeatureQuery>* queries;
+    std::vector<float>* matrix;
+    std::vector<std::string>* errors;
+};
+
+struct FeatureExtractionWorker {
+    FeatureExtractionState* state;
+    indri::index::DiskIndex* index;
+};
+
+// Computes the features of the candidates of a query, reading the inverted
+// list of every query term once. Throws lemur::api::Exception on I/O errors.
+static void extract_query_features(const FeatureExtractionState& state,
+                                   indri::index::DiskIndex* const index,
+                                   const FeatureQuery& query,
+                                   std::vector<float>* const matrix) {
+    const size_t num_terms = query.terms.size();
+    const size_t num_candidates = query.candidates.size();
+
+    const bool positional = std::find(state.features.begin(), state.features.end(),
+                                      PROXIMITY_FEATURE) != state.features.end();
+
+    // Candidates in increasing order, such that every inverted list is
+    // read in a single forward pass.
+    std::vector<std::pair<lemur::api::DOCID_T, size_t> > order;
+
+    for (size_t i = 0; i < num_candidates; ++i) {
+        order.push_back(std::make_pair(query.candidates[i], i));
+    }
+
+    std::sort(order.begin(), order.end());
+
+    // Indexed by candidate * num_terms + term.
+    std::vector<int> term_frequencies(num_candidates * num_terms, 0);
+    std::vector<std::vector<int> > positions(positional ? num_candidates * num_terms : 0);
+
+    for (size_t term = 0; term < num_terms; ++term) {
+        if (query.terms[term].term_id <= 0) {
+            continue;
+        }
+
+        indri::index::DocListIterator* const doc_list_it =
+            index->docListIterator(query.terms[term].term_id);
+
+        if (doc_list_it == NULL) {
+            continue;
+        }
+
+        try {
+            doc_list_it->startIteration();
+
+            for (size_t i = 0; i < order.size() && !doc_list_it->finished(); ++i) {
+                if (doc_list_it->currentEntry()->document < order[i].first) {
+                    doc_list_it->nextEntry(order[i].first);
+
+                    if (doc_list_it->finished()) {
+                        break;
+                    }
+                }
+
+                const indri::index::DocListIterator::DocumentData* const entry =
+                    doc_list_it->currentEntry();
+
+                if (entry->document != order[i].first) {
+                    continue;
+                }
+
+                const size_t cell = order[i].second * num_terms + term;
+
+                term_frequencies[cell] = entry->positions.size();
+
+                if (positional) {
+                    positions[cell].assign(entry->positions.begin(), entry->positions.end());
+                }
+            }
+        } catch (const lemur::api::Exception& e) {
+            delete doc_list_it;
+
+            throw;
+        }
+
+        delete doc_list_it;
+    }
+
+    DirichletModel ql(state.mu);
+    ql.prepare(state.statistics, query.terms);
+
+    BM25Model bm25(state.k1, state.b);
+    bm25.prepare(state.statistics, query.terms);
+
+    const size_t num_features = state.features.size();
+
+    std::vector<int> candidate_term_frequencies(num_terms, 0);
+
+    for (size_t i = 0; i < num_candidates; ++i) {
+        const lemur::api::DOCID_T int_document_id = query.candidates[i];
+
+        const int length = state.lengths != NULL ?
+            state.lengths[int_document_id - state.document_base] :
+            index->documentLength(int_document_id);
+
+        std::copy(term_frequencies.begin() + i * num_terms,
+                  term_frequencies.begin() + (i + 1) * num_terms,
+                  candidate_term_frequencies.begin());
+
+        float* const row = &(*matrix)[(query.row + i) * num_features];
+
+        for (size_t f = 0; f < num_features; ++f) {
+            double value = 0.0;
+
+            switch (state.features[f]) {
+                case QL_FEATURE:
+                    value = num_terms > 0 ? ql.score(candidate_term_frequencies, length) : 0.0;
+
+                    break;
+                case BM25_FEATURE:
+                    value = bm25.score(candidate_term_frequencies, length);
+
+                    break;
+                case TFIDF_FEATURE:
+                    for (size_t term = 0; term < num_terms; ++term) {
+                        if (candidate_term_frequencies[term] > 0) {
+                            value += query.terms[term].weight *
+                                candidate_term_frequencies[term] *
+                                log(static_cast<double>(state.statistics.num_documents) /
+                                    query.terms[term].document_frequency);
+                        }
+                    }
+
+                    break;
+                case TF_FEATURE:
+                    for (size_t term = 0; term < num_terms; ++term) {
+                        value += candidate_term_frequencies[term] * query.terms[term].weight;
+                    }
+
+                    break;
+                case COVERAGE_FEATURE:
+                    for (size_t term = 0; term < num_terms; ++term) {
+                        value += candidate_term_frequencies[term] > 0;
+                    }
+
+                    value = num_terms > 0 ? value / num_terms : 0.0;
+
+                    break;
+                case PROXIMITY_FEATURE:
+                    for (size_t j = 1; j < query.sequence.size(); ++j) {
+                        const size_t first = query.sequence[j - 1];
+                        const size_t second = query.sequence[j];
+
+                        if (first != second) {
+                            value += count_co_occurrences(
+                                positions[i * num_terms + first],
+                                positions[i * num_terms + second],
+                                state.window);
+                        }
+                    }
+
+                    break;
+                case LENGTH_FEATURE:
+                    value = length;
+
+                    break;
+            }
+
+            row[f] = value;
+        }
+    }
+}
+
+static void feature_extraction_worker(void* data) {
+    FeatureExtractionWorker* const worker = static_cast<FeatureExtractionWorker*>(data);
+    FeatureExtractionState* const state = worker->state;
+
+    size_t idx;
+    while (state->work_queue->next(&idx)) {
+        try {
+            extract_query_features(*state, worker->index,
+                                   (*state->queries)[idx], state->matrix);
+        } catch (const lemur::api::Exception& e) {
+            (*state->errors)[idx] = e.what();
+
+            // Guarantee that an empty message still flags the failure.
+            if ((*state->errors)[idx].empty()) {
+                (*state->errors)[idx] = "Unable to read inverted lists.";
+            }
+        }
+    }
+}
+
+// Reads the names of the features to extract. Sets an exception and returns
+// false on failure.
+static bool read_features(PyObject* const names, std::vector<Feature>* const features) {
+    std::vector<std::string> feature_names;
+
+    if (PyUnicode_Check(names)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a sequence of feature names.");
+
+        return false;
+    }
+
+    if (!read_strings(names, &feature_names)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < feature_names.size(); ++i) {
+        size_t j = 0;
+
+        while (j < NUM_FEATURES && feature_names[i] != FEATURES[j].name) {
+            ++j;
+        }
+
+        if (j == NUM_FEATURES) {
+            PyErr_Format(PyExc_ValueError, "Unknown feature %s.", feature_names[i].c_str());
+
+            return false;
+        }
+
+        features->push_back(FEATURES[j].feature);
+    }
+
+    return true;
+}
+
+static PyObject* Index_extract_features(Index* self, PyObject* args, PyObject* kwds) {
+    if (!require_components(self, INDEX_COMPONENT)) {
+        return NULL;
+    }
+
+    PyObject* queries_object;
+    PyObject* candidates_object;
+    PyObject* features_object = NULL;
+    double mu = 2500.0;
+    double k1 = 1.2;
+    double b = 0.75;
+    long window = 8;
+    long num_threads = 0;
+
+    static char* kwlist[] = {"queries",
+                             "candidates",
+                             "features",
+                             "mu",
+                             "k1",
+                             "b",
+                             "window",
+                             "num_threads",
+                             NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|Odddll", kwlist,
+                                     &queries_object,
+                                     &candidates_object,
+                                     &features_object,
+                                     &mu, &k1, &b,
+                                     &window,
+                                     &num_threads)) {
+        return NULL;
+    }
+
+    FeatureExtractionState state;
+
+    if (features_object == NULL) {
+        for (size_t i = 0; i < NUM_FEATURES; ++i) {
+            state.features.push_back(FEATURES[i].feature);
+        }
+    } else if (!read_features(features_object, &state.features)) {
+        return NULL;
+    }
+
+    if (mu <= 0.0 || k1 < 0.0 || b < 0.0 || b > 1.0 || window <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "mu and window should be strictly positive, "
+                        "k1 non-negative and b within [0, 1].");
+
+        return NULL;
+    }
+
+    std::vector<std::string> query_strs;
+
+    if (!read_strings(queries_object, &query_strs)) {
+        return NULL;
+    }
+
+    PyObject* const iterator = PyObject_GetIter(candidates_object);
+
+    if (iterator == NULL) {
+        return NULL;
+    }
+
+    // Tokenize and resolve every query up front, as the GIL is released
+    // during the extraction.
+    std::vector<FeatureQuery> queries;
+    size_t num_rows = 0;
+
+    PyObject* item;
+    while ((item = PyIter_Next(iterator))) {
+        if (queries.size() == query_strs.size()) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Expected a sequence of candidates for every query.");
+
+            Py_DECREF(item);
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+
+        queries.push_back(FeatureQuery());
+        FeatureQuery& query = queries.back();
+
+        std::vector<int64_t> candidates;
+        const bool success = read_integers(item, &candidates);
+        Py_DECREF(item);
 
-    indri::api::Parameters* parameters_;
+        if (!success) {
+            Py_DECREF(iterator);
 
-    indri::collection::CompressedCollection* collection_;
-    indri::index::DiskIndex* index_;
+            return NULL;
+        }
 
-    indri::api::QueryEnvironment* query_env_;
-} Index;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (candidates[i] < self->index_->documentBase() ||
+                candidates[i] >= self->index_->documentMaximum()) {
+                PyErr_SetString(
+                    PyExc_IndexError,
+                    "Specified internal document identifier is out of bounds.");
 
-static void Index_dealloc(Index* self) {
-    // self->collection_->close();
-    self->index_->close();
-    // self->query_env_->close();
+                Py_DECREF(iterator);
 
-    delete self->parameters_;
+                return NULL;
+            }
+        }
 
-    // delete self->collection_;
-    delete self->index_;
-    delete self->query_env_;
-}
+        query.candidates.assign(candidates.begin(), candidates.end());
+        query.row = num_rows;
 
-static PyObject* Index_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
-    Index* self;
+        num_rows += candidates.size();
 
-    self = (Index*) type->tp_alloc(type, 0);
-    if (self != NULL) {
-        self->parameters_ = new indri::api::Parameters;
+        std::vector<std::string> terms;
 
-        self->collection_ = new indri::collection::CompressedCollection;
-        self->index_ = new indri::index::DiskIndex;
+        if (!tokenize_query(self, query_strs[queries.size() - 1], &terms)) {
+            Py_DECREF(iterator);
+
+            return NULL;
+        }
+
+        resolve_terms(self, terms, std::vector<double>(terms.size(), 1.0), &query.terms);
+
+        // resolve_terms keeps the terms in order of first occurrence.
+        std::map<std::string, size_t> positions;
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const size_t position = positions.size();
 
-        self->query_env_ = new indri::api::QueryEnvironment;
+            query.sequence.push_back(
+                positions.insert(std::make_pair(terms[i], position)).first->second);
+        }
     }
 
-    return (PyObject*) self;
-}
+    Py_DECREF(iterator);
 
-static int Index_init(Index* self, PyObject* args, PyObject* kwds) {
-    char* repository_path = "";
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
 
-    static char* kwlist[] = {"repository_path", NULL};
+    if (queries.size() != query_strs.size()) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Expected a sequence of candidates for every query.");
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist,
-                                     &repository_path)) {
-        return -1;
+        return NULL;
     }
 
-    // Load parameters.
-    self->parameters_->loadFile(indri::file::Path::combine(repository_path, "manifest"));
+    if (num_threads <= 0) {
+        num_threads = default_num_threads();
+    }
+
+    num_threads = std::max(
+        std::min(static_cast<size_t>(num_threads), queries.size()), static_cast<size_t>(1));
+
+    std::vector<float> matrix(num_rows * state.features.size(), 0.0f);
+    std::vector<std::string> errors(queries.size());
+
+    WorkQueue work_queue(queries.size());
 
-    const std::string collection_path =
-        indri::file::Path::combine(repository_path, "collection");
+    state.mu = mu;
+    state.k1 = k1;
+    state.b = b;
+    state.window = window;
+    state.statistics.num_documents = self->index_->documentCount();
+    state.statistics.total_terms = self->index_->termCount();
+    state.lengths = shared_document_lengths(self);
+    state.document_base = self->index_->documentBase();
+    state.work_queue = &work_queue;
+    state.queries = &queries;
+    state.matrix = &matrix;
+    state.errors = &errors;
 
+    std::vector<FeatureExtractionWorker> workers;
+    std::string open_error;
+
+    Py_BEGIN_ALLOW_THREADS
+
+    // Every worker reads its inverted lists through its own DiskIndex.
     try {
-        self->collection_->open(collection_path);
+        for (long i = 0; i < num_threads; ++i) {
+            FeatureExtractionWorker worker;
+            worker.state = &state;
+            worker.index = self->index_pool_->acquire();
+
+            workers.push_back(worker);
+        }
     } catch (const lemur::api::Exception& e) {
-        PyErr_SetString(PyExc_IOError, e.what().c_str());
+        open_error = e.what().empty() ? "Unable to open index." : e.what();
+    }
 
-        return -1;
+    if (open_error.empty()) {
+        run_threads(feature_extraction_worker, &workers);
     }
 
-    // Load index.
-    std::string index_path = "index";
+    for (size_t i = 0; i < workers.size(); ++i) {
+        self->index_pool_->release(workers[i].index);
+    }
 
-    indri::api::Parameters container = (*self->parameters_)["indexes"];
+    Py_END_ALLOW_THREADS
 
-    if(container.exists("index")) {
-        indri::api::Parameters indexes = container["index"];
+    if (!open_error.empty()) {
+        PyErr_SetString(PyExc_IOError, open_error.c_str());
 
-        if (indexes.size() != 1) {
-            PyErr_SetString(PyExc_IOError, "Indri repository contain more than one index.");
+        return NULL;
+    }
 
-            return -1;
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            PyErr_Format(PyExc_IOError, "Query %zu failed: %s", i, errors[i].c_str());
+
+            return NULL;
         }
+    }
 
-        index_path = indri::file::Path::combine(
-            index_path, (std::string) indexes[static_cast<size_t>(0)]);
-    } else {
-        PyErr_SetString(PyExc_IOError, "Indri repository does not contain an index.");
+    return Array_from_matrix(&matrix, num_rows, state.features.size());
+}
 
-        return -1;
+static PyObject* Index_document_cache_stats(Index* self) {
+    if (!Index_reset_after_fork(self)) {
+        return NULL;
     }
 
-    try {
-        self->index_->open(repository_path, index_path);
-    } catch (const lemur::api::Exception& e) {
-        PyErr_SetString(PyExc_IOError, e.what().c_str());
+    size_t capacity;
+    size_t size;
+    uint64_t hits;
+    uint64_t misses;
 
-        return -1;
+    self->document_cache_->statistics(&capacity, &size, &hits, &misses);
+
+    return Py_BuildValue("{s:n,s:n,s:K,s:K}",
+                         "capacity", static_cast<Py_ssize_t>(capacity),
+                         "size", static_cast<Py_ssize_t>(size),
+                         "hits", static_cast<unsigned long long>(hits),
+                         "misses", static_cast<unsigned long long>(misses));
+}
+
+static PyObject* Index_result_cache_stats(Index* self) {
+    if (!Index_reset_after_fork(self)) {
+        return NULL;
     }
 
-    try {
-        self->query_env_->addIndex(repository_path);
-    } catch (const lemur::api::Exception& e) {
-        PyErr_SetString(PyExc_IOError, e.what().c_str());
+    size_t capacity;
+    size_t size;
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    self->result_cache_->statistics(
+        &capacity, &size, &entries, &hits, &misses, &evictions);
+
+    return Py_BuildValue("{s:n,s:n,s:n,s:K,s:K,s:K}",
+                         "capacity", static_cast<Py_ssize_t>(capacity),
+                         "bytes", static_cast<Py_ssize_t>(size),
+                         "entries", static_cast<Py_ssize_t>(entries),
+                         "hits", static_cast<unsigned long long>(hits),
+                         "misses", static_cast<unsigned long long>(misses),
+                         "evictions", static_cast<unsigned long long>(evictions));
+}
 
-        return -1;
+static PyObject* Index_clear_result_cache(Index* self) {
+    if (!Index_reset_after_fork(self)) {
+        return NULL;
     }
 
-    return 0;
+    self->result_cache_->clear();
+
+    Py_RETURN_NONE;
 }
 
-static PyMemberDef Index_members[] = {
-    {NULL}  /* Sentinel */
-};
+static PyObject* Index_set_instrumentation(Index* self, PyObject* args) {
+    if (!Index_reset_after_fork(self)) {
+        return NULL;
+    }
 
-static PyObject* Index_get_document_ids(Index* self, PyObject* args) {
-    PyObject* external_doc_ids = NULL;
+    int enabled = true;
 
-    if (!PyArg_ParseTuple(args, "O", &external_doc_ids)) {
+    if (!PyArg_ParseTuple(args, "|p", &enabled)) {
         return NULL;
     }
 
-    if (external_doc_ids == NULL) {
+    self->instrumentation_->set_enabled(enabled);
+
+    Py_RETURN_NONE;
+}
+
+// Returns {"enabled": bool, "phases": {phase: {"calls": int, "seconds":
+// float}}, "counters": {counter: int}}.
+static PyObject* Index_instrumentation_stats(Index* self) {
+    if (!Index_reset_after_fork(self)) {
         return NULL;
     }
 
-    PyObject* const iterator = PyObject_GetIter(external_doc_ids);
-    PyObject *item;
+    uint64_t calls[NUM_PHASES];
+    double seconds[NUM_PHASES];
+    uint64_t counters[NUM_COUNTERS];
 
-    if (iterator == NULL) {
-        PyErr_SetString(
-            PyExc_TypeError,
-            "Passed object is not iterable.");
+    self->instrumentation_->statistics(calls, seconds, counters);
 
-        Py_DECREF(iterator);
+    PyObject* const phases = PyDict_New();
+
+    for (size_t i = 0; i < NUM_PHASES; ++i) {
+        PyObject* const phase = Py_BuildValue(
+            "{s:K,s:d}",
+            "calls", static_cast<unsigned long long>(calls[i]),
+            "seconds", seconds[i]);
+
+        PyDict_SetItemString(phases, PHASE_NAMES[i], phase);
+        Py_DECREF(phase);
+    }
+
+    PyObject* const counters_dict = PyDict_New();
+
+    for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+        PyObject* const value = PyLong_FromUnsignedLongLong(counters[i]);
+
+        PyDict_SetItemString(counters_dict, COUNTER_NAMES[i], value);
+        Py_DECREF(value);
+    }
 
+    return Py_BuildValue("{s:O,s:N,s:N}",
+                         "enabled", self->instrumentation_->enabled() ? Py_True : Py_False,
+                         "phases", phases,
+                         "counters", counters_dict);
+}
+
+static PyObject* Index_reset_instrumentation(Index* self) {
+    if (!Index_reset_after_fork(self)) {
         return NULL;
     }
 
-    std::vector<std::string> ext_document_ids;
+    self->instrumentation_->reset();
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef Index_methods[] = {
+    {"document_ids", (PyCFunction) Index_get_document_ids, METH_VARARGS,
+     "Returns the internal DOC_IDs given the external identifiers."},
+    {"resolve_document_ids", (PyCFunction) Index_resolve_document_ids, METH_VARARGS,
+     "Returns the internal DOC_IDs of a sequence of external identifiers as an "
+     "int32 Array, with -1 for unknown identifiers."},
+    {"docnos", (PyCFunction) Index_docnos, METH_VARARGS,
+     "Returns the external identifiers of a sequence of documents as a "
+     "(blob, offsets) pair; identifier i is blob[offsets[i]:offsets[i + 1]]."},
+    {"all_docnos", (PyCFunction) Index_all_docnos, METH_NOARGS,
+     "Returns the external identifiers of all documents as a "
+     "(blob, offsets) pair."},
+    {"share", (PyCFunction) Index_share, METH_NOARGS,
+     "Writes the docno table, dictionary snapshot and statistics sidecars "
+     "that are missing or outdated, and memory-maps them."},
+    {"__reduce__", (PyCFunction) Index_reduce, METH_NOARGS,
+     "Pickles the index by its repository path and constructor arguments."},
+    {"build_docno_table", (PyCFunction) Index_build_docno_table, METH_NOARGS,
+     "Writes a sorted docno table to the repository, such that external "
+     "identifiers are resolved without querying the collection."},
+    {"document", (PyCFunction) Index_document, METH_VARARGS,
+     "Return a document (ext_document_id, terms) pair."},
+    {"document_array", (PyCFunction) Index_document_array, METH_VARARGS,
+     "Return a document (ext_document_id, terms) pair, "
+     "with terms an int32 Array."},
+    {"document_range", (PyCFunction) Index_document_range, METH_VARARGS,
+     "Return the (terms, offsets) Arrays of the documents within a range of "
+     "internal identifiers; document i spans terms[offsets[i]:offsets[i + 1]]."},
+    {"document_vector", (PyCFunction) Index_document_vector, METH_VARARGS,
+     "Return the (terms, field_ids, begins, ends) Arrays of a document; field "
+     "i spans terms[begins[i]:ends[i]]."},
+    {"document_vectors", (PyCFunction) Index_document_vectors, METH_VARARGS,
+     "Return the (terms, term_offsets, field_ids, begins, ends, field_offsets) "
+     "Arrays of the documents; document i spans "
+     "terms[term_offsets[i]:term_offsets[i + 1]] and its fields "
+     "field_ids[field_offsets[i]:field_offsets[i + 1]]."},
+    {"document_vector_range", (PyCFunction) Index_document_vector_range, METH_VARARGS,
+     "Return the document vectors, as document_vectors does, of the documents "
+     "within a range of internal identifiers."},
+    {"field_names", (PyCFunction) Index_field_names, METH_NOARGS,
+     "Return the names of the indexed fields, keyed by field identifier."},
+    {"to_csr", (PyCFunction) Index_to_csr, METH_VARARGS | METH_KEYWORDS,
+     "Returns the document-term matrix of a range of documents as the "
+     "(data, indices, indptr) Arrays of a CSR matrix, with a row per "
+     "document and a column per term identifier."},
+    {"doc2bow", (PyCFunction) Index_doc2bow, METH_VARARGS,
+     "Returns the sorted (term_ids, counts) Arrays of a document, given as raw "
+     "text (tokenized by Indri's TextTokenizer) or as a sequence of tokens; "
+     "tokens are stemmed as the index was and out-of-vocabulary tokens are "
+     "skipped."},
+    {"batch_doc2bow", (PyCFunction) Index_batch_doc2bow, METH_VARARGS | METH_KEYWORDS,
+     "Converts many documents in parallel, as doc2bow does, and returns the "
+     "(data, indices, indptr) Arrays of a CSR matrix."},
+    {"iter_documents", (PyCFunction) Index_iter_documents, METH_VARARGS | METH_KEYWORDS,
+     "Iterate sequentially over the (int_document_id, terms) pairs within a "
+     "range of internal identifiers, while prefetching in the background."},
+    {"document_base", (PyCFunction) Index_document_base, METH_NOARGS,
+     "Returns the lower bound document identifier (inclusive)."},
+    {"maximum_document", (PyCFunction) Index_maximum_document, METH_NOARGS,
+     "Returns the upper bound document identifier (exclusive)."},
+
+    {"document_count", (PyCFunction) Index_document_count, METH_NOARGS,
+     "Returns the number of documents in the index."},
+    {"document_length", (PyCFunction) Index_document_length, METH_VARARGS,
+     "Returns the length of a document."},
+    {"document_lengths", (PyCFunction) Index_document_lengths, METH_VARARGS,
+     "Returns the lengths of a sequence of documents as an int32 Array."},
+    {"all_document_lengths", (PyCFunction) Index_all_document_lengths, METH_NOARGS,
+     "Returns the lengths of all documents, from the document base, as a uint32 Array."},
+    {"collection_statistics", (PyCFunction) Index_collection_statistics, METH_NOARGS,
+     "Returns the number of documents, total and unique terms, and average document length."},
+    {"document_frequencies", (PyCFunction) Index_document_frequencies, METH_VARARGS,
+     "Returns the document frequencies of term identifiers (or of all, indexed by identifier) as a uint64 Array."},
+    {"collection_frequencies", (PyCFunction) Index_collection_frequencies, METH_VARARGS,
+     "Returns the collection frequencies of term identifiers (or of all, indexed by identifier) as a uint64 Array."},
+    {"build_statistics", (PyCFunction) Index_build_statistics, METH_NOARGS,
+     "Writes the statistics sidecar (document lengths, frequencies and totals) of the repository."},
+    {"document_length_statistics", (PyCFunction) Index_document_length_statistics,
+     METH_VARARGS | METH_KEYWORDS,
+     "Returns the moments and histogram of the document lengths in the index."},
 
-    while (item = PyIter_Next(iterator)) {
-        CHECK(PyUnicode_CheckExact(item));
+    {"total_terms", (PyCFunction) Index_total_terms, METH_NOARGS,
+     "Returns the number of total terms in the index."},
+    {"unique_terms", (PyCFunction) Index_unique_terms, METH_NOARGS,
+     "Returns the number of unique terms in the index."},
 
-        PyObject* item_bytes = PyUnicode_AsEncodedString(item, ENCODING, "strict");
-        char* const ext_document_id = PyBytes_AsString(item_bytes);
+    {"term_count", (PyCFunction) Index_term_count, METH_VARARGS,
+     "Return the term frequency for a term."},
+    {"term_counts", (PyCFunction) Index_term_counts, METH_VARARGS,
+     "Return the term frequencies of a sequence of terms as a uint64 Array."},
 
-        // Create a copy of the string.
-        ext_document_ids.push_back(ext_document_id);
+    {"query", (PyCFunction) Index_run_query, METH_VARARGS | METH_KEYWORDS,
+     "Queries an Indri index."},
+    {"result_cache_stats", (PyCFunction) Index_result_cache_stats, METH_NOARGS,
+     "Returns the capacity and size (in bytes), entries, hits, misses and "
+     "evictions of the query result cache."},
+    {"clear_result_cache", (PyCFunction) Index_clear_result_cache, METH_NOARGS,
+     "Removes all entries from the query result cache."},
+    {"document_cache_stats", (PyCFunction) Index_document_cache_stats, METH_NOARGS,
+     "Returns the capacity, size, hits and misses of the cache of "
+     "decompressed documents used to build snippets."},
+    {"set_instrumentation", (PyCFunction) Index_set_instrumentation, METH_VARARGS,
+     "Enables (default) or disables the per-phase timers and counters."},
+    {"instrumentation_stats", (PyCFunction) Index_instrumentation_stats, METH_NOARGS,
+     "Returns the per-phase timers and counters recorded while enabled."},
+    {"reset_instrumentation", (PyCFunction) Index_reset_instrumentation, METH_NOARGS,
+     "Resets the per-phase timers and counters to zero."},
+    {"aquery", (PyCFunction) Index_aquery, METH_VARARGS | METH_KEYWORDS,
+     "Queries an Indri index on a native worker pool; returns an asyncio "
+     "future of the results. Cancelling it skips the work not yet started."},
+    {"adocuments", (PyCFunction) Index_adocuments, METH_VARARGS,
+     "Returns an asyncio future of the (ext_document_id, terms) pairs of the "
+     "internal document identifiers, read on a native worker pool."},
+    {"batch_query", (PyCFunction) Index_batch_query, METH_VARARGS | METH_KEYWORDS,
+     "Queries an Indri index with many queries in parallel."},
+    {"wand_query", (PyCFunction) Index_wand_query, METH_VARARGS | METH_KEYWORDS,
+     "Returns the top-k documents of a bag-of-words query under Dirichlet "
+     "or BM25 scoring, evaluated with dynamic pruning (WAND)."},
+    {"rm3_query", (PyCFunction) Index_rm3_query, METH_VARARGS | METH_KEYWORDS,
+     "Returns the top-k documents of a bag-of-words query expanded with RM3 "
+     "pseudo-relevance feedback, and the expansion terms with their weights."},
+    {"build_max_scores", (PyCFunction) Index_build_max_scores, METH_NOARGS,
+     "Writes the per-term score bounds used by wand_query to the repository."},
+    {"extract_features", (PyCFunction) Index_extract_features, METH_VARARGS | METH_KEYWORDS,
+     "Computes learning-to-rank features of candidate documents for a batch of queries; returns a float32 matrix Array with a row per candidate and a column per feature."},
+
+    {"postings", (PyCFunction) Index_postings, METH_VARARGS | METH_KEYWORDS,
+     "Returns the (int_document_ids, tfs) Arrays of the inverted list of a "
+     "term; with include_positions, the (positions, position_offsets) "
+     "Arrays are appended."},
+    {"posting_iterator", (PyCFunction) Index_posting_iterator, METH_VARARGS,
+     "Returns a lazy PostingIterator over the inverted list of a term."},
 
-        Py_DECREF(item_bytes);
-        Py_DECREF(item);
+    {"get_dictionary", (PyCFunction) Index_get_dictionary, METH_NOARGS,
+     "Extracts the dictionary from the index."},
+    {"vocabulary", (PyCFunction) Index_vocabulary, METH_NOARGS,
+     "Returns the terms (as a blob and int64 offsets), document and collection frequencies, all indexed by term identifier, in a single scan."},
+    {"get_term_frequencies", (PyCFunction) Index_get_term_frequencies, METH_NOARGS,
+     "Extracts the term frequencies from the index."},
+    {"export_dictionary", (PyCFunction) Index_export_dictionary, METH_VARARGS,
+     "Writes a memory-mappable snapshot of the dictionary to a file."},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject IndexType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pyndri.Index",             /* tp_name */
+    sizeof(Index),             /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) Index_dealloc, /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
+    "Index objects",           /* tp_doc */
+    0,                   /* tp_traverse */
+    0,                   /* tp_clear */
+    0,                   /* tp_richcompare */
+    0,                   /* tp_weaklistoffset */
+    0,                   /* tp_iter */
+    0,                   /* tp_iternext */
+    Index_methods,             /* tp_methods */
+    Index_members,             /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc) Index_init,      /* tp_init */
+    0,                         /* tp_alloc */
+    Index_new,                 /* tp_new */
+};
+
+// ShardedIndex
+
+// Documents partitioned over several repositories (shards), each opened as
+// an Index. Bag-of-words queries are evaluated on every shard in parallel
+// under the collection statistics of the union of the shards, such that
+// scores are comparable across shards. Documents are identified by
+// (shard, int_document_id) pairs.
+typedef struct {
+    PyObject_HEAD
+
+    // Owned references.
+    std::vector<Index*>* shards_;
+
+    // See Index::initialized_.
+    bool initialized_;
+} ShardedIndex;
+
+static void ShardedIndex_clear_shards(ShardedIndex* self) {
+    for (size_t i = 0; i < self->shards_->size(); ++i) {
+        Py_DECREF((*self->shards_)[i]);
     }
 
-    Py_DECREF(iterator);
+    self->shards_->clear();
+}
 
-    std::vector<lemur::api::DOCID_T> int_doc_ids;
+static void ShardedIndex_dealloc(ShardedIndex* self) {
+    ShardedIndex_clear_shards(self);
 
-    try {
-        int_doc_ids = self->query_env_->documentIDsFromMetadata("docno", ext_document_ids);
-    } catch (const lemur::api::Exception& e) {
-        PyErr_SetString(PyExc_IOError, e.what().c_str());
+    delete self->shards_;
 
-        return NULL;
+    Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+static PyObject* ShardedIndex_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    ShardedIndex* const self = (ShardedIndex*) type->tp_alloc(type, 0);
+
+    if (self != NULL) {
+        self->shards_ = new std::vector<Index*>;
+        self->initialized_ = false;
     }
 
-    PyObject* const doc_ids_tuple = PyTuple_New(int_doc_ids.size());
+    return (PyObject*) self;
+}
 
-    Py_ssize_t pos = 0;
-    for (std::vector<lemur::api::DOCID_T>::iterator int_doc_ids_it = int_doc_ids.begin();
-         int_doc_ids_it != int_doc_ids.end();
-         ++int_doc_ids_it, ++pos) {
-        const lemur::api::DOCID_T int_document_id = *int_doc_ids_it;
+// Takes a sequence of repository paths, opened as Index(path, **kwds), or
+// of Index objects.
+static int ShardedIndex_init(ShardedIndex* self, PyObject* args, PyObject* kwds) {
+    PyObject* shards;
+
+    if (!PyArg_ParseTuple(args, "O", &shards)) {
+        return -1;
+    }
 
-        std::string ext_document_id;
+    if (__atomic_exchange_n(&self->initialized_, true, __ATOMIC_ACQ_REL)) {
+        PyErr_SetString(PyExc_RuntimeError, "ShardedIndex is already initialized.");
 
-        try {
-            ext_document_id = self->collection_->retrieveMetadatum(int_document_id, "docno");
-        } catch (const lemur::api::Exception& e) {
-            PyErr_SetString(PyExc_IOError, e.what().c_str());
+        return -1;
+    }
 
-            Py_DECREF(doc_ids_tuple);
+    PyObject* const iterator = PyObject_GetIter(shards);
 
-            return NULL;
+    if (iterator == NULL) {
+        return -1;
+    }
+
+    PyObject* item;
+    while ((item = PyIter_Next(iterator))) {
+        PyObject* shard = item;
+
+        if (PyObject_TypeCheck(item, &IndexType)) {
+            Py_INCREF(shard);
+        } else {
+            PyObject* const shard_args = PyTuple_Pack(1, item);
+
+            shard = shard_args != NULL ?
+                PyObject_Call((PyObject*) &IndexType, shard_args, kwds) : NULL;
+
+            Py_XDECREF(shard_args);
         }
 
-        PyTuple_SetItem(doc_ids_tuple,
-                        pos,
-                        PyTuple_Pack(2,
-                            PyUnicode_Decode(ext_document_id.c_str(),
-                                             ext_document_id.size(),
-                                             ENCODING,
-                                             "strict"),
-                            PyLong_FromLong(int_document_id)));
+        Py_DECREF(item);
+
+        if (shard == NULL) {
+            Py_DECREF(iterator);
+
+            return -1;
+        }
+
+        self->shards_->push_back((Index*) shard);
     }
 
-    return doc_ids_tuple;
-}
+    Py_DECREF(iterator);
 
-static PyObject* Index_document(Index* self, PyObject* args) {
-    int int_document_id;
+    if (PyErr_Occurred()) {
+        return -1;
+    }
 
-    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
-        return NULL;
+    if (self->shards_->empty()) {
+        PyErr_SetString(PyExc_ValueError, "Expected at least one shard.");
+
+        return -1;
     }
 
-    if (int_document_id < self->index_->documentBase() ||
-        int_document_id >= self->index_->documentMaximum()) {
-        PyErr_SetString(
-            PyExc_IndexError,
-            "Specified internal document identifier is out of bounds.");
+    // Queries are tokenized once, for all shards.
+    for (size_t i = 1; i < self->shards_->size(); ++i) {
+        if (*(*self->shards_)[i]->stemmer_ != *(*self->shards_)[0]->stemmer_) {
+            PyErr_SetString(PyExc_ValueError, "Shards should share a stemmer.");
+
+            return -1;
+        }
+
+        if (*(*self->shards_)[i]->stopwords_ != *(*self->shards_)[0]->stopwords_) {
+            PyErr_SetString(PyExc_ValueError, "Shards should share a stopper.");
 
-        return NULL;
+            return -1;
+        }
     }
 
-    string ext_document_id;
-    const indri::index::TermList* term_list = 0;
+    return 0;
+}
 
-    try {
-        ext_document_id = self->collection_->retrieveMetadatum(
-            int_document_id, "docno");
-        term_list = self->index_->termList(int_document_id);
-    } catch (const lemur::api::Exception& e) {
-        PyErr_SetString(PyExc_IOError, e.what().c_str());
+// Returns the shard of a (shard, int_document_id) pair, or sets an exception
+// and returns NULL.
+static Index* route_document(ShardedIndex* self,
+                             PyObject* const document,
+                             long* const int_document_id) {
+    Py_ssize_t shard;
 
-        if (term_list != 0) {
-            delete term_list;
-        }
+    if (!PyTuple_Check(document) ||
+        !PyArg_ParseTuple(document, "nl", &shard, int_document_id)) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError,
+                        "Expected a (shard, int_document_id) pair.");
 
         return NULL;
     }
 
-    PyObject* terms = PyTuple_New(term_list->terms().size());
-
-    indri::utility::greedy_vector<lemur::api::TERMID_T>::const_iterator term_it =
-        term_list->terms().begin();
+    if (shard < 0 || static_cast<size_t>(shard) >= self->shards_->size()) {
+        PyErr_SetString(PyExc_IndexError, "Specified shard is out of bounds.");
 
-    Py_ssize_t pos = 0;
-    for (; term_it != term_list->terms().end(); ++term_it, ++pos) {
-        PyTuple_SetItem(terms, pos, PyLong_FromLong(*term_it));
+        return NULL;
     }
 
-    delete term_list;
-
-    return PyTuple_Pack(
-        2,
-        PyUnicode_Decode(ext_document_id.c_str(),
-                         ext_document_id.size(),
-                         ENCODING,
-                         "strict"),
-        terms);
+    return (*self->shards_)[shard];
 }
 
-static PyObject* Index_document_base(Index* self) {
-    return PyLong_FromLong(self->index_->documentBase());
-}
+static PyObject* ShardedIndex_shards(ShardedIndex* self) {
+    PyObject* const shards = PyTuple_New(self->shards_->size());
 
-static PyObject* Index_maximum_document(Index* self) {
-    return PyLong_FromLong(self->index_->documentMaximum());
-}
+    for (size_t i = 0; i < self->shards_->size(); ++i) {
+        Py_INCREF((*self->shards_)[i]);
+        PyTuple_SetItem(shards, i, (PyObject*) (*self->shards_)[i]);
+    }
 
-static PyObject* Index_document_count(Index* self) {
-    return PyLong_FromLong(self->index_->documentCount());
+    return shards;
 }
 
-static PyObject* Index_total_terms(Index* self) {
-    return PyLong_FromLong(self->index_->termCount());
+static PyObject* ShardedIndex_reduce(ShardedIndex* self) {
+    return Py_BuildValue("(O(N))", Py_TYPE(self), ShardedIndex_shards(self));
 }
 
-static PyObject* Index_unique_terms(Index* self) {
-    return PyLong_FromLong(self->index_->uniqueTermCount());
-}
+static PyObject* ShardedIndex_document(ShardedIndex* self, PyObject* args) {
+    PyObject* document;
 
-static PyObject* Index_term_count(Index* self, PyObject* args) {
-    char* term_object;
+    if (!PyArg_ParseTuple(args, "O", &document)) {
+        return NULL;
+    }
 
-    if (!PyArg_ParseTuple(args, "s", &term_object)) {
+    long int_document_id;
+    Index* const shard = route_document(self, document, &int_document_id);
+
+    if (shard == NULL) {
         return NULL;
     }
 
-    return PyLong_FromLong(self->index_->termCount(term_object));
+    return PyObject_CallMethod((PyObject*) shard, "document", "l", int_document_id);
 }
 
-static PyObject* Index_document_length(Index* self, PyObject* args) {
-    int int_document_id;
+static PyObject* ShardedIndex_document_length(ShardedIndex* self, PyObject* args) {
+    PyObject* document;
 
-    if (!PyArg_ParseTuple(args, "i", &int_document_id)) {
+    if (!PyArg_ParseTuple(args, "O", &document)) {
         return NULL;
     }
 
-    return PyLong_FromLong(self->index_->documentLength(int_document_id));
-}
+    long int_document_id;
+    Index* const shard = route_document(self, document, &int_document_id);
 
-static PyObject* Index_run_query(Index* self, PyObject* args, PyObject* kwds) {
-    PyObject* query = NULL;
-    PyObject* document_set = NULL;
-    long results_requested = 0;
-    bool include_snippets = false;
+    if (shard == NULL) {
+        return NULL;
+    }
 
-    static char* kwlist[] = {"query_str",
-                             "document_set",
-                             "results_requested",
-                             "include_snippets",
-                             NULL};
+    return PyObject_CallMethod((PyObject*) shard, "document_length", "l", int_document_id);
+}
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "U|Olb", kwlist,
-                                     &query,
-                                     &document_set,
-                                     &results_requested,
-                                     &include_snippets)) {
+// Returns (ext_document_id, (shard, int_document_id)) pairs, by shard.
+static PyObject* ShardedIndex_document_ids(ShardedIndex* self, PyObject* args) {
+    PyObject* external_doc_ids;
+
+    if (!PyArg_ParseTuple(args, "O", &external_doc_ids)) {
         return NULL;
     }
 
-    CHECK(PyUnicode_Check(query));
+    // The identifiers are read once, as they may be given by an iterator.
+    PyObject* const ext_document_ids = PySequence_Tuple(external_doc_ids);
 
-    PyObject* query_bytes = PyUnicode_AsEncodedString(query, ENCODING, "strict");
-    char* query_str = PyBytes_AsString(query_bytes);
+    if (ext_document_ids == NULL) {
+        return NULL;
+    }
 
-    std::vector<lemur::api::DOCID_T> document_ids;
+    PyObject* const results = PyList_New(0);
 
-    if (document_set != NULL) {
-        CHECK(PyIter_Check(document_set));
+    if (results == NULL) {
+        Py_DECREF(ext_document_ids);
 
-        PyObject* const iterator = PyObject_GetIter(document_set);
-        PyObject *item;
+        return NULL;
+    }
 
-        if (iterator == NULL) {
-            PyErr_SetString(
-                PyExc_TypeError,
-                "Passed object for document_set not iterable.");
+    for (size_t i = 0; i < self->shards_->size(); ++i) {
+        PyObject* const shard_results = PyObject_CallMethod(
+            (PyObject*) (*self->shards_)[i], "document_ids", "O", ext_document_ids);
 
-            Py_DECREF(iterator);
-            Py_DECREF(query_bytes);
+        if (shard_results == NULL) {
+            Py_DECREF(ext_document_ids);
+            Py_DECREF(results);
 
             return NULL;
         }
 
-        while (item = PyIter_Next(iterator)) {
-            CHECK(PyLong_CheckExact(item));
+        for (Py_ssize_t j = 0; j < PyTuple_GET_SIZE(shard_results); ++j) {
+            PyObject* ext_document_id;
+            long int_document_id;
 
-            const lemur::api::DOCID_T int_doc_id = PyLong_AsLong(item);
-            if (int_doc_id < 0) {
-                continue;
+            if (!PyArg_ParseTuple(PyTuple_GET_ITEM(shard_results, j), "Ol",
+                                  &ext_document_id, &int_document_id)) {
+                Py_DECREF(shard_results);
+                Py_DECREF(ext_document_ids);
+                Py_DECREF(results);
+
+                return NULL;
             }
 
-            document_ids.push_back(int_doc_id);
+            PyObject* const result = Py_BuildValue(
+                "(O(nl))", ext_document_id, static_cast<Py_ssize_t>(i), int_document_id);
 
-            Py_DECREF(item);
-        }
+            if (result == NULL || PyList_Append(results, result) < 0) {
+                Py_XDECREF(result);
+                Py_DECREF(shard_results);
+                Py_DECREF(ext_document_ids);
+                Py_DECREF(results);
 
-        Py_DECREF(iterator);
-    }
+                return NULL;
+            }
 
-    if (results_requested <= 0) {
-        if (document_set != NULL) {
-            results_requested = document_ids.size();
-        } else {
-            results_requested = 100;
+            Py_DECREF(result);
         }
+
+        Py_DECREF(shard_results);
     }
 
-    CHECK_GE(results_requested, 0);
+    Py_DECREF(ext_document_ids);
 
-    indri::api::QueryAnnotation* query_annotation;
+    PyObject* const results_tuple = PyList_AsTuple(results);
+    Py_DECREF(results);
 
-    try {
-        if (document_ids.empty()) {
-            query_annotation = self->query_env_->runAnnotatedQuery(
-                query_str, results_requested);
-        } else{
-            query_annotation = self->query_env_->runAnnotatedQuery(
-                query_str, document_ids, results_requested);
+    return results_tuple;
+}
+
+// Sums the collection statistics of the shards. Requires the GIL.
+static bool sharded_collection_statistics(ShardedIndex* self,
+                                          CollectionStatistics* const statistics) {
+    statistics->num_documents = 0;
+    statistics->total_terms = 0;
+
+    for (size_t i = 0; i < self->shards_->size(); ++i) {
+        Index* const shard = (*self->shards_)[i];
+
+        if (!require_components(shard, INDEX_COMPONENT)) {
+            return false;
         }
-    } catch (const lemur::api::Exception& e) {
-        PyErr_SetString(PyExc_IOError, e.what().c_str());
 
-        Py_DECREF(query_bytes);
+        statistics->num_documents += shard->index_->documentCount();
+        statistics->total_terms += shard->index_->termCount();
+    }
+
+    return true;
+}
+
+static PyObject* ShardedIndex_collection_statistics(ShardedIndex* self) {
+    CollectionStatistics statistics;
 
+    if (!sharded_collection_statistics(self, &statistics)) {
         return NULL;
     }
 
-    Py_DECREF(query_bytes);
+    return Py_BuildValue(
+        "{s:K,s:K,s:d}",
+        "num_documents", static_cast<unsigned long long>(statistics.num_documents),
+        "total_terms", static_cast<unsigned long long>(statistics.total_terms),
+        "average_document_length",
+        statistics.num_documents > 0 ?
+            static_cast<double>(statistics.total_terms) / statistics.num_documents : 0.0);
+}
 
-    std::vector<indri::api::ScoredExtentResult> query_results =
-        query_annotation->getResults();
+// A query evaluated on a single shard, by its own thread.
+struct ShardQuery {
+    Index* shard;
 
-    std::vector<indri::api::ScoredExtentResult>::const_iterator it = query_results.begin();
+    RetrievalModel* model;
+    const CollectionStatistics* statistics;
+    std::vector<RetrievalTerm> terms;
+    size_t k;
 
-    std::vector<string> snippets;
+    std::vector<ScoredDocument> results;
+    std::string error;
+};
+
+static void shard_query_worker(void* data) {
+    ShardQuery* const query = static_cast<ShardQuery*>(data);
 
-    if (include_snippets) {
-        indri::api::SnippetBuilder builder(false /* html */);
+    try {
+        retrieve_top_k(query->shard, query->model, *query->statistics,
+                       &query->terms, query->k, &query->results);
+    } catch (const lemur::api::Exception& e) {
+        query->error = e.what().empty() ? "Unable to evaluate query." : e.what();
+    }
+}
 
-        std::vector<lemur::api::DOCID_T> documentIDs(query_results.size(), 0);
+struct ShardedResult {
+    size_t shard;
+    ScoredDocument document;
+};
 
-        for (size_t i = 0; i < query_results.size(); ++i) {
-            documentIDs[i] = query_results[i].document;
+// Ranks by decreasing score, breaking ties by shard and identifier.
+struct ShardedResultRank {
+    bool operator()(const ShardedResult& first, const ShardedResult& second) const {
+        if (first.document.score != second.document.score) {
+            return first.document.score > second.document.score;
         }
 
-        try {
-            const std::vector<indri::api::ParsedDocument*> documents =
-                self->query_env_->documents(documentIDs);
-
-            for (size_t i = 0; i < query_results.size(); ++i) {
-                snippets.push_back(
-                    builder.build(documentIDs[i], documents[i], query_annotation));
+        if (first.shard != second.shard) {
+            return first.shard < second.shard;
+        }
 
-                delete documents[i];
-            }
-        } catch (const lemur::api::Exception& e) {}
+        return first.document.document < second.document.document;
     }
+};
 
-    delete query_annotation;
+static PyObject* ShardedIndex_query(ShardedIndex* self, PyObject* args, PyObject* kwds) {
+    char* query_str;
+    long results_requested = 100;
+    char* model_name = "dirichlet";
+    double mu = 2500.0;
+    double k1 = 1.2;
+    double b = 0.75;
 
-    if (include_snippets && snippets.empty()) {
-        PyErr_SetString(PyExc_IOError,
-                        "Unable to retrieve snippets. "
-                        "Make sure storeDocs is enabled "
-                        "in your Indri configuration.");
+    static char* kwlist[] = {"query_str",
+                             "results_requested",
+                             "model",
+                             "mu",
+                             "k1",
+                             "b",
+                             NULL};
 
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "es|lsddd", kwlist,
+                                     ENCODING, &query_str,
+                                     &results_requested,
+                                     &model_name,
+                                     &mu, &k1, &b)) {
         return NULL;
     }
 
-    PyObject* results = PyTuple_New(query_results.size());
-
-    Py_ssize_t pos = 0;
-    for (; it != query_results.end(); ++it, ++pos) {
-        PyObject* const result = PyTuple_New(include_snippets ? 3 : 2);
+    const std::string query(query_str);
+    PyMem_Free(query_str);
 
-        PyTuple_SetItem(result, 0, PyLong_FromLong(it->document));
-        PyTuple_SetItem(result, 1, PyFloat_FromDouble(it->score));
-
-        if (include_snippets) {
-            PyTuple_SetItem(result, 2, PyUnicode_Decode(snippets[pos].c_str(),
-                                                        snippets[pos].size(),
-                                                        ENCODING,
-                                                        "strict"));
-        }
+    if (results_requested <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "results_requested should be strictly positive.");
 
-       PyTuple_SetItem(results, pos, result);
+        return NULL;
     }
 
-    return results;
-}
+    CollectionStatistics statistics;
 
-static PyObject* Index_get_dictionary(Index* self, PyObject* args) {
-    indri::index::VocabularyIterator* const vocabulary_it = self->index_->vocabularyIterator();
+    if (!sharded_collection_statistics(self, &statistics)) {
+        return NULL;
+    }
 
-    PyObject* const token2id = PyDict_New();
-    PyObject* const id2token = PyDict_New();
-    PyObject* const id2df = PyDict_New();
+    std::vector<std::string> terms;
 
-    vocabulary_it->startIteration();
+    if (!tokenize_query((*self->shards_)[0], query, &terms)) {
+        return NULL;
+    }
 
-    while (!vocabulary_it->finished()) {
-        indri::index::DiskTermData* const term_data = vocabulary_it->currentEntry();
+    const std::vector<double> weights(terms.size(), 1.0);
 
-        const lemur::api::TERMID_T term_id = term_data->termID;
-        const string term = term_data->termData->term;
+    std::vector<ShardQuery> shard_queries(self->shards_->size());
 
-        const unsigned int document_frequency = term_data->termData->corpus.documentCount;
-        CHECK_GT(document_frequency, 0);
+    for (size_t i = 0; i < shard_queries.size(); ++i) {
+        ShardQuery& shard_query = shard_queries[i];
 
-        PyDict_SetItem(token2id,
-                       PyUnicode_Decode(term.c_str(),
-                                        term.size(),
-                                        ENCODING,
-                                        "strict"),
-                       PyLong_FromLong(term_id));
+        shard_query.shard = (*self->shards_)[i];
+        shard_query.model = create_retrieval_model(model_name, mu, k1, b);
+        shard_query.statistics = &statistics;
+        shard_query.k = results_requested;
 
-        PyDict_SetItem(id2token,
-                       PyLong_FromLong(term_id),
-                       PyUnicode_Decode(term.c_str(),
-                                        term.size(),
-                                        ENCODING,
-                                        "strict"));
+        if (shard_query.model == NULL) {
+            for (size_t j = 0; j < i; ++j) {
+                delete shard_queries[j].model;
+            }
 
-        PyDict_SetItem(id2df,
-                       PyLong_FromLong(term_id),
-                       PyLong_FromLong(document_frequency));
+            return NULL;
+        }
 
-        vocabulary_it->nextEntry();
+        resolve_terms(shard_query.shard, terms, weights, &shard_query.terms);
     }
 
-    delete vocabulary_it;
-
-    CHECK_EQ(PyDict_Size(token2id), self->index_->uniqueTermCount());
-    CHECK_EQ(PyDict_Size(id2token), self->index_->uniqueTermCount());
-    CHECK_EQ(PyDict_Size(id2df), self->index_->uniqueTermCount());
+    // Terms are resolved in the same order on every shard; their
+    // frequencies are summed over the shards.
+    for (size_t term = 0; term < shard_queries[0].terms.size(); ++term) {
+        uint64_t document_frequency = 0;
+        uint64_t term_frequency = 0;
 
-    return PyTuple_Pack(3, token2id, id2token, id2df);
-}
+        for (size_t i = 0; i < shard_queries.size(); ++i) {
+            document_frequency += shard_queries[i].terms[term].document_frequency;
+            term_frequency += shard_queries[i].terms[term].term_frequency;
+        }
 
-static PyObject* Index_get_term_frequencies(Index* self, PyObject* args) {
-    indri::index::VocabularyIterator* const vocabulary_it = self->index_->vocabularyIterator();
+        for (size_t i = 0; i < shard_queries.size(); ++i) {
+            shard_queries[i].terms[term].document_frequency = document_frequency;
+            shard_queries[i].terms[term].term_frequency = term_frequency;
+        }
+    }
 
-    PyObject* const id2tf = PyDict_New();
+    std::vector<ShardedResult> results;
 
-    vocabulary_it->startIteration();
+    Py_BEGIN_ALLOW_THREADS
 
-    while (!vocabulary_it->finished()) {
-        indri::index::DiskTermData* const term_data = vocabulary_it->currentEntry();
+    run_threads(shard_query_worker, &shard_queries);
 
-        const lemur::api::TERMID_T term_id = term_data->termID;
+    for (size_t i = 0; i < shard_queries.size(); ++i) {
+        for (size_t j = 0; j < shard_queries[i].results.size(); ++j) {
+            ShardedResult result;
+            result.shard = i;
+            result.document = shard_queries[i].results[j];
 
-        const uint64_t term_frequency = term_data->termData->corpus.totalCount;
-        CHECK_GT(term_frequency, 0);
+            results.push_back(result);
+        }
+    }
 
-        PyDict_SetItem(id2tf,
-                       PyLong_FromLong(term_id),
-                       PyLong_FromLong(term_frequency));
+    std::sort(results.begin(), results.end(), ShardedResultRank());
 
-        vocabulary_it->nextEntry();
+    if (results.size() > static_cast<size_t>(results_requested)) {
+        results.resize(results_requested);
     }
 
-    delete vocabulary_it;
-
-    CHECK_EQ(PyDict_Size(id2tf), self->index_->uniqueTermCount());
+    Py_END_ALLOW_THREADS
 
-    return id2tf;
-}
+    for (size_t i = 0; i < shard_queries.size(); ++i) {
+        delete shard_queries[i].model;
+    }
 
-static PyMethodDef Index_methods[] = {
-    {"document_ids", (PyCFunction) Index_get_document_ids, METH_VARARGS,
-     "Returns the internal DOC_IDs given the external identifiers."},
-    {"document", (PyCFunction) Index_document, METH_VARARGS,
-     "Return a document (ext_document_id, terms) pair."},
-    {"document_base", (PyCFunction) Index_document_base, METH_NOARGS,
-     "Returns the lower bound document identifier (inclusive)."},
-    {"maximum_document", (PyCFunction) Index_maximum_document, METH_NOARGS,
-     "Returns the upper bound document identifier (exclusive)."},
+    for (size_t i = 0; i < shard_queries.size(); ++i) {
+        if (!shard_queries[i].error.empty()) {
+            PyErr_Format(PyExc_IOError, "Shard %zu failed: %s",
+                         i, shard_queries[i].error.c_str());
 
-    {"document_count", (PyCFunction) Index_document_count, METH_NOARGS,
-     "Returns the number of documents in the index."},
-    {"document_length", (PyCFunction) Index_document_length, METH_VARARGS,
-     "Returns the length of a document."},
+            return NULL;
+        }
+    }
 
-    {"total_terms", (PyCFunction) Index_total_terms, METH_NOARGS,
-     "Returns the number of total terms in the index."},
-    {"unique_terms", (PyCFunction) Index_unique_terms, METH_NOARGS,
-     "Returns the number of unique terms in the index."},
+    PyObject* const tuple = PyTuple_New(results.size());
 
-    {"term_count", (PyCFunction) Index_term_count, METH_VARARGS,
-     "Return the term frequency for a term."},
+    for (size_t pos = 0; pos < results.size(); ++pos) {
+        PyTuple_SetItem(tuple, pos,
+                        Py_BuildValue("((nl)d)",
+                                      static_cast<Py_ssize_t>(results[pos].shard),
+                                      static_cast<long>(results[pos].document.document),
+                                      results[pos].document.score));
+    }
 
-    {"query", (PyCFunction) Index_run_query, METH_VARARGS | METH_KEYWORDS,
-     "Queries an Indri index."},
+    return tuple;
+}
 
-    {"get_dictionary", (PyCFunction) Index_get_dictionary, METH_NOARGS,
-     "Extracts the dictionary from the index."},
-    {"get_term_frequencies", (PyCFunction) Index_get_term_frequencies, METH_NOARGS,
-     "Extracts the term frequencies from the index."},
+static PyMethodDef ShardedIndex_methods[] = {
+    {"shards", (PyCFunction) ShardedIndex_shards, METH_NOARGS,
+     "Returns the Index of every shard."},
+    {"__reduce__", (PyCFunction) ShardedIndex_reduce, METH_NOARGS,
+     "Pickles the index by its shards."},
+    {"query", (PyCFunction) ShardedIndex_query, METH_VARARGS | METH_KEYWORDS,
+     "Evaluates a bag-of-words query on all shards in parallel (as Index.wand_query); returns ((shard, int_document_id), score) pairs."},
+    {"collection_statistics", (PyCFunction) ShardedIndex_collection_statistics, METH_NOARGS,
+     "Returns the number of documents, total terms and average document length over all shards."},
+    {"document", (PyCFunction) ShardedIndex_document, METH_VARARGS,
+     "Returns the document of a (shard, int_document_id) pair."},
+    {"document_length", (PyCFunction) ShardedIndex_document_length, METH_VARARGS,
+     "Returns the length of the document of a (shard, int_document_id) pair."},
+    {"document_ids", (PyCFunction) ShardedIndex_document_ids, METH_VARARGS,
+     "Returns (ext_document_id, (shard, int_document_id)) pairs."},
     {NULL}  /* Sentinel */
 };
 
-static PyTypeObject IndexType = {
+static PyTypeObject ShardedIndexType = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "pyndri.Index",             /* tp_name */
-    sizeof(Index),             /* tp_basicsize */
+    "pyndri.ShardedIndex",      /* tp_name */
+    sizeof(ShardedIndex),      /* tp_basicsize */
     0,                         /* tp_itemsize */
-    (destructor) Index_dealloc, /* tp_dealloc */
+    (destructor) ShardedIndex_dealloc, /* tp_dealloc */
     0,                         /* tp_print */
     0,                         /* tp_getattr */
     0,                         /* tp_setattr */
@@ -592,24 +9284,24 @@ static PyTypeObject IndexType = {
     0,                         /* tp_setattro */
     0,                         /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
-    "Index objects",           /* tp_doc */
+    "ShardedIndex objects",    /* tp_doc */
     0,                   /* tp_traverse */
     0,                   /* tp_clear */
     0,                   /* tp_richcompare */
     0,                   /* tp_weaklistoffset */
     0,                   /* tp_iter */
     0,                   /* tp_iternext */
-    Index_methods,             /* tp_methods */
-    Index_members,             /* tp_members */
+    ShardedIndex_methods,      /* tp_methods */
+    0,                         /* tp_members */
     0,                         /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc) Index_init,      /* tp_init */
+    (initproc) ShardedIndex_init, /* tp_init */
     0,                         /* tp_alloc */
-    Index_new,                 /* tp_new */
+    ShardedIndex_new,          /* tp_new */
 };
 
 // Module methods.
@@ -629,10 +9321,7 @@ static PyObject* pyndri_stem(PyObject* self, PyObject* args) {
         return NULL;
     }
 
-    char* term_str = PyBytes_AsString(term_bytes);
-
-    static indri::parse::KrovetzStemmer stemmer;
-    std::string stemmed_term(stemmer.kstem_stemmer(term_str));
+    const std::string stemmed_term = krovetz_stem(PyBytes_AsString(term_bytes));
 
     Py_DECREF(term_bytes);
 
@@ -649,9 +9338,46 @@ static PyObject* pyndri_stem(PyObject* self, PyObject* args) {
     return result;
 }
 
+static PyObject* pyndri_set_async_concurrency(PyObject* self, PyObject* args) {
+    Py_ssize_t max_in_flight;
+
+    if (!PyArg_ParseTuple(args, "n", &max_in_flight)) {
+        return NULL;
+    }
+
+    if (max_in_flight <= 0) {
+        PyErr_SetString(PyExc_ValueError, "max_in_flight should be strictly positive.");
+
+        return NULL;
+    }
+
+    get_async_executor()->set_max_in_flight(max_in_flight);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyndri_async_stats(PyObject* self) {
+    size_t max_in_flight;
+    size_t running;
+    size_t queued;
+
+    get_async_executor()->statistics(&max_in_flight, &running, &queued);
+
+    return Py_BuildValue("{s:n,s:n,s:n}",
+                         "max_in_flight", static_cast<Py_ssize_t>(max_in_flight),
+                         "running", static_cast<Py_ssize_t>(running),
+                         "queued", static_cast<Py_ssize_t>(queued));
+}
+
 static PyMethodDef PyndriMethods[] = {
     {"stem", (PyCFunction) pyndri_stem, METH_VARARGS,
      "Return the Krovetz stemmed version of a term."},
+    {"set_async_concurrency", (PyCFunction) pyndri_set_async_concurrency, METH_VARARGS,
+     "Sets the maximum number of aquery/adocuments calls evaluated at once; "
+     "others wait in line. Defaults to the number of processors."},
+    {"async_stats", (PyCFunction) pyndri_async_stats, METH_NOARGS,
+     "Returns the maximum number of asynchronous calls evaluated at once, "
+     "and those running and queued."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -669,14 +9395,49 @@ PyMODINIT_FUNC PyInit_pyndri_ext(void) {
         return NULL;
     }
 
+    static bool fork_handlers_registered = false;
+
+    if (!fork_handlers_registered) {
+        pthread_atfork(NULL, NULL, fork_child);
+        fork_handlers_registered = true;
+    }
+
+    if (PyType_Ready(&ArrayType) < 0) {
+        return NULL;
+    }
+
+    if (PyType_Ready(&DocumentIteratorType) < 0) {
+        return NULL;
+    }
+
+    if (PyType_Ready(&PostingIteratorType) < 0) {
+        return NULL;
+    }
+
+    if (PyType_Ready(&ShardedIndexType) < 0) {
+        return NULL;
+    }
+
     PyObject* const module = PyModule_Create(&PyndriModule);
 
     if (module == NULL) {
         return NULL;
     }
 
+#ifdef Py_GIL_DISABLED
+    // Indexes serialize access to their Indri handles and caches themselves,
+    // and iterators their state through critical sections.
+    PyUnstable_Module_SetGIL(module, Py_MOD_GIL_NOT_USED);
+#endif
+
     Py_INCREF(&IndexType);
     PyModule_AddObject(module, "Index", (PyObject*) &IndexType);
 
+    Py_INCREF(&ArrayType);
+    PyModule_AddObject(module, "Array", (PyObject*) &ArrayType);
+
+    Py_INCREF(&ShardedIndexType);
+    PyModule_AddObject(module, "ShardedIndex", (PyObject*) &ShardedIndexType);
+
     return module;
 }
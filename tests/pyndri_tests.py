@@ -1,13 +1,36 @@
+import asyncio
+import concurrent.futures
+import math
+import multiprocessing
 import operator
 import os
+import pickle
 import shutil
+import struct
 import subprocess
 import tempfile
+import time
 import unittest
 
 import pyndri
 
 
+# Index inherited by forked worker processes in IndriTest.test_shared_index,
+# IndriTest.test_fork_reopen_failure and IndriTest.test_fork_sidecar_failure.
+_shared_index = None
+
+
+def _query_shared_index(query):
+    return _shared_index.query(query), _shared_index.document(2)
+
+
+def _document_shared_index(int_document_id):
+    try:
+        return _shared_index.document(int_document_id)
+    except IOError:
+        return None
+
+
 class KrovetzStemmingTest(unittest.TestCase):
 
     def test_stemming(self):
@@ -74,6 +97,48 @@ ACT I  PROLOGUE  Two households, both alike in dignity, In fair Verona, where we
         self.assertEqual(self.index.document_base(), 1)
         self.assertEqual(self.index.maximum_document(), 4)
 
+    def test_document_ids(self):
+        self.assertEqual(
+            self.index.document_ids(['romeo', 'unknown', 'hamlet']),
+            (('romeo', 3), ('hamlet', 2)))
+
+    def test_resolve_document_ids(self):
+        ext_doc_ids = ['romeo', 'unknown', 'hamlet', 'lorem', 'romeo']
+
+        self.assertEqual(
+            self.index.resolve_document_ids(ext_doc_ids).tolist(),
+            [3, -1, 2, 1, 3])
+
+        self.index.build_docno_table()
+        self.assertTrue(
+            os.path.exists(os.path.join(self.index_path, 'pyndri.docnos')))
+
+        index = pyndri.Index(self.index_path)
+
+        self.assertEqual(
+            index.resolve_document_ids(ext_doc_ids).tolist(),
+            [3, -1, 2, 1, 3])
+        self.assertEqual(index.document_ids(['hamlet']), (('hamlet', 2),))
+
+    def test_docnos(self):
+        blob, offsets = self.index.docnos([3, 1, 3])
+
+        self.assertEqual(blob, b'romeoloremromeo')
+        self.assertEqual(offsets.tolist(), [0, 5, 10, 15])
+
+        blob, offsets = self.index.all_docnos()
+
+        self.assertEqual(blob, b'loremhamletromeo')
+        self.assertEqual(offsets.tolist(), [0, 5, 11, 16])
+
+        blob, offsets = self.index.docnos([])
+
+        self.assertEqual(blob, b'')
+        self.assertEqual(offsets.tolist(), [0])
+
+        with self.assertRaises(IndexError):
+            self.index.docnos([4])
+
     def test_simple_query(self):
         self.assertEqual(
             self.index.query('ipsum'),
@@ -100,6 +165,226 @@ ACT I  PROLOGUE  Two households, both alike in dignity, In fair Verona, where we
                 results_requested=1),
             ((2, -5.794010932279138),))
 
+    def test_query_annotate(self):
+        for query in ('ipsum', 'his', '#1(thumb sir)'):
+            self.assertEqual(
+                self.index.query(query, annotate=True),
+                self.index.query(query))
+
+    def test_batch_query(self):
+        queries = ['ipsum', 'his', 'thumb', 'his']
+
+        self.assertEqual(
+            self.index.batch_query(queries, num_threads=2),
+            tuple(self.index.query(query) for query in queries))
+
+        self.assertEqual(
+            self.index.batch_query(['his'], results_requested=1),
+            (((2, -5.794010932279138),),))
+
+        self.assertEqual(self.index.batch_query([]), ())
+
+    def test_concurrent_access(self):
+        calls = [
+            (self.index.query, ('his',)),
+            (self.index.query, ('ipsum',)),
+            (self.index.document, (2,)),
+            (self.index.document_ids, (['romeo', 'lorem'],)),
+            (self.index.get_dictionary, ()),
+            (self.index.document_length, (3,)),
+            (self.index.term_count, ('his',)),
+        ] * 8
+
+        expected = [function(*args) for function, args in calls]
+
+        with concurrent.futures.ThreadPoolExecutor(max_workers=8) as executor:
+            futures = [executor.submit(function, *args)
+                       for function, args in calls]
+
+            self.assertEqual([future.result() for future in futures],
+                             expected)
+
+    def test_concurrent_statistics_reload(self):
+        self.index.build_statistics()
+
+        lengths = self.index.all_document_lengths().tolist()
+        dfs = self.index.document_frequencies().tolist()
+
+        def read_statistics():
+            return (self.index.all_document_lengths().tolist(),
+                    self.index.document_frequencies().tolist(),
+                    self.index.document_lengths([3, 1, 2]).tolist())
+
+        with concurrent.futures.ThreadPoolExecutor(max_workers=8) as executor:
+            futures = [executor.submit(self.index.build_statistics)
+                       for _ in range(4)]
+            futures += [executor.submit(read_statistics) for _ in range(32)]
+
+            for future in futures[4:]:
+                self.assertEqual(future.result(),
+                                 (lengths, dfs, [573, 88, 71]))
+
+            for future in futures[:4]:
+                future.result()
+
+    def test_init_twice(self):
+        with self.assertRaises(RuntimeError):
+            self.index.__init__(self.index_path)
+
+        sharded_index = pyndri.ShardedIndex([self.index])
+
+        with self.assertRaises(RuntimeError):
+            sharded_index.__init__([self.index])
+
+        self.assertEqual(self.index.query('ipsum'),
+                         ((1, -6.373564749941117),))
+
+    def assertResultsAlmostEqual(self, first, second):
+        self.assertEqual([doc_id for doc_id, _ in first],
+                         [doc_id for doc_id, _ in second])
+
+        for (_, first_score), (_, second_score) in zip(first, second):
+            self.assertAlmostEqual(first_score, second_score)
+
+    def test_wand_query_dirichlet(self):
+        for query in ('ipsum', 'his', 'thumb sir', 'thumb thumb sir',
+                      'the castle of montague', 'nonexistent'):
+            for results_requested in (1, 2, 100):
+                self.assertResultsAlmostEqual(
+                    self.index.wand_query(
+                        query, results_requested=results_requested),
+                    self.index.query(
+                        query, results_requested=results_requested))
+
+        self.index.build_max_scores()
+
+        self.assertResultsAlmostEqual(
+            self.index.wand_query('the castle of montague'),
+            self.index.query('the castle of montague'))
+
+        with self.assertRaises(ValueError):
+            self.index.wand_query('#combine(his)')
+
+    def test_wand_query_bm25(self):
+        token2id, _, id2df = self.index.get_dictionary()
+
+        num_documents = self.index.document_count()
+        avg_length = float(self.index.total_terms()) / num_documents
+
+        k1, b = 1.2, 0.75
+
+        def bm25(terms):
+            scores = {}
+
+            for term in terms:
+                term_id = token2id[term]
+                idf = math.log1p(
+                    (num_documents - id2df[term_id] + 0.5) /
+                    (id2df[term_id] + 0.5))
+
+                doc_ids, tfs = self.index.postings(term_id)
+
+                for doc_id, tf in zip(doc_ids.tolist(), tfs.tolist()):
+                    length = self.index.document_length(doc_id)
+                    scores[doc_id] = scores.get(doc_id, 0.0) + idf * (
+                        tf * (k1 + 1) /
+                        (tf + k1 * (1 - b + b * length / avg_length)))
+
+            return sorted(scores.items(),
+                          key=lambda item: (-item[1], item[0]))
+
+        for terms in (['sir'], ['in', 'sampson'], ['act', 'scene', 'lorem']):
+            self.assertResultsAlmostEqual(
+                self.index.wand_query(' '.join(terms), model='bm25',
+                                      k1=k1, b=b),
+                bm25(terms))
+
+    def test_wand_query_stopper(self):
+        with open(os.path.join(self.test_dir,
+                               'IndriBuildIndex.conf'), 'w') as f:
+            f.write(self.INDRI_CONFIG.replace(
+                '<index>index/</index>',
+                '<index>stopped/</index>'
+                '<stopper><word>the</word><word>of</word></stopper>'))
+
+        with open(os.devnull, "w") as f:
+            ret = subprocess.call(['IndriBuildIndex', 'IndriBuildIndex.conf'],
+                                  stdout=f,
+                                  cwd=self.test_dir)
+
+        self.assertEqual(ret, 0)
+
+        index = pyndri.Index(os.path.join(self.test_dir, 'stopped'))
+
+        self.assertResultsAlmostEqual(
+            index.wand_query('the castle of montague'),
+            index.query('castle montague'))
+        self.assertResultsAlmostEqual(
+            index.wand_query('the castle of montague'),
+            index.query('the castle of montague'))
+        self.assertEqual(index.wand_query('the of'), ())
+
+        results, expansion = index.rm3_query('the castle of montague')
+
+        self.assertNotIn('the', dict(expansion))
+
+    def test_rm3_query(self):
+        _, id2token, _ = self.index.get_dictionary()
+
+        def relevance_model(query, fb_docs, fb_terms):
+            feedback = self.index.query(query, results_requested=fb_docs)
+            max_score = max(score for _, score in feedback)
+
+            likelihoods = [math.exp(score - max_score)
+                           for _, score in feedback]
+
+            weights = {}
+
+            for (doc_id, _), likelihood in zip(feedback, likelihoods):
+                _, terms = self.index.document(doc_id)
+
+                for term_id in terms:
+                    if term_id > 0:
+                        weights[term_id] = weights.get(term_id, 0.0) + (
+                            likelihood / sum(likelihoods) / len(terms))
+
+            top = sorted(weights.items(),
+                         key=lambda item: (-item[1], item[0]))[:fb_terms]
+            total = sum(weight for _, weight in top)
+
+            return [(id2token[term_id], weight / total)
+                    for term_id, weight in top]
+
+        for query in ('thumb sir', 'the castle of montague'):
+            results, expansion = self.index.rm3_query(
+                query, fb_docs=2, fb_terms=5, orig_weight=0.3)
+
+            expected_expansion = relevance_model(query, 2, 5)
+
+            self.assertEqual([term for term, _ in expansion],
+                             [term for term, _ in expected_expansion])
+
+            for (_, weight), (_, expected_weight) in zip(
+                    expansion, expected_expansion):
+                self.assertAlmostEqual(weight, expected_weight)
+
+            self.assertResultsAlmostEqual(
+                results,
+                self.index.query(
+                    '#weight(0.3 #combine({}) 0.7 #weight({}))'.format(
+                        query,
+                        ' '.join('{!r} {}'.format(weight, term)
+                                 for term, weight in expansion))))
+
+        results, expansion = self.index.rm3_query('thumb sir', fb_terms=0)
+
+        self.assertEqual(expansion, ())
+        self.assertResultsAlmostEqual(
+            results, self.index.wand_query('thumb sir'))
+
+        with self.assertRaises(ValueError):
+            self.index.rm3_query('thumb sir', orig_weight=1.5)
+
     def test_query_snippets(self):
         self.assertEqual(
             self.index.query('ipsum', include_snippets=True),
@@ -107,11 +392,612 @@ ACT I  PROLOGUE  Two households, both alike in dignity, In fair Verona, where we
               'Lorem IPSUM dolor sit amet, consectetur '
               'adipiscing\nelit. Duis...'),))
 
+    def test_query_snippets_document_cache(self):
+        self.assertEqual(self.index.document_cache_stats()['hits'], 0)
+
+        first = self.index.query('his', include_snippets=True)
+
+        stats = self.index.document_cache_stats()
+        self.assertEqual(stats['misses'], 2)
+        self.assertEqual(stats['size'], 2)
+
+        self.assertEqual(self.index.query('his', include_snippets=True), first)
+        self.assertEqual(self.index.document_cache_stats()['hits'], 2)
+
+        index = pyndri.Index(self.index_path, document_cache_size=0)
+
+        self.assertEqual(index.query('his', include_snippets=True), first)
+        self.assertEqual(index.document_cache_stats()['size'], 0)
+
+    def test_query_result_cache(self):
+        self.assertEqual(self.index.result_cache_stats()['capacity'], 0)
+
+        index = pyndri.Index(self.index_path, result_cache_size=1 << 20)
+
+        first = index.query('his')
+        self.assertEqual(index.query('  his '), first)
+        self.assertEqual(index.query('his', results_requested=1), first[:1])
+
+        stats = index.result_cache_stats()
+        self.assertEqual(stats['hits'], 1)
+        self.assertEqual(stats['misses'], 2)
+        self.assertEqual(stats['entries'], 2)
+
+        self.assertEqual(
+            index.query('his', include_snippets=True),
+            self.index.query('his', include_snippets=True))
+        self.assertEqual(index.batch_query(['his', 'ipsum']),
+                         (first, self.index.query('ipsum')))
+        self.assertEqual(index.result_cache_stats()['hits'], 2)
+
+        # Document sets only share entries if they are equal.
+        self.assertEqual(index.query('his', document_set=[2]),
+                         ((2, -5.794010932279138),))
+        self.assertEqual(index.query('his', document_set=[3]),
+                         ((3, -5.972370287143733),))
+        self.assertEqual(index.query('his', document_set=[3, 2]), first)
+        self.assertEqual(index.query('his', document_set=[2, 3]), first)
+        self.assertEqual(index.result_cache_stats()['hits'], 3)
+
+        index.clear_result_cache()
+
+        stats = index.result_cache_stats()
+        self.assertEqual(stats['entries'], 0)
+        self.assertEqual(stats['bytes'], 0)
+
+    def test_async(self):
+        loop = asyncio.new_event_loop()
+
+        async def query_and_documents():
+            return await asyncio.gather(
+                self.index.aquery('his', include_snippets=True),
+                self.index.adocuments([2, 3]))
+
+        results, documents = loop.run_until_complete(query_and_documents())
+
+        self.assertEqual(results, self.index.query('his', include_snippets=True))
+        self.assertEqual(documents,
+                         (self.index.document(2), self.index.document(3)))
+
+        pyndri.set_async_concurrency(1)
+
+        async def cancel():
+            futures = [self.index.aquery('thumb') for _ in range(8)]
+            futures[-1].cancel()
+
+            return await asyncio.gather(*futures, return_exceptions=True)
+
+        results = loop.run_until_complete(cancel())
+
+        self.assertEqual(results[:-1], [self.index.query('thumb')] * 7)
+        self.assertIsInstance(results[-1], asyncio.CancelledError)
+
+        # Cancelled lookups stop between documents.
+        self.index.set_instrumentation()
+
+        async def cancel_documents():
+            futures = [self.index.aquery('thumb') for _ in range(4)]
+            futures.append(self.index.adocuments([1, 2, 3] * 10000))
+            futures[-1].cancel()
+
+            return await asyncio.gather(*futures, return_exceptions=True)
+
+        results = loop.run_until_complete(cancel_documents())
+
+        self.assertIsInstance(results[-1], asyncio.CancelledError)
+
+        # The executor skips or stops the cancelled work in the background.
+        deadline = time.monotonic() + 10.0
+
+        while time.monotonic() < deadline:
+            stats = pyndri.async_stats()
+
+            if stats['queued'] == 0 and stats['running'] == 0:
+                break
+
+            time.sleep(0.01)
+
+        self.assertEqual(stats['max_in_flight'], 1)
+        self.assertEqual(stats['queued'], 0)
+        self.assertEqual(stats['running'], 0)
+
+        self.assertLess(
+            self.index.instrumentation_stats()['counters']['documents_decoded'],
+            30000)
+
+        pyndri.set_async_concurrency(os.cpu_count())
+
+        async def out_of_bounds():
+            return self.index.adocuments([4])
+
+        with self.assertRaises(IndexError):
+            loop.run_until_complete(out_of_bounds())
+
+        loop.close()
+
+    def test_instrumentation(self):
+        self.index.query('his')
+
+        stats = self.index.instrumentation_stats()
+        self.assertFalse(stats['enabled'])
+        self.assertEqual(stats['phases']['query'], {'calls': 0, 'seconds': 0.0})
+
+        self.index.set_instrumentation()
+
+        self.index.query('his', include_snippets=True)
+        self.index.query('his', include_snippets=True)
+        self.index.document(2)
+        self.index.document_range(1, 4)
+
+        stats = self.index.instrumentation_stats()
+        self.assertTrue(stats['enabled'])
+
+        for phase in ('query', 'snippets', 'results'):
+            self.assertEqual(stats['phases'][phase]['calls'], 2)
+            self.assertGreater(stats['phases'][phase]['seconds'], 0.0)
+
+        self.assertEqual(stats['phases']['documents']['calls'], 2)
+        self.assertEqual(stats['counters']['documents_decoded'], 4)
+        self.assertEqual(stats['counters']['documents_decompressed'], 2)
+        self.assertGreater(stats['counters']['bytes_decompressed'], 0)
+        self.assertEqual(stats['counters']['document_cache_hits'], 2)
+
+        self.index.reset_instrumentation()
+        self.index.set_instrumentation(False)
+
+        self.index.wand_query('his')
+
+        stats = self.index.instrumentation_stats()
+        self.assertEqual(stats['phases']['wand']['calls'], 0)
+        self.assertEqual(set(stats['counters'].values()), {0})
+
+    def test_components(self):
+        index = pyndri.Index(self.index_path, components=['index'])
+
+        self.assertEqual(index.document_length(2),
+                         self.index.document_length(2))
+        self.assertEqual(index.term_count('his'),
+                         self.index.term_count('his'))
+
+        with self.assertRaises(RuntimeError):
+            index.query('his')
+
+        with self.assertRaises(RuntimeError):
+            index.document(2)
+
+        with self.assertRaises(RuntimeError):
+            pickle.loads(pickle.dumps(index)).query('his')
+
+        with self.assertRaises(ValueError):
+            pyndri.Index(self.index_path, components=['postings'])
+
+        # Without an explicit list, components are opened on first use.
+        index = pyndri.Index(self.index_path)
+
+        self.assertEqual(index.query('his'), self.index.query('his'))
+        self.assertEqual(index.document(2), self.index.document(2))
+
+        # A component whose sidecars fail to load is opened again later.
+        statistics_path = os.path.join(self.index_path, 'pyndri.statistics')
+
+        with open(statistics_path, 'wb') as f:
+            f.write(b'corrupt')
+
+        index = pyndri.Index(self.index_path)
+
+        with self.assertRaises(IOError):
+            index.document_length(2)
+
+        os.remove(statistics_path)
+
+        self.assertEqual(index.document_length(2),
+                         self.index.document_length(2))
+
+    def test_statistics(self):
+        token2id, _, id2df = self.index.get_dictionary()
+        id2tf = self.index.get_term_frequencies()
+
+        term_ids = sorted(id2df)
+
+        # Served from the index, as the sidecar does not exist yet.
+        lengths = self.index.all_document_lengths().tolist()
+        statistics = self.index.collection_statistics()
+        dfs = self.index.document_frequencies(term_ids).tolist()
+        cfs = self.index.collection_frequencies(term_ids).tolist()
+
+        self.assertEqual(
+            lengths,
+            [self.index.document_length(int_document_id)
+             for int_document_id in range(self.index.document_base(),
+                                          self.index.maximum_document())])
+        self.assertEqual(statistics['num_documents'], 3)
+        self.assertEqual(statistics['total_terms'], sum(lengths))
+        self.assertEqual(statistics['unique_terms'], len(token2id))
+        self.assertAlmostEqual(statistics['average_document_length'],
+                               sum(lengths) / 3.0)
+        self.assertEqual(dfs, [id2df[term_id] for term_id in term_ids])
+        self.assertEqual(cfs, [id2tf[term_id] for term_id in term_ids])
+
+        self.index.build_statistics()
+
+        self.assertTrue(os.path.exists(
+            os.path.join(self.index_path, 'pyndri.statistics')))
+
+        index = pyndri.Index(self.index_path)
+
+        self.assertEqual(index.all_document_lengths().tolist(), lengths)
+        self.assertEqual(index.collection_statistics(), statistics)
+        self.assertEqual(index.document_frequencies(term_ids).tolist(), dfs)
+        self.assertEqual(index.collection_frequencies(term_ids).tolist(), cfs)
+
+        all_dfs = index.document_frequencies()
+
+        self.assertEqual([all_dfs[term_id] for term_id in term_ids], dfs)
+        self.assertEqual(index.term_counts(['his', 'unknown']).tolist(),
+                         [id2tf[token2id['his']], 0])
+
+        with self.assertRaises(IndexError):
+            index.document_frequencies([0])
+
+        # Rebuilding replaces the sidecar mapped before.
+        index.build_statistics()
+
+        self.assertEqual(index.collection_statistics(), statistics)
+        self.assertEqual(index.all_document_lengths().tolist(), lengths)
+
+        # Sidecars are validated against the totals of the index.
+        with open(os.path.join(self.index_path, 'pyndri.statistics'),
+                  'r+b') as f:
+            f.seek(40)  # StatisticsHeader.total_terms.
+            f.write(struct.pack('=Q', statistics['total_terms'] + 1))
+
+        with self.assertRaises(IOError):
+            pyndri.Index(self.index_path).collection_statistics()
+
+        index.build_statistics()
+
+        self.assertEqual(
+            pyndri.Index(self.index_path).collection_statistics(), statistics)
+
+    def test_vocabulary(self):
+        token2id, id2token, id2df = self.index.get_dictionary()
+        id2tf = self.index.get_term_frequencies()
+
+        blob, offsets, dfs, cfs = self.index.vocabulary()
+        offsets = offsets.tolist()
+
+        self.assertEqual(len(offsets), len(token2id) + 2)
+        self.assertEqual(len(dfs), len(token2id) + 1)
+        self.assertEqual(len(cfs), len(token2id) + 1)
+
+        self.assertEqual(offsets[0], offsets[1])
+        self.assertEqual(dfs[0], 0)
+
+        for term_id, token in id2token.items():
+            self.assertEqual(
+                blob[offsets[term_id]:offsets[term_id + 1]].decode('latin1'),
+                token)
+            self.assertEqual(dfs[term_id], id2df[term_id])
+            self.assertEqual(cfs[term_id], id2tf[term_id])
+
+    def test_extract_features(self):
+        token2id, _, id2df = self.index.get_dictionary()
+
+        features = ['ql', 'bm25', 'tfidf', 'tf', 'coverage', 'proximity',
+                    'document_length']
+        queries = ['thumb sir', 'his', 'nonexistent']
+        candidates = [[3, 1, 2], [2, 3], [1]]
+
+        matrix = self.index.extract_features(
+            queries, candidates, features=features, num_threads=2)
+
+        self.assertEqual(memoryview(matrix).shape, (6, len(features)))
+        self.assertEqual(len(matrix), 6)
+
+        values = matrix.tolist()
+
+        self.assertEqual(matrix[1].tolist(), values[1])
+
+        rows = [dict(zip(features, row)) for row in values]
+
+        def proximity(doc_id, first, second, window=8):
+            _, terms = self.index.document(doc_id)
+
+            first_positions = [pos for pos, term_id in enumerate(terms)
+                               if term_id == token2id[first]]
+            second_positions = [pos for pos, term_id in enumerate(terms)
+                                if term_id == token2id[second]]
+
+            return sum(
+                1 for pos in first_positions
+                if any(abs(pos - other) < window
+                       for other in second_positions))
+
+        row = 0
+
+        for query, query_candidates in zip(queries, candidates):
+            ql = dict(self.index.query(query))
+            bm25 = dict(self.index.wand_query(query, model='bm25'))
+
+            terms = [term for term in query.split() if term in token2id]
+
+            for doc_id in query_candidates:
+                _, document = self.index.document(doc_id)
+
+                tfs = [document.count(token2id[term]) for term in terms]
+
+                if doc_id in ql:
+                    self.assertAlmostEqual(rows[row]['ql'], ql[doc_id],
+                                           places=4)
+                    self.assertAlmostEqual(rows[row]['bm25'], bm25[doc_id],
+                                           places=4)
+                else:
+                    self.assertEqual(rows[row]['bm25'], 0.0)
+
+                self.assertAlmostEqual(
+                    rows[row]['tfidf'],
+                    sum(tf * math.log(3.0 / id2df[token2id[term]])
+                        for term, tf in zip(terms, tfs) if tf > 0),
+                    places=4)
+                self.assertEqual(rows[row]['tf'], sum(tfs))
+                self.assertAlmostEqual(
+                    rows[row]['coverage'],
+                    sum(1 for tf in tfs if tf > 0) / len(query.split()))
+                self.assertEqual(rows[row]['document_length'],
+                                 self.index.document_length(doc_id))
+
+                if len(terms) == 2:
+                    self.assertEqual(rows[row]['proximity'],
+                                     proximity(doc_id, *terms))
+
+                row += 1
+
+        with self.assertRaises(ValueError):
+            self.index.extract_features(['his'], [[1]], features=['pagerank'])
+
+        with self.assertRaises(ValueError):
+            self.index.extract_features(['his', 'sir'], [[1]])
+
+        with self.assertRaises(IndexError):
+            self.index.extract_features(['his'], [[100]])
+
+    def test_sharded_index(self):
+        documents = [document + '</DOC>\n'
+                     for document in self.CORPUS.split('</DOC>\n')[:-1]]
+
+        shard_paths = []
+
+        # The first shard holds lorem and hamlet, the second holds romeo.
+        for shard, shard_documents in enumerate((documents[:2], documents[2:])):
+            shard_dir = os.path.join(self.test_dir, 'shard{}'.format(shard))
+            os.mkdir(shard_dir)
+
+            with open(os.path.join(shard_dir, 'corpus.trectext'),
+                      'w', encoding='latin1') as f:
+                f.write(''.join(shard_documents))
+
+            with open(os.path.join(shard_dir, 'IndriBuildIndex.conf'),
+                      'w') as f:
+                f.write(self.INDRI_CONFIG)
+
+            with open(os.devnull, 'w') as f:
+                self.assertEqual(
+                    subprocess.call(['IndriBuildIndex', 'IndriBuildIndex.conf'],
+                                    stdout=f, cwd=shard_dir), 0)
+
+            shard_paths.append(os.path.join(shard_dir, 'index'))
+
+        index = pyndri.ShardedIndex(shard_paths, document_cache_size=16)
+
+        self.assertEqual(len(index.shards()), 2)
+        self.assertEqual(index.collection_statistics()['num_documents'], 3)
+        self.assertEqual(index.collection_statistics()['total_terms'],
+                         self.index.total_terms())
+
+        def docnos(results, document):
+            return [(document(int_document_id)[0], score)
+                    for int_document_id, score in results]
+
+        for model in ('dirichlet', 'bm25'):
+            for query in ('his', 'thumb sir', 'the castle of montague',
+                          'nonexistent'):
+                self.assertResultsAlmostEqual(
+                    docnos(index.query(query, model=model),
+                           index.document),
+                    docnos(self.index.wand_query(query, model=model),
+                           self.index.document))
+
+        self.assertEqual(index.query('thumb', results_requested=1)[0][0],
+                         (1, 1))
+
+        self.assertEqual(index.document((0, 2)), self.index.document(2))
+        self.assertEqual(index.document_length((1, 1)),
+                         self.index.document_length(3))
+        self.assertEqual(
+            index.document_ids(['romeo', 'unknown', 'hamlet']),
+            (('hamlet', (0, 2)), ('romeo', (1, 1))))
+
+        with self.assertRaises(IndexError):
+            index.document((2, 1))
+
+        with self.assertRaises(TypeError):
+            index.document(1)
+
+        self.assertEqual(pickle.loads(pickle.dumps(index)).query('his'),
+                         index.query('his'))
+
+    def test_shared_index(self):
+        global _shared_index
+
+        index = pyndri.Index(self.index_path, shared=True)
+
+        for filename in ('pyndri.docnos',
+                         'pyndri.dictionary',
+                         'pyndri.statistics'):
+            self.assertTrue(
+                os.path.exists(os.path.join(self.index_path, filename)))
+
+        self.assertEqual(index.document_lengths([3, 1, 2]).tolist(),
+                         self.index.document_lengths([3, 1, 2]).tolist())
+        self.assertEqual(index.document_length(2),
+                         self.index.document_length(2))
+
+        token2id, _, _ = self.index.get_dictionary()
+        dictionary = pyndri.Dictionary.from_snapshot(
+            os.path.join(self.index_path, 'pyndri.dictionary'))
+        self.assertEqual(dict(dictionary.token2id), token2id)
+
+        unpickled = pickle.loads(pickle.dumps(index))
+        self.assertEqual(unpickled.query('his'), self.index.query('his'))
+
+        _shared_index = index
+
+        try:
+            context = multiprocessing.get_context('fork')
+
+            with context.Pool(2) as pool:
+                self.assertEqual(
+                    pool.map(_query_shared_index, ['his', 'ipsum'] * 2),
+                    [(self.index.query(query), self.index.document(2))
+                     for query in ['his', 'ipsum'] * 2])
+        finally:
+            _shared_index = None
+
+    def test_fork_reopen_failure(self):
+        global _shared_index
+
+        self.assertEqual(self.index.document(2)[0], 'hamlet')
+
+        collection_path = os.path.join(self.index_path, 'collection')
+        os.rename(collection_path, collection_path + '.moved')
+
+        _shared_index = self.index
+
+        try:
+            context = multiprocessing.get_context('fork')
+
+            with context.Pool(1) as pool:
+                self.assertEqual(pool.map(_document_shared_index, [2, 2]),
+                                 [None, None])
+        finally:
+            _shared_index = None
+
+            os.rename(collection_path + '.moved', collection_path)
+
+        self.assertEqual(self.index.document(2)[0], 'hamlet')
+
+    def test_fork_sidecar_failure(self):
+        global _shared_index
+
+        index = pyndri.Index(self.index_path, shared=True)
+
+        # Replaced, not truncated, as the parent keeps its mapping.
+        statistics_path = os.path.join(self.index_path, 'pyndri.statistics')
+
+        with open(statistics_path + '.corrupt', 'wb') as f:
+            f.write(b'corrupt')
+
+        os.rename(statistics_path + '.corrupt', statistics_path)
+
+        _shared_index = index
+
+        try:
+            context = multiprocessing.get_context('fork')
+
+            with context.Pool(1) as pool:
+                self.assertEqual(pool.map(_document_shared_index, [2, 2]),
+                                 [None, None])
+        finally:
+            _shared_index = None
+
+        self.assertEqual(index.document_length(2), 71)
+
     def test_document_length(self):
         self.assertEqual(self.index.document_length(1), 88)
         self.assertEqual(self.index.document_length(2), 71)
         self.assertEqual(self.index.document_length(3), 573)
 
+    def test_document_lengths(self):
+        self.assertEqual(
+            self.index.document_lengths([3, 1, 2, 1]).tolist(),
+            [573, 88, 71, 88])
+
+        self.assertEqual(
+            self.index.document_lengths(self.index.document_lengths([])).tolist(),
+            [])
+
+        with self.assertRaises(IndexError):
+            self.index.document_lengths([1, 4])
+
+    def test_document_length_statistics(self):
+        statistics = self.index.document_length_statistics(bin_width=100)
+
+        self.assertEqual(statistics['num_documents'], 3)
+        self.assertEqual(statistics['total_length'], 88 + 71 + 573)
+        self.assertEqual(statistics['min'], 71)
+        self.assertEqual(statistics['max'], 573)
+        self.assertAlmostEqual(statistics['mean'], (88 + 71 + 573) / 3.0)
+        self.assertAlmostEqual(statistics['std'], 285.0491186)
+        self.assertEqual(statistics['histogram'].tolist(), [2, 0, 0, 0, 0, 1])
+
+    def test_term_counts(self):
+        terms = ['sampson', 'lorem', 'nonexistent']
+
+        self.assertEqual(
+            self.index.term_counts(terms).tolist(),
+            [self.index.term_count(term) for term in terms])
+
+    def test_postings(self):
+        token2id, _, id2df = self.index.get_dictionary()
+
+        documents = dict(
+            (int_doc_id, self.index.document(int_doc_id)[1])
+            for int_doc_id in range(self.index.document_base(),
+                                    self.index.maximum_document()))
+
+        for token in ('in', 'sampson', 'lorem', 'act'):
+            term_id = token2id[token]
+
+            doc_ids, tfs, positions, offsets = self.index.postings(
+                term_id, include_positions=True)
+
+            expected_doc_ids = [
+                int_doc_id for int_doc_id, terms in sorted(documents.items())
+                if term_id in terms]
+
+            self.assertEqual(doc_ids.tolist(), expected_doc_ids)
+            self.assertEqual(len(doc_ids), id2df[term_id])
+
+            for pos, int_doc_id in enumerate(expected_doc_ids):
+                terms = documents[int_doc_id]
+
+                self.assertEqual(tfs[pos], terms.count(term_id))
+                self.assertEqual(
+                    positions.tolist()[offsets[pos]:offsets[pos + 1]],
+                    [idx for idx, t in enumerate(terms) if t == term_id])
+
+            self.assertEqual(
+                [(doc_id, tf) for doc_id, tf in
+                 self.index.posting_iterator(term_id)],
+                list(zip(doc_ids.tolist(), tfs.tolist())))
+
+        with self.assertRaises(IndexError):
+            self.index.postings(0)
+
+    def test_posting_iterator_next_geq(self):
+        token2id, _, _ = self.index.get_dictionary()
+
+        it = self.index.posting_iterator(token2id['act'])
+
+        self.assertEqual(it.document, 2)
+        self.assertEqual(it.next_geq(1), 2)
+        self.assertEqual(it.next_geq(3), 3)
+        self.assertEqual(it.tf, 1)
+        self.assertEqual(len(it.positions), 1)
+        self.assertEqual(list(it), [(3, 1)])
+        self.assertEqual(it.next_geq(4), None)
+        self.assertEqual(it.document, None)
+
     def test_raw_dictionary(self):
         token2id, id2token, id2df = self.index.get_dictionary()
         id2tf = self.index.get_term_frequencies()
@@ -124,6 +1010,65 @@ ACT I  PROLOGUE  Two households, both alike in dignity, In fair Verona, where we
             self.assertGreaterEqual(id2df[idx], 1)
             self.assertGreaterEqual(id2tf[idx], 1)
 
+    def test_dictionary_snapshot(self):
+        token2id, id2token, id2df = self.index.get_dictionary()
+
+        snapshot_path = os.path.join(self.test_dir, 'dictionary.snapshot')
+        self.index.export_dictionary(snapshot_path)
+
+        dictionary = pyndri.Dictionary.from_snapshot(snapshot_path)
+
+        self.assertEqual(len(dictionary), len(id2token))
+        self.assertEqual(dict(dictionary.token2id), token2id)
+        self.assertEqual(dict(dictionary.id2token), id2token)
+        self.assertEqual(dict(dictionary.dfs), id2df)
+
+        self.assertEqual(dictionary.translate_token('predictions'), None)
+        self.assertEqual(dictionary.translate_token('lorem'),
+                         token2id['lorem'])
+
+    def test_doc2bow(self):
+        dictionary = pyndri.extract_dictionary(self.index)
+
+        tokens = ['households', 'the', 'castle', 'sampson', 'nonexistent',
+                  'sampson']
+
+        def bow(result):
+            return list(zip(*(array.tolist() for array in result)))
+
+        self.assertEqual(bow(self.index.doc2bow(tokens)),
+                         dictionary.doc2bow(tokens))
+        self.assertEqual(
+            bow(self.index.doc2bow('The castle; SAMPSON, sampson!')),
+            dictionary.doc2bow(['the', 'castle', 'sampson', 'sampson']))
+        self.assertEqual(bow(self.index.doc2bow([])), [])
+
+        # Raw text is tokenized as during indexing, including contractions
+        # such as "Who's", "'Tis" and "we'll".
+        for docno, int_document_id in (('hamlet', 2), ('romeo', 3)):
+            begin = self.CORPUS.index(
+                '<DOCNO>{}</DOCNO>\n<TEXT>\n'.format(docno))
+            text = self.CORPUS[begin:self.CORPUS.index('</TEXT>', begin)]
+            text = text[text.index('<TEXT>') + len('<TEXT>'):]
+
+            terms = self.index.document(int_document_id)[1]
+
+            self.assertEqual(
+                bow(self.index.doc2bow(text)),
+                sorted((term_id, terms.count(term_id))
+                       for term_id in set(terms) if term_id > 0))
+
+        documents = [tokens, 'Verona. Two households', [], 'hamlet']
+
+        data, indices, indptr = (
+            array.tolist()
+            for array in self.index.batch_doc2bow(documents, num_threads=2))
+
+        self.assertEqual(
+            [list(zip(indices[begin:end], data[begin:end]))
+             for begin, end in zip(indptr, indptr[1:])],
+            [bow(self.index.doc2bow(document)) for document in documents])
+
     def test_document(self):
         token2id, id2token, id2df = self.index.get_dictionary()
 
@@ -150,6 +1095,131 @@ ACT I  PROLOGUE  Two households, both alike in dignity, In fair Verona, where we
              'eget', 'convalli', 'vestibulum', 'nulla', 'integer',
              'vestibulum', 'et', 'sem', 'ac', 'scelerisque'])
 
+    def test_document_array(self):
+        ext_document_id, terms = self.index.document_array(2)
+
+        self.assertEqual(ext_document_id, 'hamlet')
+        self.assertEqual(memoryview(terms).format, 'i')
+        self.assertEqual(tuple(terms.tolist()), self.index.document(2)[1])
+
+        with self.assertRaises(IndexError):
+            self.index.document_array(0)
+
+    def test_document_range(self):
+        terms, offsets = self.index.document_range(
+            self.index.document_base(), self.index.maximum_document())
+
+        self.assertEqual(offsets.tolist(), [0, 88, 88 + 71, 88 + 71 + 573])
+
+        for pos, int_doc_id in enumerate(range(
+                self.index.document_base(), self.index.maximum_document())):
+            self.assertEqual(
+                tuple(terms.tolist()[offsets[pos]:offsets[pos + 1]]),
+                self.index.document(int_doc_id)[1])
+
+        terms, offsets = self.index.document_range(2, 2)
+
+        self.assertEqual(len(terms), 0)
+        self.assertEqual(offsets.tolist(), [0])
+
+    def test_document_vectors(self):
+        self.assertEqual(self.index.field_names(), {})
+
+        terms, field_ids, begins, ends = self.index.document_vector(2)
+
+        self.assertEqual(tuple(terms.tolist()), self.index.document(2)[1])
+        self.assertEqual(len(field_ids), 0)
+
+        with open(os.path.join(self.test_dir,
+                               'IndriBuildIndex.conf'), 'w') as f:
+            f.write(self.INDRI_CONFIG.replace(
+                '<index>index/</index>',
+                '<index>fields/</index><field><name>text</name></field>'))
+
+        with open(os.devnull, "w") as f:
+            ret = subprocess.call(['IndriBuildIndex', 'IndriBuildIndex.conf'],
+                                  stdout=f,
+                                  cwd=self.test_dir)
+
+        self.assertEqual(ret, 0)
+
+        index = pyndri.Index(os.path.join(self.test_dir, 'fields'))
+
+        self.assertEqual(index.field_names(), {1: 'text'})
+
+        terms, field_ids, begins, ends = index.document_vector(2)
+
+        self.assertEqual(tuple(terms.tolist()), self.index.document(2)[1])
+        self.assertEqual(field_ids.tolist(), [1])
+        self.assertEqual(begins.tolist(), [0])
+        self.assertEqual(ends.tolist(), [len(terms)])
+
+        vectors = index.document_vectors([3, 2])
+        terms, term_offsets, field_ids, begins, ends, field_offsets = vectors
+
+        self.assertEqual(term_offsets.tolist(), [0, 573, 573 + 71])
+        self.assertEqual(field_offsets.tolist(), [0, 1, 2])
+        self.assertEqual(field_ids.tolist(), [1, 1])
+        self.assertEqual(ends.tolist(), [573, 71])
+        self.assertEqual(tuple(terms.tolist()[573:]), self.index.document(2)[1])
+
+        range_vectors = index.document_vector_range(1, 4)
+
+        self.assertEqual(range_vectors[1].tolist(), [0, 88, 88 + 71, 88 + 71 + 573])
+        self.assertEqual(range_vectors[5].tolist(), [0, 1, 2, 3])
+
+        with self.assertRaises(IndexError):
+            index.document_vectors([4])
+
+    def test_to_csr(self):
+        _, _, id2df = self.index.get_dictionary()
+
+        def bow(int_doc_id, min_df=0):
+            terms = [term_id for term_id in self.index.document(int_doc_id)[1]
+                     if term_id > 0 and id2df[term_id] >= min_df]
+
+            return sorted(
+                (term_id, terms.count(term_id)) for term_id in set(terms))
+
+        def rows(csr):
+            data, indices, indptr = (array.tolist() for array in csr)
+
+            return [list(zip(indices[begin:end], data[begin:end]))
+                    for begin, end in zip(indptr, indptr[1:])]
+
+        for num_threads in (1, 2):
+            self.assertEqual(
+                rows(self.index.to_csr(num_threads=num_threads)),
+                [bow(int_doc_id) for int_doc_id in (1, 2, 3)])
+
+        self.assertEqual(rows(self.index.to_csr(start=2, end=4, min_df=2)),
+                         [bow(2, min_df=2), bow(3, min_df=2)])
+
+        self.assertEqual(rows(self.index.to_csr(start=2, end=2)), [])
+
+    def test_iter_documents(self):
+        for batch_size in (1, 2, 1024):
+            documents = [
+                (int_doc_id, tuple(terms.tolist()))
+                for int_doc_id, terms in self.index.iter_documents(
+                    batch_size=batch_size)]
+
+            self.assertEqual(
+                documents,
+                [(int_doc_id, self.index.document(int_doc_id)[1])
+                 for int_doc_id in range(self.index.document_base(),
+                                         self.index.maximum_document())])
+
+        self.assertEqual(
+            [int_doc_id
+             for int_doc_id, _ in self.index.iter_documents(start=2, end=3)],
+            [2])
+
+        self.assertEqual(list(self.index.iter_documents(start=2, end=2)), [])
+
+        with self.assertRaises(IndexError):
+            self.index.iter_documents(start=0)
+
     def test_iter_index(self):
         ext_doc_ids = [
             self.index.document(int_doc_id)[0]